@@ -8,14 +8,11 @@
 #include "attacks.h"
 #include "utils.h"
 
-#include <functional>
-#include <vector>
-#ifdef USE_PEXT
-#include <immintrin.h>
-#endif
+#include <array>
+#include <type_traits>
 
 namespace {
-    const uint64_t BMagic[64] =
+    constexpr uint64_t BMagic[64] =
     {
         0x0048610528020080ULL, 0x00c4100212410004ULL, 0x0004180181002010ULL, 0x0004040188108502ULL,
         0x0012021008003040ULL, 0x0002900420228000ULL, 0x0080808410c00100ULL, 0x000600410c500622ULL,
@@ -35,7 +32,7 @@ namespace {
         0x000008021020a200ULL, 0x0000414128092100ULL, 0x0000042002024200ULL, 0x0002081204004200ULL
     };
 
-    const uint64_t RMagic[64] =
+    constexpr uint64_t RMagic[64] =
     {
         0x00800011400080a6ULL, 0x004000100120004eULL, 0x0080100008600082ULL, 0x0080080016500080ULL,
         0x0080040008000280ULL, 0x0080020005040080ULL, 0x0080108046000100ULL, 0x0080010000204080ULL,
@@ -55,160 +52,139 @@ namespace {
         0x0011001800021025ULL, 0x00c9000400620811ULL, 0x0032009001080224ULL, 0x001400810044086aULL
     };
 
-    uint64_t KnightMoves[64];
-    uint64_t KingMoves[64];
-    uint64_t PawnCaps[2][64];
-    uint64_t PawnMoves[2][64];
-    uint64_t PawnMoves2[2][64];
-    uint64_t RMagicAttacks[0x19000];
-    uint64_t BMagicAttacks[0x1480];
-
-    struct Magic {
-        uint64_t* offset;
-        uint64_t mask;
-        uint64_t magic;
-        uint64_t shift;
-    };
-    Magic RookMagic[64];
-    Magic BishopMagic[64];
-
-    uint64_t slideAttacks(int sq, uint64_t occ, const std::vector<int>& D) {
-        uint64_t att = 0;
-        for (int d : D) {
-            for (int p = sq, n = sq + d; n >= 0 && n < 64 && abs((n & 7) - (p & 7)) < 2; p = n, n += d) {
-                att |= BitMask[n];
-                if (BitMask[n] & occ) break;
+    template<int N>
+    constexpr std::array<uint64_t, 64> movesTable(const int (&D)[N]) {
+        std::array<uint64_t, 64> A{};
+        for (int i = 0; i < 0x40; i++) {
+            for (int j : D) {
+                if (Attacks::isStep(i, i + j, 2))
+                    A[i] |= BitMask[i + j];
             }
         }
-        return att;
+        return A;
     }
 
-    size_t sliderIndex(uint64_t occ, Magic& m) {
-#ifdef USE_PEXT
-        return _pext_u64(occ, m.mask);
-#else
-        return ((occ & m.mask) * m.magic) >> m.shift;
-#endif
+#ifdef USE_PEXT16
+    // an attack set never has more than 14 bits, so it is stored as a pext against the empty board attacks
+    // and expanded with pdep: about 210 KB of tables instead of 840 KB
+    constexpr uint16_t compress(uint64_t atks, uint64_t empty) {
+        uint16_t r = 0;
+        for (int bit = 0; empty; empty &= empty - 1, ++bit)
+            if (atks & empty & -empty) r |= 1 << bit;
+        return r;
     }
+#endif
 
-    void initSliderTable(uint64_t atktable[], const uint64_t magics[], Magic mtable[], const std::vector<int>& dir) {
-        mtable[0].offset = atktable;
+    // firstdir 0 builds the bishop table, 1 the rook table
+    template<size_t Size, bool Pext>
+    constexpr auto sliderTable(const uint64_t (&magics)[64], int firstdir) {
+        Attacks::slider_table_t<Size, std::conditional_t<Pext, Attacks::pext_entry_t, uint64_t>> t{};
+        uint32_t offset = 0;
         for (int s = 0; s < 0x40; s++) {
-            Magic& m = mtable[s];
+            Attacks::magic_t& m = t.magics[s];
             m.magic = magics[s];
-            m.mask = slideAttacks(s, 0, dir) & ~(((Rank1BB | Rank8BB) & ~RankBB[sqRank(s)]) | ((FileABB | FileHBB) & ~FileBB[sqFile(s)]));
-            m.shift = 64 - Utils::bitCnt(m.mask);
-            if (s < 63) mtable[s + 1].offset = m.offset + (1ull << Utils::bitCnt(m.mask));
-            uint64_t occ = 0;
+            m.mask = Attacks::slideAttacksBB(s, 0, firstdir) & ~(((Rank1BB | Rank8BB) & ~RankBB[sqRank(s)]) | ((FileABB | FileHBB) & ~FileBB[sqFile(s)]));
+            m.shift = 64 - __builtin_popcountll(m.mask);
+#ifdef USE_PEXT16
+            m.empty = Attacks::slideAttacksBB(s, 0, firstdir);
+#endif
+            m.offset = offset;
+            uint64_t occ = 0, idx = 0;
             do {
-                m.offset[sliderIndex(occ, m)] = slideAttacks(s, occ, dir);
+                if constexpr (!Pext)
+                    t.attacks[offset + ((occ * m.magic) >> m.shift)] = Attacks::slideAttacksBB(s, occ, firstdir);
+#ifdef USE_PEXT16
+                else t.attacks[offset + idx++] = compress(Attacks::slideAttacksBB(s, occ, firstdir), m.empty);
+#else
+                // the carry-rippler visits the subsets of the mask in pext index order
+                else t.attacks[offset + idx++] = Attacks::slideAttacksBB(s, occ, firstdir);
+#endif
                 occ = (occ - m.mask) & m.mask;
             } while (occ);
+            offset += 1u << (64 - m.shift);
         }
+        return t;
     }
+}
 
-    void initMovesTable(const std::vector<int>& D, uint64_t A[]) {
-        for (int i = 0; i < 0x40; i++) {
-            for (int j : D) {
-                int n = i + j;
-                if (n >= 0 && n < 64 && abs((n & 7) - (i & 7)) <= 2)
-                    A[i] |= BitMask[n];
-            }
-        }
-    }
-    uint64_t shiftLeft(uint64_t b, int i) {
-        return (b << i);
-    }
-    uint64_t shiftRight(uint64_t b, int i) {
-        return (b >> i);
-    }
-    uint64_t shiftLeft8(uint64_t b) {
-        return (b << 8);
-    }
-    uint64_t shiftRight8(uint64_t b) {
-        return (b >> 8);
-    }
-    uint64_t shiftLeft16(uint64_t b) {
-        return (b << 16);
-    }
-    uint64_t shiftRight16(uint64_t b) {
-        return (b >> 16);
-    }
-    uint64_t fillUp(uint64_t b) {
-        return b |= b << 8, b |= b << 16, b |= b << 32;
-    }
-    uint64_t fillDown(uint64_t b) {
-        return b |= b >> 8, b |= b >> 16, b |= b >> 32;
-    }
-    uint64_t fillUpEx(uint64_t b) {
-        return b |= b << 8, b |= b << 16, (b |= b << 32) << 8;
-    }
-    uint64_t fillDownEx(uint64_t b) {
-        return b |= b >> 8, b |= b >> 16, (b |= b >> 32) >> 8;
+#ifdef USE_KOGGE_STONE
+#include <immintrin.h>
+
+namespace {
+    // one direction per 64-bit lane: lanes shifting left use lshift, lanes shifting right use rshift,
+    // the other count is 64 which zeroes the lane in vpsllvq/vpsrlvq
+    struct avx2_dirs_t {
+        int64_t lshift[4];
+        int64_t rshift[4];
+        uint64_t wrap[4]; // squares a step can land on without wrapping around the board edge
+    };
+    constexpr uint64_t NotFileA = ~FileABB, NotFileH = ~FileHBB;
+    constexpr uint64_t NotFileAB = ~(FileABB | FileBBB), NotFileGH = ~(FileGBB | FileHBB);
+    constexpr avx2_dirs_t KnightDirs1 = { { 17, 15, 64, 64 }, { 64, 64, 15, 17 }, { NotFileA, NotFileH, NotFileA, NotFileH } };
+    constexpr avx2_dirs_t KnightDirs2 = { { 10, 6, 64, 64 }, { 64, 64, 6, 10 }, { NotFileAB, NotFileGH, NotFileAB, NotFileGH } };
+    constexpr avx2_dirs_t DiagonalDirs = { { 9, 7, 64, 64 }, { 64, 64, 7, 9 }, { NotFileA, NotFileH, NotFileA, NotFileH } };
+    constexpr avx2_dirs_t OrthogonalDirs = { { 8, 1, 64, 64 }, { 64, 64, 8, 1 }, { ~0ull, NotFileA, ~0ull, NotFileH } };
+
+    __attribute__((target("avx2"))) inline __m256i shift4(__m256i b, __m256i lshift, __m256i rshift) {
+        return _mm256_or_si256(_mm256_sllv_epi64(b, lshift), _mm256_srlv_epi64(b, rshift));
+    }
+    __attribute__((target("avx2"))) inline __m256i steps4(uint64_t b, const avx2_dirs_t& d) {
+        const __m256i l = _mm256_loadu_si256((const __m256i*)d.lshift), r = _mm256_loadu_si256((const __m256i*)d.rshift);
+        return _mm256_and_si256(shift4(_mm256_set1_epi64x(b), l, r), _mm256_loadu_si256((const __m256i*)d.wrap));
+    }
+    // Kogge-Stone occluded fill in four directions at once
+    __attribute__((target("avx2"))) inline __m256i slides4(uint64_t b, uint64_t empty, const avx2_dirs_t& d) {
+        const __m256i wrap = _mm256_loadu_si256((const __m256i*)d.wrap);
+        const __m256i l1 = _mm256_loadu_si256((const __m256i*)d.lshift), r1 = _mm256_loadu_si256((const __m256i*)d.rshift);
+        const __m256i l2 = _mm256_slli_epi64(l1, 1), r2 = _mm256_slli_epi64(r1, 1);
+        const __m256i l4 = _mm256_slli_epi64(l1, 2), r4 = _mm256_slli_epi64(r1, 2);
+        __m256i gen = _mm256_set1_epi64x(b);
+        __m256i prop = _mm256_and_si256(_mm256_set1_epi64x(empty), wrap);
+        gen = _mm256_or_si256(gen, _mm256_and_si256(prop, shift4(gen, l1, r1)));
+        prop = _mm256_and_si256(prop, shift4(prop, l1, r1));
+        gen = _mm256_or_si256(gen, _mm256_and_si256(prop, shift4(gen, l2, r2)));
+        prop = _mm256_and_si256(prop, shift4(prop, l2, r2));
+        gen = _mm256_or_si256(gen, _mm256_and_si256(prop, shift4(gen, l4, r4)));
+        return _mm256_and_si256(shift4(gen, l1, r1), wrap);
+    }
+    __attribute__((target("avx2"))) inline uint64_t or4(__m256i b) {
+        const __m128i x = _mm_or_si128(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1));
+        return _mm_cvtsi128_si64(_mm_or_si128(x, _mm_unpackhi_epi64(x, x)));
     }
 }
+#endif
 
 namespace Attacks {
-    void initArr(void) {
-        initMovesTable({ -17, -10, 6, 15, 17, 10, -6, -15 }, KnightMoves);
-        initMovesTable({ -9, -1, 7, 8, 9, 1, -7, -8 }, KingMoves);
-        initMovesTable({ 8 }, PawnMoves[WHITE]);
-        initMovesTable({ -8 }, PawnMoves[BLACK]);
-        initMovesTable({ 7, 9 }, PawnCaps[WHITE]);
-        initMovesTable({ -7, -9 }, PawnCaps[BLACK]);
-        initMovesTable({ 16 }, PawnMoves2[WHITE]);
-        initMovesTable({ -16 }, PawnMoves2[BLACK]);
-
-        initSliderTable(RMagicAttacks, RMagic, RookMagic, { -1, 8, 1, -8 });
-        initSliderTable(BMagicAttacks, BMagic, BishopMagic, { -9, 7, 9, -7 });
-    }
+    constexpr std::array<uint64_t, 64> KnightMoves = movesTable({ -17, -10, 6, 15, 17, 10, -6, -15 });
+    constexpr std::array<uint64_t, 64> KingMoves = movesTable({ -9, -1, 7, 8, 9, 1, -7, -8 });
+    constexpr std::array<uint64_t, 64> PawnCaps[2] = { movesTable({ 7, 9 }), movesTable({ -7, -9 }) };
+    constexpr std::array<uint64_t, 64> PawnMoves[2] = { movesTable({ 8 }), movesTable({ -8 }) };
+    constexpr std::array<uint64_t, 64> PawnMoves2[2] = { movesTable({ 16 }), movesTable({ -16 }) };
+    constexpr slider_table_t<0x19000, uint64_t> RookTable = sliderTable<0x19000, false>(RMagic, 1);
+    constexpr slider_table_t<0x1480, uint64_t> BishopTable = sliderTable<0x1480, false>(BMagic, 0);
+#ifdef USE_PEXT
+    constexpr slider_table_t<0x19000, pext_entry_t> RookPextTable = sliderTable<0x19000, true>(RMagic, 1);
+    constexpr slider_table_t<0x1480, pext_entry_t> BishopPextTable = sliderTable<0x1480, true>(BMagic, 0);
+#endif
 
-    uint64_t pawnMovesBB(int from, uint64_t s) {
-        return PawnMoves[s][from];
-    }
-    uint64_t pawnMoves2BB(int from, uint64_t s) {
-        return PawnMoves2[s][from];
-    }
-    uint64_t pawnAttacksBB(int from, uint64_t s) {
-        return PawnCaps[s][from];
-    }
-    uint64_t knightAttacksBB(int from, uint64_t occ) {
-        return KnightMoves[from];
-    }
-    uint64_t bishopAttacksBB(int from, uint64_t occ) {
-        return BishopMagic[from].offset[sliderIndex(occ, BishopMagic[from])];
-    }
-    uint64_t rookAttacksBB(int from, uint64_t occ) {
-        return RookMagic[from].offset[sliderIndex(occ, RookMagic[from])];
-    }
-    uint64_t queenAttacksBB(int from, uint64_t occ) {
-        return bishopAttacksBB(from, occ) | rookAttacksBB(from, occ);
-    }
-    uint64_t bishopAttacksBBX(int from, uint64_t occ) {
-        return bishopAttacksBB(from, occ & ~(bishopAttacksBB(from, occ) & occ));
-    }
-    uint64_t rookAttacksBBX(int from, uint64_t occ) {
-        return rookAttacksBB(from, occ & ~(rookAttacksBB(from, occ) & occ));
-    }
-    uint64_t kingAttacksBB(int from, uint64_t occ) {
-        return KingMoves[from];
-    }
-    uint64_t knightMovesBB(int from) {
-        return KnightMoves[from];
-    }
-    uint64_t kingMovesBB(int from) {
-        return KingMoves[from];
+    const char* sliderBackend() {
+#ifdef USE_PEXT
+#ifdef USE_PEXT16
+        if (pextSliders(Utils::CpuPath)) return "pext16";
+#else
+        if (pextSliders(Utils::CpuPath)) return "pext";
+#endif
+#endif
+        return "magic";
     }
-    std::function<uint64_t(uint64_t, int i)> shiftBB[2] = { shiftLeft, shiftRight };
-    std::function<uint64_t(uint64_t)> shift8BB[2] = { shiftLeft8, shiftRight8 };
-    std::function<uint64_t(uint64_t)> shift16BB[2] = { shiftLeft16, shiftRight16 };
-    std::function<uint64_t(uint64_t)> fillBB[2] = { fillUp, fillDown };
-    std::function<uint64_t(uint64_t)> fillBBEx[2] = { fillUpEx, fillDownEx };
 
-    uint64_t pawnAttackBB(uint64_t pawns, size_t color) {
-        const int Shift[] = { 9, 7 };
-        uint64_t pawnAttackLeft = shiftBB[color](pawns, Shift[color ^ 1]) & ~FileHBB;
-        uint64_t pawnAttackright = shiftBB[color](pawns, Shift[color]) & ~FileABB;
-        return (pawnAttackLeft | pawnAttackright);
+#ifdef USE_KOGGE_STONE
+    __attribute__((target("avx2"))) void setwiseAttacksAVX2(uint64_t knights, uint64_t bishops, uint64_t rooks, uint64_t queens,
+        uint64_t bempty, uint64_t rempty, uint64_t qempty, uint64_t atks[4]) {
+        atks[0] = or4(_mm256_or_si256(steps4(knights, KnightDirs1), steps4(knights, KnightDirs2)));
+        atks[1] = or4(slides4(bishops, bempty, DiagonalDirs));
+        atks[2] = or4(slides4(rooks, rempty, OrthogonalDirs));
+        atks[3] = or4(_mm256_or_si256(slides4(queens, qempty, DiagonalDirs), slides4(queens, qempty, OrthogonalDirs)));
     }
-}
\ No newline at end of file
+#endif
+}
@@ -6,26 +6,181 @@
 
 #pragma once
 
-#include <functional>
+#include "typedefs.h"
+#include "utils.h"
+
+#include <array>
 
 namespace Attacks {
-    extern void initArr(void);
-    extern uint64_t knightAttacksBB(int from, uint64_t occ);
-    extern uint64_t pawnMovesBB(int from, uint64_t s);
-    extern uint64_t pawnMoves2BB(int from, uint64_t s);
-    extern uint64_t pawnAttacksBB(int from, uint64_t s);
-    extern uint64_t bishopAttacksBB(int from, uint64_t occ);
-    extern uint64_t bishopAttacksBBX(int from, uint64_t occ);
-    extern uint64_t rookAttacksBB(int from, uint64_t occ);
-    extern uint64_t rookAttacksBBX(int from, uint64_t occ);
-    extern uint64_t queenAttacksBB(int from, uint64_t occ);
-    extern uint64_t kingAttacksBB(int from, uint64_t occ);
-
-    extern uint64_t knightMovesBB(int from);
-    extern uint64_t kingMovesBB(int from);
-    extern std::function<uint64_t(uint64_t)> shift8BB[2];
-    extern std::function<uint64_t(uint64_t)> shift16BB[2];
-    extern std::function<uint64_t(uint64_t)> fillBB[2];
-    extern std::function<uint64_t(uint64_t)> fillBBEx[2];
-    extern uint64_t pawnAttackBB(uint64_t pawns, size_t color);
+    struct magic_t {
+        uint64_t mask;
+        uint64_t magic;
+        uint32_t offset;
+        uint32_t shift;
+#ifdef USE_PEXT16
+        uint64_t empty; // attacks on the empty board, entries are pext-ed against it
+#endif
+    };
+
+    template<size_t Size, typename Entry>
+    struct slider_table_t {
+        magic_t magics[64];
+        Entry attacks[Size];
+    };
+
+#ifdef USE_PEXT16
+    using pext_entry_t = uint16_t;
+#else
+    using pext_entry_t = uint64_t;
+#endif
+
+    // built at compile time in attacks.cpp
+    extern const std::array<uint64_t, 64> KnightMoves;
+    extern const std::array<uint64_t, 64> KingMoves;
+    extern const std::array<uint64_t, 64> PawnCaps[2];
+    extern const std::array<uint64_t, 64> PawnMoves[2];
+    extern const std::array<uint64_t, 64> PawnMoves2[2];
+    extern const slider_table_t<0x19000, uint64_t> RookTable;
+    extern const slider_table_t<0x1480, uint64_t> BishopTable;
+#ifdef USE_PEXT
+    // only touched by the bmi2 path
+    extern const slider_table_t<0x19000, pext_entry_t> RookPextTable;
+    extern const slider_table_t<0x1480, pext_entry_t> BishopPextTable;
+#endif
+
+    template<size_t Size>
+    inline uint64_t magicAttacks(const slider_table_t<Size, uint64_t>& table, int from, uint64_t occ) {
+        const magic_t& m = table.magics[from];
+        return table.attacks[m.offset + (((occ & m.mask) * m.magic) >> m.shift)];
+    }
+
+#ifdef USE_PEXT
+    template<size_t Size>
+    inline uint64_t pextAttacks(const slider_table_t<Size, pext_entry_t>& table, int from, uint64_t occ) {
+        const magic_t& m = table.magics[from];
+#ifdef USE_PEXT16
+        return Utils::pdep(table.attacks[m.offset + Utils::pext(occ, m.mask)], m.empty);
+#else
+        return table.attacks[m.offset + Utils::pext(occ, m.mask)];
+#endif
+    }
+#endif
+
+    inline uint64_t pawnMovesBB(int from, uint64_t s) {
+        return PawnMoves[s][from];
+    }
+    inline uint64_t pawnMoves2BB(int from, uint64_t s) {
+        return PawnMoves2[s][from];
+    }
+    inline uint64_t pawnAttacksBB(int from, uint64_t s) {
+        return PawnCaps[s][from];
+    }
+    inline uint64_t knightMovesBB(int from) {
+        return KnightMoves[from];
+    }
+    inline uint64_t kingMovesBB(int from) {
+        return KingMoves[from];
+    }
+
+    // the slider lookups of one cpu path, see Utils::withCpuPath
+    template<int path>
+    inline uint64_t bishopAttacksBB(int from, uint64_t occ) {
+#ifdef USE_PEXT
+        if constexpr (pextSliders(path)) return pextAttacks(BishopPextTable, from, occ);
+#endif
+        return magicAttacks(BishopTable, from, occ);
+    }
+    template<int path>
+    inline uint64_t rookAttacksBB(int from, uint64_t occ) {
+#ifdef USE_PEXT
+        if constexpr (pextSliders(path)) return pextAttacks(RookPextTable, from, occ);
+#endif
+        return magicAttacks(RookTable, from, occ);
+    }
+    template<int path>
+    inline uint64_t queenAttacksBB(int from, uint64_t occ) {
+        return bishopAttacksBB<path>(from, occ) | rookAttacksBB<path>(from, occ);
+    }
+    template<int path>
+    inline uint64_t bishopAttacksBBX(int from, uint64_t occ) {
+        return bishopAttacksBB<path>(from, occ & ~(bishopAttacksBB<path>(from, occ) & occ));
+    }
+    template<int path>
+    inline uint64_t rookAttacksBBX(int from, uint64_t occ) {
+        return rookAttacksBB<path>(from, occ & ~(rookAttacksBB<path>(from, occ) & occ));
+    }
+
+    // for code outside the kernels, decided on every call
+    inline uint64_t bishopAttacksBB(int from, uint64_t occ) {
+        return pextSliders(Utils::CpuPath) ? bishopAttacksBB<CPU_BMI2>(from, occ) : bishopAttacksBB<CPU_GENERIC>(from, occ);
+    }
+    inline uint64_t rookAttacksBB(int from, uint64_t occ) {
+        return pextSliders(Utils::CpuPath) ? rookAttacksBB<CPU_BMI2>(from, occ) : rookAttacksBB<CPU_GENERIC>(from, occ);
+    }
+    inline uint64_t queenAttacksBB(int from, uint64_t occ) {
+        return bishopAttacksBB(from, occ) | rookAttacksBB(from, occ);
+    }
+
+    extern const char* sliderBackend();
+
+#ifdef USE_KOGGE_STONE
+    // union of the attacks of every knight, bishop, rook and queen in the sets, sliders stopping at
+    // the first square not in their empty set; only valid when Utils::cpuHas(CPU_AVX2)
+    extern void setwiseAttacksAVX2(uint64_t knights, uint64_t bishops, uint64_t rooks, uint64_t queens,
+        uint64_t bempty, uint64_t rempty, uint64_t qempty, uint64_t atks[4]);
+#endif
+
+    template<int c>
+    constexpr uint64_t shift8BB(uint64_t b) {
+        return c == WHITE ? b << 8 : b >> 8;
+    }
+    template<int c>
+    constexpr uint64_t shift16BB(uint64_t b) {
+        return c == WHITE ? b << 16 : b >> 16;
+    }
+    template<int c>
+    constexpr uint64_t fillBB(uint64_t b) {
+        return c == WHITE
+            ? (b |= b << 8, b |= b << 16, b | b << 32)
+            : (b |= b >> 8, b |= b >> 16, b | b >> 32);
+    }
+    template<int c>
+    constexpr uint64_t fillBBEx(uint64_t b) {
+        return shift8BB<c>(fillBB<c>(b));
+    }
+    template<int c>
+    constexpr uint64_t pawnCapsWestBB(uint64_t b) {
+        return (c == WHITE ? b << 7 : b >> 9) & ~FileHBB;
+    }
+    template<int c>
+    constexpr uint64_t pawnCapsEastBB(uint64_t b) {
+        return (c == WHITE ? b << 9 : b >> 7) & ~FileABB;
+    }
+    template<int c>
+    constexpr uint64_t pawnAttackBB(uint64_t pawns) {
+        return pawnCapsWestBB<c>(pawns) | pawnCapsEastBB<c>(pawns);
+    }
+    inline uint64_t pawnAttackBB(uint64_t pawns, int c) {
+        return c == WHITE ? pawnAttackBB<WHITE>(pawns) : pawnAttackBB<BLACK>(pawns);
+    }
+
+    // compile-time helpers for the attack tables; even directions are diagonal, odd ones orthogonal
+    constexpr int KingDirs[8] = { -9, -1, 7, 8, 9, 1, -7, -8 };
+    constexpr bool isStep(int from, int to, int maxfiles) {
+        return to >= 0 && to < 64 && (to & 7) - (from & 7) <= maxfiles && (from & 7) - (to & 7) <= maxfiles;
+    }
+    constexpr uint64_t rayBB(int sq, int dir) {
+        uint64_t ray = 0;
+        for (int p = sq, n = sq + dir; isStep(p, n, 1); p = n, n += dir) ray |= BitMask[n];
+        return ray;
+    }
+    constexpr uint64_t slideAttacksBB(int sq, uint64_t occ, int firstdir) {
+        uint64_t atks = 0;
+        for (int k = firstdir; k < 8; k += 2) {
+            uint64_t ray = rayBB(sq, KingDirs[k]), blockers = ray & occ;
+            if (blockers) ray ^= rayBB(KingDirs[k] > 0 ? __builtin_ctzll(blockers) : 63 - __builtin_clzll(blockers), KingDirs[k]);
+            atks |= ray;
+        }
+        return atks;
+    }
 }
\ No newline at end of file
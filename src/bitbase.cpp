@@ -0,0 +1,213 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#include <algorithm>
+#include <vector>
+#include "typedefs.h"
+#include "bitbase.h"
+#include "attacks.h"
+#include "utils.h"
+
+using namespace Attacks;
+using namespace Utils;
+
+namespace {
+    // 2 sides to move x 24 pawn squares (a2-d7) x 64 x 64 king squares
+    constexpr int KPKSize = 2 * 24 * 64 * 64;
+
+    // 2 sides to move x 24 pawn squares (a2-d7) x 64 x 64 x 64 king and rook squares
+    constexpr int KRKPSize = 2 * 24 * 64 * 64 * 64;
+
+    // results from white's view; in KRKP a draw stands for anything but a win
+    enum Results { RES_INVALID = 0, RES_UNKNOWN = 1, RES_DRAW = 2, RES_WIN = 4 };
+
+    inline int kpkIndex(int stm, int bksq, int wksq, int psq) {
+        return wksq | (bksq << 6) | (stm << 12) | (sqFile(psq) << 13) | ((Rank7 - sqRank(psq)) << 15);
+    }
+
+    inline int krkpIndex(int stm, int bksq, int wksq, int wrsq, int psq) {
+        return wksq | (bksq << 6) | (wrsq << 12) | (stm << 18) | (sqFile(psq) << 19) | ((sqRank(psq) - Rank2) << 21);
+    }
+
+    inline int distance(int a, int b) {
+        return std::max(abs(sqFile(a) - sqFile(b)), abs(sqRank(a) - sqRank(b)));
+    }
+
+    struct kpk_bitbase_t {
+        kpk_bitbase_t();
+        uint64_t bits[KPKSize / 64] = {};
+    };
+
+    // positions that are decided on the board first, then every unknown position takes the best result
+    // of its moves for the side to move, repeated until nothing changes
+    kpk_bitbase_t::kpk_bitbase_t() {
+        std::vector<uint8_t> db(KPKSize);
+        for (int idx = 0; idx < KPKSize; ++idx) {
+            const int wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F, stm = (idx >> 12) & 1;
+            const int psq = (Rank7 - ((idx >> 15) & 7)) * 8 + ((idx >> 13) & 3);
+            if (distance(wksq, bksq) <= 1 || wksq == psq || bksq == psq
+                || (stm == WHITE && (pawnAttacksBB(psq, WHITE) & BitMask[bksq])))
+                db[idx] = RES_INVALID;
+            else if (stm == WHITE && sqRank(psq) == Rank7 && wksq != psq + 8
+                && (distance(bksq, psq + 8) > 1 || distance(wksq, psq + 8) == 1))
+                db[idx] = RES_WIN; // promotes safely
+            else if (stm == BLACK && (!(kingMovesBB(bksq) & ~(kingMovesBB(wksq) | pawnAttacksBB(psq, WHITE)))
+                || (kingMovesBB(bksq) & ~kingMovesBB(wksq) & BitMask[psq])))
+                db[idx] = RES_DRAW; // stalemate or the pawn falls
+            else
+                db[idx] = RES_UNKNOWN;
+        }
+
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (int idx = 0; idx < KPKSize; ++idx) {
+                if (db[idx] != RES_UNKNOWN) continue;
+                const int wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F, stm = (idx >> 12) & 1;
+                const int psq = (Rank7 - ((idx >> 15) & 7)) * 8 + ((idx >> 13) & 3);
+                const int good = stm == WHITE ? RES_WIN : RES_DRAW;
+                const int bad = stm == WHITE ? RES_DRAW : RES_WIN;
+                int r = RES_INVALID;
+                for (uint64_t b = kingMovesBB(stm == WHITE ? wksq : bksq); b;) {
+                    const int to = popFirstBit(b);
+                    r |= stm == WHITE ? db[kpkIndex(BLACK, bksq, to, psq)] : db[kpkIndex(WHITE, to, wksq, psq)];
+                }
+                if (stm == WHITE) {
+                    if (sqRank(psq) < Rank7) r |= db[kpkIndex(BLACK, bksq, wksq, psq + 8)];
+                    if (sqRank(psq) == Rank2 && psq + 8 != wksq && psq + 8 != bksq)
+                        r |= db[kpkIndex(BLACK, bksq, wksq, psq + 16)];
+                }
+                db[idx] = r & good ? good : r & RES_UNKNOWN ? RES_UNKNOWN : bad;
+                changed |= db[idx] != RES_UNKNOWN;
+            }
+        }
+
+        for (int idx = 0; idx < KPKSize; ++idx)
+            if (db[idx] == RES_WIN) bits[idx / 64] |= 1ULL << (idx % 64);
+    }
+
+    // KRK with black to move is won unless black takes the rook or is stalemated
+    bool krkWins(int wksq, int wrsq, int bksq) {
+        const uint64_t ratks = rookAttacksBB(wrsq, BitMask[wksq] | BitMask[wrsq]);
+        if (BitMask[wrsq] & kingMovesBB(bksq) & ~kingMovesBB(wksq)) return false;
+        return (kingMovesBB(bksq) & ~kingMovesBB(wksq) & ~ratks & ~BitMask[wrsq]) || (ratks & BitMask[bksq]);
+    }
+
+    struct krkp_bitbase_t {
+        krkp_bitbase_t();
+        uint64_t bits[KRKPSize / 64] = {};
+    };
+
+    // the same iteration as KPK. Black leaving the four pieces (taking the rook, or promoting to a piece
+    // white cannot take at once) counts as a draw, so a win here is always a win
+    krkp_bitbase_t::krkp_bitbase_t() {
+        std::vector<uint8_t> db(KRKPSize);
+        std::vector<int> unknown;
+        // a pawn move only leads to a more advanced pawn, so the slices of one pawn square are solved from
+        // rank 2 up, each one small enough to stay in cache
+        for (int base = 0; base < KRKPSize; base += KRKPSize / 24) {
+            unknown.clear();
+            for (int idx = base; idx < base + KRKPSize / 24; ++idx) {
+                const int wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F, wrsq = (idx >> 12) & 0x3F, stm = (idx >> 18) & 1;
+                const int psq = (Rank2 + (idx >> 21)) * 8 + ((idx >> 19) & 3);
+                const uint64_t occ = BitMask[wksq] | BitMask[bksq] | BitMask[wrsq] | BitMask[psq];
+                const uint64_t ratks = rookAttacksBB(wrsq, occ);
+                if (distance(wksq, bksq) <= 1 || wksq == wrsq || wksq == psq || bksq == wrsq || bksq == psq || wrsq == psq
+                    || (stm == WHITE && (ratks & BitMask[bksq])) || (stm == BLACK && (pawnAttacksBB(psq, BLACK) & BitMask[wksq])))
+                    db[idx] = RES_INVALID;
+                else {
+                    db[idx] = RES_UNKNOWN;
+                    unknown.push_back(idx);
+                }
+            }
+
+            for (bool changed = true; changed;) {
+                changed = false;
+                size_t left = 0;
+                for (int idx : unknown) {
+                    const int wksq = idx & 0x3F, bksq = (idx >> 6) & 0x3F, wrsq = (idx >> 12) & 0x3F, stm = (idx >> 18) & 1;
+                    const int psq = (Rank2 + (idx >> 21)) * 8 + ((idx >> 19) & 3);
+                    const uint64_t occ = BitMask[wksq] | BitMask[bksq] | BitMask[wrsq] | BitMask[psq];
+                    int r = RES_INVALID;
+                    if (stm == WHITE) {
+                        for (uint64_t b = kingMovesBB(wksq) & ~kingMovesBB(bksq) & ~pawnAttacksBB(psq, BLACK) & ~BitMask[wrsq]; b && !(r & RES_WIN);) {
+                            const int to = popFirstBit(b);
+                            r |= to == psq ? (krkWins(to, wrsq, bksq) ? RES_WIN : RES_DRAW) : db[krkpIndex(BLACK, bksq, to, wrsq, psq)];
+                        }
+                        // against a pawn check the rook can only take the pawn
+                        uint64_t rookto = rookAttacksBB(wrsq, occ) & ~BitMask[wksq];
+                        if (pawnAttacksBB(psq, BLACK) & BitMask[wksq]) rookto &= BitMask[psq];
+                        for (uint64_t b = rookto; b && !(r & RES_WIN);) {
+                            const int to = popFirstBit(b);
+                            r |= to == psq ? (krkWins(wksq, to, bksq) ? RES_WIN : RES_DRAW) : db[krkpIndex(BLACK, bksq, wksq, to, psq)];
+                        }
+                    }
+                    else {
+                        int moves = 0;
+                        const uint64_t ratks = rookAttacksBB(wrsq, occ ^ BitMask[bksq]);
+                        for (uint64_t b = kingMovesBB(bksq) & ~kingMovesBB(wksq) & ~BitMask[psq] & (~ratks | BitMask[wrsq]); b && !(r & RES_DRAW); ++moves) {
+                            const int to = popFirstBit(b);
+                            r |= to == wrsq ? RES_DRAW : db[krkpIndex(WHITE, to, wksq, wrsq, psq)];
+                        }
+                        uint64_t tobits = BitMask[psq - 8] & ~occ;
+                        if (sqRank(psq) == Rank7 && tobits) tobits |= BitMask[psq - 16] & ~occ;
+                        tobits |= pawnAttacksBB(psq, BLACK) & BitMask[wrsq];
+                        while (tobits && !(r & RES_DRAW)) {
+                            const int to = popFirstBit(tobits);
+                            const uint64_t newocc = occ ^ BitMask[psq] ^ (to == wrsq ? 0 : BitMask[to]);
+                            if (to != wrsq && (rookAttacksBB(wrsq, newocc) & BitMask[bksq])) continue; // leaves the king in check
+                            ++moves;
+                            if (to == wrsq) r |= RES_DRAW;
+                            else if (sqRank(to) == Rank1) {
+                                // white has to take the new piece at once
+                                const bool byking = (kingMovesBB(wksq) & BitMask[to]) && !(kingMovesBB(bksq) & BitMask[to]);
+                                const bool byrook = rookAttacksBB(wrsq, newocc) & BitMask[to];
+                                r |= (byking && krkWins(to, wrsq, bksq)) || (byrook && krkWins(wksq, to, bksq)) ? RES_WIN : RES_DRAW;
+                            }
+                            else r |= db[krkpIndex(WHITE, bksq, wksq, wrsq, to)];
+                        }
+                        if (!moves) r = (ratks & BitMask[bksq]) ? RES_WIN : RES_DRAW;
+                    }
+                    const int good = stm == WHITE ? RES_WIN : RES_DRAW;
+                    const int bad = stm == WHITE ? RES_DRAW : RES_WIN;
+                    db[idx] = r & good ? good : r & RES_UNKNOWN ? RES_UNKNOWN : bad;
+                    if (db[idx] == RES_UNKNOWN) unknown[left++] = idx;
+                    else changed = true;
+                }
+                unknown.resize(left);
+            }
+        }
+        // what is still unknown never reaches a win
+        for (int idx = 0; idx < KRKPSize; ++idx)
+            if (db[idx] == RES_WIN) bits[idx / 64] |= 1ULL << (idx % 64);
+    }
+
+    // solved by the first caller, thread safe
+    const kpk_bitbase_t& kpk() {
+        static const kpk_bitbase_t KPK;
+        return KPK;
+    }
+    const krkp_bitbase_t& krkp() {
+        static const krkp_bitbase_t KRKP;
+        return KRKP;
+    }
+}
+
+namespace Bitbases {
+    void init() {
+        kpk();
+        krkp();
+    }
+
+    bool probeKPK(int wksq, int wpsq, int bksq, int stm) {
+        const int idx = kpkIndex(stm, bksq, wksq, wpsq);
+        return kpk().bits[idx / 64] & (1ULL << (idx % 64));
+    }
+
+    bool probeKRKP(int wksq, int wrsq, int bksq, int bpsq, int stm) {
+        const int idx = krkpIndex(stm, bksq, wksq, wrsq, bpsq);
+        return krkp().bits[idx / 64] & (1ULL << (idx % 64));
+    }
+}
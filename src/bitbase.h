@@ -0,0 +1,19 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#pragma once
+
+#include "typedefs.h"
+
+// win/draw bitbases of small endgames, solved by retrograde analysis on first use
+namespace Bitbases {
+    // solves every bitbase now instead of on the first probe, KRKP takes most of a second
+    extern void init();
+    // KPK with the pawn side as white and the pawn on files a-d; true if white wins
+    extern bool probeKPK(int wksq, int wpsq, int bksq, int stm);
+    // KRKP with the rook side as white and the pawn on files a-d; true if white wins
+    extern bool probeKRKP(int wksq, int wrsq, int bksq, int bpsq, int stm);
+}
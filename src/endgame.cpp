@@ -0,0 +1,177 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include "typedefs.h"
+#include "endgame.h"
+#include "position.h"
+#include "bitbase.h"
+#include "params.h"
+#include "utils.h"
+
+using namespace Utils;
+using namespace EvalParam;
+
+namespace {
+    constexpr basic_score_t KnownWin = 1000; // a won ending, clear of any material edge these endings can have
+
+    inline int distance(int a, int b) {
+        return std::max(abs(sqFile(a) - sqFile(b)), abs(sqRank(a) - sqRank(b)));
+    }
+    inline int edgeDistance(int r) {
+        return std::min(r, 7 - r);
+    }
+
+    // bonuses for driving the weak king to the edge or a corner and the kings close to or away from each other
+    inline int pushToEdge(int sq) {
+        const int rd = edgeDistance(sqRank(sq)), fd = edgeDistance(sqFile(sq));
+        return 90 - (7 * fd * fd / 2 + 7 * rd * rd / 2);
+    }
+    inline int pushToCorner(int sq) { // the a1 and h8 corners
+        return abs(7 - sqRank(sq) - sqFile(sq));
+    }
+    inline int pushClose(int a, int b) {
+        return 140 - 20 * distance(a, b);
+    }
+    inline int pushAway(int a, int b) {
+        return 120 - pushClose(a, b);
+    }
+
+    int nonPawnMaterial(position_t& p, int c) {
+        int npm = 0;
+        for (int pc = KNIGHT; pc <= QUEEN; ++pc) npm += Params.MaterialValues[pc].eg() * bitCnt(p.getPieceBB(pc, c));
+        return npm;
+    }
+
+    // lone king against enough material to mate: drive it to the edge, stalemate aside. Without pawns,
+    // bishops of one color or two knights cannot force mate and are a dead draw
+    basic_score_t evalKXK(position_t& p, int strong) {
+        const int weak = strong ^ 1;
+        const uint64_t bishops = p.getPieceBB(BISHOP, strong);
+        const uint64_t knights = p.getPieceBB(KNIGHT, strong);
+        const bool mates = p.getPieceBB(QUEEN, strong) || p.getPieceBB(ROOK, strong) || (bishops && knights)
+            || ((bishops & WhiteSquaresBB) && (bishops & ~WhiteSquaresBB)) || bitCnt(knights) > 2;
+        if (!mates && !p.getPieceBB(PAWN, strong)) return 0;
+        if (p.side == weak) {
+            movelist_t<220> mvlist;
+            p.genLegal(mvlist);
+            if (mvlist.size == 0) return 0;
+        }
+        int score = nonPawnMaterial(p, strong) + bitCnt(p.getPieceBB(PAWN, strong)) * Params.MaterialValues[PAWN].eg()
+            + pushToEdge(p.kpos[weak]) + pushClose(p.kpos[strong], p.kpos[weak]);
+        if (mates) score += KnownWin;
+        return score;
+    }
+
+    // only mates in the corner of the bishop's color
+    basic_score_t evalKBNK(position_t& p, int strong) {
+        const int weak = strong ^ 1;
+        const int ksq = (p.piecesBB[BISHOP] & WhiteSquaresBB) ? p.kpos[weak] ^ 7 : p.kpos[weak];
+        return KnownWin + Params.MaterialValues[BISHOP].eg() + Params.MaterialValues[KNIGHT].eg()
+            + pushClose(p.kpos[strong], p.kpos[weak]) + 40 * pushToCorner(ksq);
+    }
+
+    // won KPK scores rise as the pawn advances so the search pushes it, drawn ones are 0
+    basic_score_t evalKPK(position_t& p, int strong) {
+        // the bitbase has the pawn side as white and the pawn on files a-d
+        const int flip = (strong == WHITE ? 0 : 56) ^ (sqFile(getFirstBit(p.piecesBB[PAWN])) > FileD ? 7 : 0);
+        const int psq = getFirstBit(p.piecesBB[PAWN]) ^ flip;
+        if (!Bitbases::probeKPK(p.kpos[strong] ^ flip, psq, p.kpos[strong ^ 1] ^ flip, p.side == strong ? WHITE : BLACK)) return 0;
+        return KnownWin + Params.MaterialValues[PAWN].eg() + sqRank(psq) * 10;
+    }
+
+    // won KRKP scores rise as the strong king nears the pawn, the rest is left at 0 for the search to
+    // resolve: the bitbase does not tell a draw from a promotion that wins for the pawn side
+    basic_score_t evalKRKP(position_t& p, int strong) {
+        // the bitbase has the rook side as white and the pawn on files a-d
+        const int psq = getFirstBit(p.piecesBB[PAWN]);
+        const int flip = (strong == WHITE ? 0 : 56) ^ (sqFile(psq) > FileD ? 7 : 0);
+        if (!Bitbases::probeKRKP(p.kpos[strong] ^ flip, getFirstBit(p.piecesBB[ROOK]) ^ flip, p.kpos[strong ^ 1] ^ flip,
+            psq ^ flip, p.side == strong ? WHITE : BLACK)) return 0;
+        return KnownWin + Params.MaterialValues[ROOK].eg() - Params.MaterialValues[PAWN].eg() + pushClose(p.kpos[strong], psq);
+    }
+
+    // a win in most cases, but a long one
+    basic_score_t evalKQKR(position_t& p, int strong) {
+        const int weak = strong ^ 1;
+        return Params.MaterialValues[QUEEN].eg() - Params.MaterialValues[ROOK].eg() + pushToEdge(p.kpos[weak]) + pushClose(p.kpos[strong], p.kpos[weak]);
+    }
+
+    // drawn unless the weak king is caught on the edge
+    basic_score_t evalKRKB(position_t& p, int strong) {
+        return pushToEdge(p.kpos[strong ^ 1]);
+    }
+
+    // drawn unless the knight is cut off from its king
+    basic_score_t evalKRKN(position_t& p, int strong) {
+        const int weak = strong ^ 1;
+        return pushToEdge(p.kpos[weak]) + pushAway(p.kpos[weak], getFirstBit(p.piecesBB[KNIGHT]));
+    }
+
+    // bishops and pawns only: opposite colored bishops halve the evaluation
+    basic_score_t scaleOCB(position_t& p, int) {
+        return bitCnt(p.piecesBB[BISHOP] & WhiteSquaresBB) == 1 ? 16 : 32;
+    }
+
+    struct endgame_entry_t {
+        uint8_t ending;
+        int strong;
+    };
+
+    // exact signatures with the strong side first, registered for both colors
+    std::unordered_map<uint64_t, endgame_entry_t> buildRegistry() {
+        static const std::string PieceChars = " PNBRQK";
+        static const std::pair<const char*, Endgames::Endings> Endings[] = {
+            { "KPK", Endgames::ENDING_KPK }, { "KBNK", Endgames::ENDING_KBNK }, { "KQKR", Endgames::ENDING_KQKR },
+            { "KRKB", Endgames::ENDING_KRKB }, { "KRKN", Endgames::ENDING_KRKN }, { "KRKP", Endgames::ENDING_KRKP }
+        };
+        std::unordered_map<uint64_t, endgame_entry_t> registry;
+        for (auto& e : Endings) {
+            const std::string code = e.first;
+            int counts[2][8] = {};
+            for (int i = 0, c = -1; i < (int)code.size(); ++i) {
+                if (code[i] == 'K') ++c;
+                ++counts[c][PieceChars.find(code[i])];
+            }
+            registry[PositionData::materialHash(counts)] = { e.second, WHITE };
+            std::swap(counts[WHITE], counts[BLACK]);
+            registry[PositionData::materialHash(counts)] = { e.second, BLACK };
+        }
+        return registry;
+    }
+}
+
+namespace Endgames {
+    const endgame_fn Evaluators[ENDING_NB] = {
+        nullptr, evalKXK, evalKPK, evalKBNK, evalKQKR, evalKRKB, evalKRKN, evalKRKP, scaleOCB
+    };
+
+    void lookup(position_t& p, material_info_t& mat) {
+        static const std::unordered_map<uint64_t, endgame_entry_t> Registry = buildRegistry();
+        auto setEnding = [&](int ending, int strong) {
+            mat.ending = ending;
+            mat.flags = (mat.flags & ~4) | (strong << 2);
+        };
+        setEnding(ENDING_NONE, WHITE);
+
+        auto it = Registry.find(p.stack.mhash);
+        if (it != Registry.end()) {
+            setEnding(it->second.ending, it->second.strong);
+            return;
+        }
+        for (int c = WHITE; c <= BLACK; ++c) {
+            if (!(p.colorBB[c ^ 1] & ~p.piecesBB[KING]) && nonPawnMaterial(p, c) >= Params.MaterialValues[ROOK].eg()) {
+                setEnding(ENDING_KXK, c);
+                return;
+            }
+        }
+        const uint64_t pieces = p.piecesBB[KNIGHT] | p.piecesBB[BISHOP] | p.piecesBB[ROOK] | p.piecesBB[QUEEN];
+        if (pieces == p.piecesBB[BISHOP] && bitCnt(p.getPieceBB(BISHOP, WHITE)) == 1 && bitCnt(p.getPieceBB(BISHOP, BLACK)) == 1)
+            setEnding(ENDING_OCB, WHITE);
+    }
+}
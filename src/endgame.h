@@ -0,0 +1,25 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#pragma once
+
+#include "typedefs.h"
+
+struct position_t;
+
+// specialised evaluation of known endings, keyed by material signature. Looked up once when a
+// material table entry is filled, so the evaluation only pays an index test. The evaluators read the
+// engine's EvalParam::Params for every score type, the tuner takes their scores as constants
+namespace Endgames {
+    // the exact evaluators replace the general evaluation, the scalings after them scale it out of 32
+    enum Endings {
+        ENDING_NONE, ENDING_KXK, ENDING_KPK, ENDING_KBNK, ENDING_KQKR, ENDING_KRKB, ENDING_KRKN,
+        ENDING_KRKP, ENDING_OCB, ENDING_NB,
+        FIRST_SCALING = ENDING_OCB
+    };
+    extern const endgame_fn Evaluators[ENDING_NB];
+    extern void lookup(position_t& p, material_info_t& mat);
+}
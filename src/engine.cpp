@@ -12,6 +12,8 @@
 #include "eval.h"
 #include "movepicker.h"
 #include "engine.h"
+#include "nnue.h"
+#include "tbprobe.h"
 
 engine_t::engine_t() {
     initUCIoptions();
@@ -77,6 +79,15 @@ void engine_t::initSearch() {
     cutoffcheck_depth = options["Cutoff Check Depth"].getIntVal();
     doNUMA = options["NUMA"].getIntVal();
 
+    bool searchprobes = true;
+    tbcardinality = std::min(options["SyzygyProbeLimit"].getIntVal(), Tablebases::MaxCardinality);
+    tbrootmoves.size = 0;
+    tbroothits = 0;
+    if (tbcardinality && Utils::bitCnt(origpos.occupiedBB) <= tbcardinality) {
+        tbroothits = Tablebases::rootProbe(origpos, tbrootmoves, searchprobes);
+        if (!searchprobes) tbcardinality = 0;
+    }
+
     if (doSMP = size() > 1) {
         mht.clear();
     }
@@ -114,6 +125,15 @@ void engine_t::onThreadsChange() {
     while (size() > threads) delete back(), pop_back();
 }
 
+void engine_t::onEvalFileChange() {
+    NNUE::load(options["EvalFile"].getStrVal());
+    for (auto t : *this) t->et.clear(); // cached evals came from the other evaluator
+}
+
+void engine_t::onSyzygyPathChange() {
+    Tablebases::init(options["SyzygyPath"].getStrVal());
+}
+
 void engine_t::newgame() {
     tt.resetAge();
     tt.clear();
@@ -135,6 +155,9 @@ void engine_t::initUCIoptions() {
     options["ABDADA Depth"] = uci_options_t(3, 1, 128, [&] {});
     options["Cutoff Check Depth"] = uci_options_t(4, 1, 128, [&] {});
     options["NUMA"] = uci_options_t(false, [&] {});
+    options["EvalFile"] = uci_options_t(std::string("<empty>"), [&] { onEvalFileChange(); });
+    options["SyzygyPath"] = uci_options_t(std::string("<empty>"), [&] { onSyzygyPathChange(); });
+    options["SyzygyProbeLimit"] = uci_options_t(7, 0, 7, [&] {});
 }
 
 void engine_t::printUCIoptions() {
@@ -145,4 +168,10 @@ uint64_t engine_t::nodesearched() {
     uint64_t nodes = 0;
     for (auto t : *this) nodes += t->nodecnt;
     return nodes;
+}
+
+uint64_t engine_t::tbhitcount() {
+    uint64_t hits = tbroothits;
+    for (auto t : *this) hits += t->tbhits;
+    return hits;
 }
\ No newline at end of file
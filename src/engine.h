@@ -109,8 +109,11 @@ struct engine_t : public std::vector<search_t*> {
 
     void onHashChange();
     void onThreadsChange();
+    void onEvalFileChange();
+    void onSyzygyPathChange();
 
     uint64_t nodesearched();
+    uint64_t tbhitcount();
 
     abdada_table_t mht;
     trans_table_t tt;
@@ -124,6 +127,9 @@ struct engine_t : public std::vector<search_t*> {
     int defer_depth;
     int cutoffcheck_depth;
     bool doNUMA;
+    int tbcardinality; // probe in search up to this many pieces, 0 when off
+    uint64_t tbroothits;
+    movelist_t<220> tbrootmoves; // root moves that keep the tablebase result, empty when not filtering
 
     spinlock_t updatelock;
     std::atomic<bool> plysearched[MAXPLYSIZE];
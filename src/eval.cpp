@@ -8,9 +8,12 @@
 #include "attacks.h"
 #include "params.h"
 #include "utils.h"
+#include "endgame.h"
 
 #include <algorithm>
 #include <cstring>
+#include <thread>
+#include <vector>
 
 using namespace Utils;
 using namespace Attacks;
@@ -18,8 +21,6 @@ using namespace EvalParam;
 
 namespace {
     const int FileWing[8] = { 0, 0, 0, 1, 1, 2, 2, 2 };
-    const basic_score_t TotalPhase = QueenPhase * 2 + RookPhase * 4 + BishopPhase * 4 + KnightPhase * 4;
-    const basic_score_t Phases[6] = { 0, 0, KnightPhase, BishopPhase, RookPhase, QueenPhase };
     constexpr uint64_t OutpostMask[2] = { Rank4BB | Rank5BB | Rank6BB, Rank5BB | Rank4BB | Rank3BB };
     constexpr uint64_t CenterSquaresMask = D4BB | D5BB | E4BB | E5BB;
     constexpr uint64_t KnightAttacker = (1 << 16) + (1 << 10);
@@ -35,104 +36,179 @@ namespace {
     }
 }
 
-void eval_t::material(position_t & p) {
+template<typename S>
+void basic_eval_t<S>::material(position_t& p, basic_material_t<S>& mat) {
     int pieceCount[2][6] = {};
-    phase = 0;
+    int matphase = 0;
+    const basic_t phases[6] = { 0, 0, P.KnightPhase, P.BishopPhase, P.RookPhase, P.QueenPhase };
+    mat.value = { 0, 0 };
     for (int color = WHITE; color <= BLACK; ++color) {
+        S scr;
         for (int pc = PAWN; pc <= QUEEN; ++pc) {
             pieceCount[color][pc] = bitCnt(p.getPieceBB(pc, color));
-            scr[color] += MaterialValues[pc] * pieceCount[color][pc];
-            if (pc >= KNIGHT && pc <= QUEEN) phase += pieceCount[color][pc] * Phases[pc];
+            scr += P.MaterialValues[pc] * pieceCount[color][pc];
+            if constexpr (Traced) if (trace) trace->add(P.MaterialValues[pc], color, pieceCount[color][pc]);
+            if (pc >= KNIGHT && pc <= QUEEN) matphase += pieceCount[color][pc] * phases[pc];
         }
         pieceCount[color][0] = pieceCount[color][BISHOP] > 1;
+        mat.value += scr * (color == WHITE ? 1 : -1);
     }
-    if (phase > TotalPhase) phase = TotalPhase;
-    scr[WHITE] += imbalance(pieceCount, WHITE);
-    scr[BLACK] += imbalance(pieceCount, BLACK);
+    mat.phase = std::min<int>(matphase, P.totalPhase());
+    mat.value += imbalance(P, pieceCount, WHITE, tracing() ? trace : nullptr);
+    mat.value -= imbalance(P, pieceCount, BLACK, tracing() ? trace : nullptr);
+
+    const int wp = pieceCount[WHITE][PAWN], bp = pieceCount[BLACK][PAWN];
+    const int wn = pieceCount[WHITE][KNIGHT], bn = pieceCount[BLACK][KNIGHT];
+    const int wb = pieceCount[WHITE][BISHOP], bb = pieceCount[BLACK][BISHOP];
+    const int wr = pieceCount[WHITE][ROOK], br = pieceCount[BLACK][ROOK];
+    const int wminors = wn + wb;
+    const int bminors = bn + bb;
+    const int wmajors = wr + pieceCount[WHITE][QUEEN];
+    const int bmajors = br + pieceCount[BLACK][QUEEN];
+    const int minors = wminors + bminors;
+    const int majors = wmajors + bmajors;
+
+    mat.flags = 0;
+    if (wp + bp + minors + majors == 0) mat.flags |= 1;
+    if (!wp && !bp) {
+        if (majors == 0 && wminors < 2 && bminors < 2) mat.flags |= 1; // minor vs minor
+        if (majors == 0 && minors == 2 && (wn == 2 || bn == 2)) mat.flags |= 1; // 2 knights
+        if (majors == 2 && wr == 1 && br == 1 && minors < 2) mat.flags |= 2; // rook+minor vs rook
+    }
+    Endgames::lookup(p, mat);
+    // TODO: material recognizer (KBPk, KRPkr, insufficient material, etc)
+    // TODO: endgame knowledge (KRPkr, KBPkb)
+}
+
+template<typename S>
+basic_material_t<S>& basic_eval_t<S>::getMaterial(position_t& p) {
+    material_entry_t<S>& entry = mattable[p.stack.mhash & (MaterialTableSize - 1)];
+    if (entry.key != p.stack.mhash || tracing()) {
+        entry.key = p.stack.mhash;
+        material(p, entry.mat);
+    }
+    return entry.mat;
+}
+
+template<typename S>
+void basic_eval_t<S>::prefetch(position_t& p) {
+    __builtin_prefetch(&mattable[p.stack.mhash & (MaterialTableSize - 1)]);
+}
+
+template<typename S>
+template<int side>
+void basic_eval_t<S>::initattacks(position_t& p) {
+    katkrs[side] = 0;
+    allatks2[side] = knightatks[side] = bishopatks[side] = rookatks[side] = queenatks[side] = 0;
+    kingzone[side] = KingZoneBB[side][p.kpos[side]];
+    allatks[side] = kingMovesBB(p.kpos[side]);
+    pawnatks[side] = pawnAttackBB<side>(p.getPieceBB(PAWN, side));
+    pawnfillatks[side] = fillBB<side>(pawnatks[side]);
+    allatks2[side] |= allatks[side] & pawnatks[side];
+    allatks[side] |= pawnatks[side];
 }
 
-void eval_t::pawnstructure(position_t& p, int side) {
-    const int xside = side ^ 1;
+template<typename S>
+template<int path, int side>
+void basic_eval_t<S>::pawnstructure(position_t& p) {
+    constexpr int xside = side ^ 1;
     const uint64_t pawns = p.getPieceBB(PAWN, side);
     const uint64_t xpawns = p.getPieceBB(PAWN, xside);
-    const uint64_t open = pawns & ~(pawns & fillBB[xside](xpawns));
-    const uint64_t connected = pawns & (pawnatks[side] | shift8BB[xside](pawnatks[side]));
-    const uint64_t doubled = pawns & fillBBEx[xside](pawns);
-    const uint64_t isolated = pawns & ~fillBB[xside](pawnfillatks[side]);
-    const uint64_t backward = pawns & ~isolated & shift8BB[xside]((pawnatks[xside] | xpawns) & ~pawnfillatks[side]);
-    scr[side] += PawnConnected * bitCnt(connected);
-    scr[side] += PawnDoubled * bitCnt(doubled);
-    scr[side] += PawnIsolated * bitCnt(isolated & ~open);
-    scr[side] += PawnBackward * bitCnt(backward & ~open);
-    scr[side] += PawnIsolatedOpen * bitCnt(isolated & open);
-    scr[side] += PawnBackwardOpen * bitCnt(backward & open);
-}
-
-void eval_t::pieceactivity(position_t& p, int side) {
-    const int xside = side ^ 1;
-    const uint64_t mobmask = ~(p.getPieceBB(KING, side) | pawnatks[xside] | (shift8BB[xside](p.occupiedBB) & p.getPieceBB(PAWN, side)));
+    const uint64_t open = pawns & ~(pawns & fillBB<xside>(xpawns));
+    const uint64_t connected = pawns & (pawnatks[side] | shift8BB<xside>(pawnatks[side]));
+    const uint64_t doubled = pawns & fillBBEx<xside>(pawns);
+    const uint64_t isolated = pawns & ~fillBB<xside>(pawnfillatks[side]);
+    const uint64_t backward = pawns & ~isolated & shift8BB<xside>((pawnatks[xside] | xpawns) & ~pawnfillatks[side]);
+    add<side>(P.PawnConnected, bitCnt<path>(connected));
+    add<side>(P.PawnDoubled, bitCnt<path>(doubled));
+    add<side>(P.PawnIsolated, bitCnt<path>(isolated & ~open));
+    add<side>(P.PawnBackward, bitCnt<path>(backward & ~open));
+    add<side>(P.PawnIsolatedOpen, bitCnt<path>(isolated & open));
+    add<side>(P.PawnBackwardOpen, bitCnt<path>(backward & open));
+}
+
+// setwise builds the per piece type attack maps with Kogge-Stone fills instead of from the loops below
+template<typename S>
+template<int path, int side, bool setwise>
+void basic_eval_t<S>::pieceactivity(position_t& p) {
+    constexpr int xside = side ^ 1;
+    const uint64_t mobmask = ~(p.getPieceBB(KING, side) | pawnatks[xside] | (shift8BB<xside>(p.occupiedBB) & p.getPieceBB(PAWN, side)));
     const uint64_t outpostsqs = OutpostMask[side] & pawnatks[side] & ~pawnfillatks[xside];
+#ifdef USE_KOGGE_STONE
+    if (setwise) {
+        uint64_t atks[4];
+        const uint64_t bsliders = p.bishopSlidersBB(side), rsliders = p.rookSlidersBB(side);
+        setwiseAttacksAVX2(p.getPieceBB(KNIGHT, side), p.getPieceBB(BISHOP, side), p.getPieceBB(ROOK, side), p.getPieceBB(QUEEN, side),
+            ~(p.occupiedBB & ~bsliders), ~(p.occupiedBB & ~rsliders), ~(p.occupiedBB & ~(bsliders | rsliders)), atks);
+        knightatks[side] = atks[0];
+        bishopatks[side] = atks[1];
+        rookatks[side] = atks[2];
+        queenatks[side] = atks[3];
+    }
+#endif
 
     for (uint64_t pcbits = p.getPieceBB(KNIGHT, side); pcbits;) {
         int sq = popFirstBit(pcbits);
         uint64_t atk = knightMovesBB(sq);
-        knightatks[side] |= atk;
+        if (!setwise) knightatks[side] |= atk;
         allatks2[side] |= allatks[side] & atk;
         allatks[side] |= atk;
-        scr[side] += KnightMob[bitCnt(atk & mobmask)];
-        if (atk & kingzone[xside]) katkrs[side] += KnightAttacker + bitCnt(atk & kingzone[xside]);
-        if (BitMask[sq] & outpostsqs) scr[side] += KnightOutpost;
-        else if (atk & outpostsqs & ~p.colorBB[side]) scr[side] += KnightXOutpost;
+        add<side>(P.KnightMob[bitCnt<path>(atk & mobmask)]);
+        if (atk & kingzone[xside]) katkrs[side] += KnightAttacker + bitCnt<path>(atk & kingzone[xside]);
+        if (BitMask[sq] & outpostsqs) add<side>(P.KnightOutpost);
+        else if (atk & outpostsqs & ~p.colorBB[side]) add<side>(P.KnightXOutpost);
     }
     for (uint64_t pcbits = p.getPieceBB(BISHOP, side); pcbits;) {
         int sq = popFirstBit(pcbits);
-        uint64_t atk = bishopAttacksBB(sq, p.occupiedBB & ~p.bishopSlidersBB(side));
-        bishopatks[side] |= atk;
+        uint64_t atk = bishopAttacksBB<path>(sq, p.occupiedBB & ~p.bishopSlidersBB(side));
+        if (!setwise) bishopatks[side] |= atk;
         allatks2[side] |= allatks[side] & atk;
         allatks[side] |= atk;
-        scr[side] += BishopMob[bitCnt(atk & mobmask)];
-        if (atk & kingzone[xside]) katkrs[side] += BishopAttacker + bitCnt(atk & kingzone[xside]);
-        if (BitMask[sq] & outpostsqs) scr[side] += BishopOutpost;
-        if (bitCnt(atk & CenterSquaresMask) >= 2) scr[side] += BishopCenterControl;
-        scr[side] += BishopPawns * bitCnt(p.getPieceBB(PAWN, side) & (BitMask[sq] & WhiteSquaresBB ? WhiteSquaresBB : BlackSquaresBB));
+        add<side>(P.BishopMob[bitCnt<path>(atk & mobmask)]);
+        if (atk & kingzone[xside]) katkrs[side] += BishopAttacker + bitCnt<path>(atk & kingzone[xside]);
+        if (BitMask[sq] & outpostsqs) add<side>(P.BishopOutpost);
+        if (bitCnt<path>(atk & CenterSquaresMask) >= 2) add<side>(P.BishopCenterControl);
+        add<side>(P.BishopPawns, bitCnt<path>(p.getPieceBB(PAWN, side) & (BitMask[sq] & WhiteSquaresBB ? WhiteSquaresBB : BlackSquaresBB)));
     }
     for (uint64_t pcbits = p.getPieceBB(ROOK, side); pcbits;) {
         int sq = popFirstBit(pcbits);
-        uint64_t atk = rookAttacksBB(sq, p.occupiedBB & ~p.rookSlidersBB(side));
-        rookatks[side] |= atk;
+        uint64_t atk = rookAttacksBB<path>(sq, p.occupiedBB & ~p.rookSlidersBB(side));
+        if (!setwise) rookatks[side] |= atk;
         allatks2[side] |= allatks[side] & atk;
         allatks[side] |= atk;
-        scr[side] += RookMob[bitCnt(atk & mobmask)];
-        if (atk & kingzone[xside]) katkrs[side] += RookAttacker + bitCnt(atk & kingzone[xside]);
+        add<side>(P.RookMob[bitCnt<path>(atk & mobmask)]);
+        if (atk & kingzone[xside]) katkrs[side] += RookAttacker + bitCnt<path>(atk & kingzone[xside]);
         if ((BitMask[sq] & Rank7ByColorBB[side]) && (BitMask[p.kpos[xside]] & (Rank7ByColorBB[side] | Rank8ByColorBB[side]))) {
-            scr[side] += RookOn7th;
+            add<side>(P.RookOn7th);
         }
         if (!(FileBB[sqFile(sq)] & p.getPieceBB(PAWN, side))) {
-            if (!(FileBB[sqFile(sq)] & p.getPieceBB(PAWN, xside))) scr[side] += RookOnOpenFile;
-            else scr[side] += RookOnSemiOpenFile;
+            if (!(FileBB[sqFile(sq)] & p.getPieceBB(PAWN, xside))) add<side>(P.RookOnOpenFile);
+            else add<side>(P.RookOnSemiOpenFile);
         }
     }
     for (uint64_t pcbits = p.getPieceBB(QUEEN, side); pcbits;) {
         int sq = popFirstBit(pcbits);
-        uint64_t atk = queenAttacksBB(sq, p.occupiedBB & ~(p.rookSlidersBB(side) | p.bishopSlidersBB(side)));
-        queenatks[side] |= atk;
+        uint64_t atk = queenAttacksBB<path>(sq, p.occupiedBB & ~(p.rookSlidersBB(side) | p.bishopSlidersBB(side)));
+        if (!setwise) queenatks[side] |= atk;
         allatks2[side] |= allatks[side] & atk;
         allatks[side] |= atk;
-        scr[side] += QueenMob[bitCnt(atk & mobmask)];
-        if (atk & kingzone[xside]) katkrs[side] += QueenAttacker + bitCnt(atk & kingzone[xside]);
+        add<side>(P.QueenMob[bitCnt<path>(atk & mobmask)]);
+        if (atk & kingzone[xside]) katkrs[side] += QueenAttacker + bitCnt<path>(atk & kingzone[xside]);
     }
 }
 
-void eval_t::kingsafety(position_t& p, int side) {
-    const int xside = side ^ 1;
+template<typename S>
+template<int path, int side>
+void basic_eval_t<S>::kingsafety(position_t& p) {
+    constexpr int xside = side ^ 1;
     int katkrscnt = (katkrs[side] >> 10) & 63;
     if (katkrscnt > (p.getPieceBB(QUEEN, side) ? 0 : 1)) {
         const uint64_t king_atkmask = kingMovesBB(p.kpos[xside]);
         const uint64_t weaksqs = allatks[side] & ~allatks2[xside] & (~allatks[xside] | queenatks[xside] | king_atkmask);
         const uint64_t safesqs = ~p.colorBB[side] & (~allatks[xside] | (weaksqs & allatks2[side]));
         const uint64_t knightthreats = knightMovesBB(p.kpos[xside]);
-        const uint64_t bishopthreats = bishopAttacksBB(p.kpos[xside], p.occupiedBB);
-        const uint64_t rookthreats = rookAttacksBB(p.kpos[xside], p.occupiedBB);
+        const uint64_t bishopthreats = bishopAttacksBB<path>(p.kpos[xside], p.occupiedBB);
+        const uint64_t rookthreats = rookAttacksBB<path>(p.kpos[xside], p.occupiedBB);
         const uint64_t queenthreats = bishopthreats | rookthreats;
         const uint64_t kshelter = p.getPieceBB(PAWN, xside);
         const uint64_t kstorm = p.getPieceBB(PAWN, side);
@@ -141,108 +217,194 @@ void eval_t::kingsafety(position_t& p, int side) {
         const uint64_t xsheltermask1 = KingShelterBB[xside][file];
         const uint64_t xsheltermask2 = KingShelter2BB[xside][file];
         const uint64_t xsheltermask3 = KingShelter3BB[xside][file];
-        basic_score_t bonus = 0;
-        bonus += KnightAtk * ((katkrs[side] >> 16) & 15);
-        bonus += BishopAtk * ((katkrs[side] >> 20) & 15);
-        bonus += RookAtk * ((katkrs[side] >> 24) & 15);
-        bonus += QueenAtk * ((katkrs[side] >> 28) & 15);
-        bonus += KingZoneAttacks * (katkrs[side] & 1023);
-        bonus += WeakSquares * bitCnt(king_atkmask & weaksqs);
-        bonus += EnemyPawns * bitCnt(p.getPieceBB(PAWN, xside) & king_atkmask & ~weaksqs);
-        bonus += QueenSafeCheckValue * bitCnt(queenthreats & queenatks[side] & safesqs);
-        bonus += RookSafeCheckValue * bitCnt(rookthreats & rookatks[side] & safesqs);
-        bonus += BishopSafeCheckValue * bitCnt(bishopthreats & bishopatks[side] & safesqs);
-        bonus += KnightSafeCheckValue * bitCnt(knightthreats & knightatks[side] & safesqs);
-        bonus += KingShelter1 * bitCnt(kshelter & xsheltermask1 & ~xkingfileBB);
-        bonus += KingShelterF1 * bitCnt(kshelter & xsheltermask1 & xkingfileBB);
-        bonus += KingShelter2 * bitCnt(kshelter & xsheltermask2 & ~xkingfileBB);
-        bonus += KingShelterF2 * bitCnt(kshelter & xsheltermask2 & xkingfileBB);
-        bonus += KingStorm1 * bitCnt(kstorm & xsheltermask2);
-        bonus += KingStorm2 * bitCnt(kstorm & xsheltermask3);
-        if (bonus > 0) scr[side] += score_t(bonus * bonus / 1024, bonus / 20);
-    }
-}
-
-void eval_t::threats(position_t& p, int side) {
-    const int xside = side ^ 1;
+        basic_t bonus = 0;
+        addSafety<side>(bonus, P.KnightAtk, (katkrs[side] >> 16) & 15);
+        addSafety<side>(bonus, P.BishopAtk, (katkrs[side] >> 20) & 15);
+        addSafety<side>(bonus, P.RookAtk, (katkrs[side] >> 24) & 15);
+        addSafety<side>(bonus, P.QueenAtk, (katkrs[side] >> 28) & 15);
+        addSafety<side>(bonus, P.KingZoneAttacks, katkrs[side] & 1023);
+        addSafety<side>(bonus, P.WeakSquares, bitCnt<path>(king_atkmask & weaksqs));
+        addSafety<side>(bonus, P.EnemyPawns, bitCnt<path>(p.getPieceBB(PAWN, xside) & king_atkmask & ~weaksqs));
+        addSafety<side>(bonus, P.QueenSafeCheckValue, bitCnt<path>(queenthreats & queenatks[side] & safesqs));
+        addSafety<side>(bonus, P.RookSafeCheckValue, bitCnt<path>(rookthreats & rookatks[side] & safesqs));
+        addSafety<side>(bonus, P.BishopSafeCheckValue, bitCnt<path>(bishopthreats & bishopatks[side] & safesqs));
+        addSafety<side>(bonus, P.KnightSafeCheckValue, bitCnt<path>(knightthreats & knightatks[side] & safesqs));
+        addSafety<side>(bonus, P.KingShelter1, bitCnt<path>(kshelter & xsheltermask1 & ~xkingfileBB));
+        addSafety<side>(bonus, P.KingShelterF1, bitCnt<path>(kshelter & xsheltermask1 & xkingfileBB));
+        addSafety<side>(bonus, P.KingShelter2, bitCnt<path>(kshelter & xsheltermask2 & ~xkingfileBB));
+        addSafety<side>(bonus, P.KingShelterF2, bitCnt<path>(kshelter & xsheltermask2 & xkingfileBB));
+        addSafety<side>(bonus, P.KingStorm1, bitCnt<path>(kstorm & xsheltermask2));
+        addSafety<side>(bonus, P.KingStorm2, bitCnt<path>(kstorm & xsheltermask3));
+        if (bonus > 0) scr[side] += S(bonus * bonus / 1024, bonus / 20);
+    }
+}
+
+template<typename S>
+template<int path, int side>
+void basic_eval_t<S>::threats(position_t& p) {
+    constexpr int xside = side ^ 1;
     const uint64_t minors = p.getPieceBB(KNIGHT, xside) | p.getPieceBB(BISHOP, xside);
     const uint64_t weak = (allatks[side] & ~allatks[xside]) | (allatks2[side] & ~allatks2[xside] & ~pawnatks[xside]);
     const uint64_t safepush = ~pawnatks[xside] & ~p.occupiedBB;
-    const uint64_t pushtarget = pawnAttackBB(p.colorBB[xside] & ~p.piecesBB[PAWN], xside) & (allatks[side] | ~allatks[xside]);
-    uint64_t push = shift8BB[side](p.getPieceBB(PAWN, side)) & safepush;
-    push |= shift8BB[side](push & Rank3ByColorBB[side]) & safepush;
-    scr[side] += PawnPush * bitCnt(push & pushtarget);
-    scr[side] += WeakPawns * bitCnt(p.getPieceBB(PAWN, xside) & weak);
-    scr[side] += PawnsxMinors * bitCnt(pawnatks[side] & minors);
-    scr[side] += MinorsxMinors * bitCnt((knightatks[side] | bishopatks[side]) & minors);
-    scr[side] += MajorsxWeakMinors * bitCnt((rookatks[side] | queenatks[side]) & minors & weak);
-    scr[side] += PawnsMinorsxMajors * bitCnt((pawnatks[side] | knightatks[side] | bishopatks[side]) & p.rookSlidersBB(xside));
-    scr[side] += AllxQueens * bitCnt(allatks[side] & p.getPieceBB(QUEEN, xside));
-    scr[side] += KingxMinors * bitCnt(kingMovesBB(p.kpos[side]) & minors & weak);
-    scr[side] += KingxRooks * bitCnt(kingMovesBB(p.kpos[side]) & p.getPieceBB(ROOK, xside) & weak);
-}
-
-void eval_t::passedpawns(position_t& p, int side) {
-    const int xside = side ^ 1;
-    uint64_t passers = p.getPieceBB(PAWN, side) & ~fillBBEx[xside](p.piecesBB[PAWN]) & ~pawnfillatks[xside];
+    const uint64_t pushtarget = pawnAttackBB<xside>(p.colorBB[xside] & ~p.piecesBB[PAWN]) & (allatks[side] | ~allatks[xside]);
+    uint64_t push = shift8BB<side>(p.getPieceBB(PAWN, side)) & safepush;
+    push |= shift8BB<side>(push & Rank3ByColorBB[side]) & safepush;
+    add<side>(P.PawnPush, bitCnt<path>(push & pushtarget));
+    add<side>(P.WeakPawns, bitCnt<path>(p.getPieceBB(PAWN, xside) & weak));
+    add<side>(P.PawnsxMinors, bitCnt<path>(pawnatks[side] & minors));
+    add<side>(P.MinorsxMinors, bitCnt<path>((knightatks[side] | bishopatks[side]) & minors));
+    add<side>(P.MajorsxWeakMinors, bitCnt<path>((rookatks[side] | queenatks[side]) & minors & weak));
+    add<side>(P.PawnsMinorsxMajors, bitCnt<path>((pawnatks[side] | knightatks[side] | bishopatks[side]) & p.rookSlidersBB(xside)));
+    add<side>(P.AllxQueens, bitCnt<path>(allatks[side] & p.getPieceBB(QUEEN, xside)));
+    add<side>(P.KingxMinors, bitCnt<path>(kingMovesBB(p.kpos[side]) & minors & weak));
+    add<side>(P.KingxRooks, bitCnt<path>(kingMovesBB(p.kpos[side]) & p.getPieceBB(ROOK, xside) & weak));
+}
+
+template<typename S>
+template<int side>
+void basic_eval_t<S>::passedpawns(position_t& p) {
+    constexpr int xside = side ^ 1;
+    uint64_t passers = p.getPieceBB(PAWN, side) & ~fillBBEx<xside>(p.piecesBB[PAWN]) & ~pawnfillatks[xside];
     if (!passers) return;
-    const uint64_t notblocked = ~shift8BB[xside](p.occupiedBB);
-    const uint64_t safepush = ~shift8BB[xside](allatks[xside]);
-    const uint64_t safeprom = ~fillBBEx[xside](allatks[xside] | p.colorBB[xside]);
+    const uint64_t notblocked = ~shift8BB<xside>(p.occupiedBB);
+    const uint64_t safepush = ~shift8BB<xside>(allatks[xside]);
+    const uint64_t safeprom = ~fillBBEx<xside>(allatks[xside] | p.colorBB[xside]);
     while (passers) {
         int sq = popFirstBit(passers);
         int rank = getRelativeRank(side, sq);
-        scr[side] += PasserDistOwn[rank] * distance(p.kpos[side], sq);
-        scr[side] += PasserDistEnemy[rank] * distance(p.kpos[xside], sq);
-        scr[side] += PasserBonus[rank];
-        if (BitMask[sq] & notblocked) scr[side] += PasserNotBlocked[rank];
-        if (BitMask[sq] & safepush) scr[side] += PasserSafePush[rank];
-        if (BitMask[sq] & safeprom) scr[side] += PasserSafeProm[rank];
+        add<side>(P.PasserDistOwn[rank], distance(p.kpos[side], sq));
+        add<side>(P.PasserDistEnemy[rank], distance(p.kpos[xside], sq));
+        add<side>(P.PasserBonus[rank]);
+        if (BitMask[sq] & notblocked) add<side>(P.PasserNotBlocked[rank]);
+        if (BitMask[sq] & safepush) add<side>(P.PasserSafePush[rank]);
+        if (BitMask[sq] & safeprom) add<side>(P.PasserSafeProm[rank]);
     }
 }
 
-void eval_t::space(position_t& p, int side) {
-    const int xside = side ^ 1;
+template<typename S>
+template<int path, int side>
+void basic_eval_t<S>::space(position_t& p) {
+    constexpr int xside = side ^ 1;
     uint64_t controlled = allatks2[side] & allatks[xside] & ~allatks2[xside] & ~pawnatks[xside];
-    scr[side] += PieceSpace * bitCnt(controlled & p.occupiedBB);
-    scr[side] += EmptySpace * bitCnt(controlled & ~p.occupiedBB);
+    add<side>(P.PieceSpace, bitCnt<path>(controlled & p.occupiedBB));
+    add<side>(P.EmptySpace, bitCnt<path>(controlled & ~p.occupiedBB));
 }
 
-basic_score_t eval_t::score(position_t& p) {
+template<typename S>
+template<int path>
+typename basic_eval_t<S>::basic_t basic_eval_t<S>::evaluate(position_t& p, int alpha, int beta) {
     int scale = 32;
+    const basic_t total = P.totalPhase();
+    auto blend = [&]() {
+        S score = scr[p.side] - scr[p.side ^ 1];
+        basic_t tapered = (score.mg() * phase + score.eg() * (total - phase)) / total;
+        return (tapered * scale / 32) + P.Tempo;
+    };
+    exact = true;
     for (int color = WHITE; color <= BLACK; ++color) {
-        scr[color] = p.stack.score[color];
+        scr[color] = S(p.stack.score[color]);
     }
-    if (p.isMatIdxValid()) {
-        material_t& mat = getMaterial(p.mat_idx[WHITE], p.mat_idx[BLACK]);
-        phase = mat.phase;
-        scr[WHITE] += mat.value;
-        if (mat.flags & 1) return 0;
-        if (mat.flags & 2) scale = 1;
-        if (mat.flags & 4 && bitCnt(p.piecesBB[BISHOP] & WhiteSquaresBB) == 1) scale = 16;
+    const basic_material_t<S>& mat = getMaterial(p);
+    phase = mat.phase;
+    scr[WHITE] += mat.value;
+    if (mat.flags & 1) return 0;
+    if (mat.ending && mat.ending < Endgames::FIRST_SCALING) {
+        const basic_t score = Endgames::Evaluators[mat.ending](p, mat.strong());
+        return p.side == mat.strong() ? score : -score;
     }
-    else material(p);
-    for (int color = WHITE; color <= BLACK; ++color) {
-        katkrs[color] = 0;
-        allatks2[color] = knightatks[color] = bishopatks[color] = rookatks[color] = queenatks[color] = 0;
-        kingzone[color] = KingZoneBB[color][p.kpos[color]];
-        allatks[color] = kingMovesBB(p.kpos[color]);
-        pawnatks[color] = pawnAttackBB(p.getPieceBB(PAWN, color), color);
-        pawnfillatks[color] = fillBB[color](pawnatks[color]);
-        allatks2[color] |= allatks[color] & pawnatks[color];
-        allatks[color] |= pawnatks[color];
+    if (mat.flags & 2) scale = 1;
+    if (mat.ending) scale = Endgames::Evaluators[mat.ending](p, mat.strong());
+    if (tracing()) {
+        trace->general = true;
+        trace->mgweight = double(phase) * scale / (32.0 * total);
+        trace->egweight = double(total - phase) * scale / (32.0 * total);
     }
-    for (int color = WHITE; color <= BLACK; ++color) {
-        pawnstructure(p, color);
-        pieceactivity(p, color);
+
+    // material and psqt alone are too far outside the window for the rest to matter
+    basic_t lazy = blend();
+    if (lazy - LazyMargin >= beta || lazy + LazyMargin <= alpha) {
+        exact = false;
+        return lazy;
     }
-    for (int color = WHITE; color <= BLACK; ++color) {
-        kingsafety(p, color);
-        passedpawns(p, color);
-        threats(p, color);
-        space(p, color);
-    }
-    score_t score = scr[p.side] - scr[p.side ^ 1];
-    basic_score_t tapered = (score.m * phase + score.e * (TotalPhase - phase)) / TotalPhase;
-    return (tapered * scale / 32) + Tempo;
-}
\ No newline at end of file
+
+    initattacks<WHITE>(p);
+    initattacks<BLACK>(p);
+    pawnstructure<path, WHITE>(p);
+    pawnstructure<path, BLACK>(p);
+#ifdef USE_KOGGE_STONE
+    if constexpr (cpuLevel(path) >= CPU_AVX2) {
+        pieceactivity<path, WHITE, true>(p);
+        pieceactivity<path, BLACK, true>(p);
+    }
+    else
+#endif
+    {
+        pieceactivity<path, WHITE, false>(p);
+        pieceactivity<path, BLACK, false>(p);
+    }
+    kingsafety<path, WHITE>(p);
+    kingsafety<path, BLACK>(p);
+    passedpawns<WHITE>(p);
+    passedpawns<BLACK>(p);
+    threats<path, WHITE>(p);
+    threats<path, BLACK>(p);
+    space<path, WHITE>(p);
+    space<path, BLACK>(p);
+    if (tracing()) trace->mg = (scr[WHITE] - scr[BLACK]).mg(), trace->eg = (scr[WHITE] - scr[BLACK]).eg();
+    return blend();
+}
+
+template<typename S>
+typename basic_eval_t<S>::basic_t basic_eval_t<S>::score(position_t& p, int alpha, int beta) {
+    return withCpuPath([&](auto path) { return evaluate<decltype(path)::value>(p, alpha, beta); });
+}
+
+template struct basic_eval_t<score_t>;
+template struct basic_eval_t<tune_score_t>;
+#define INSTANTIATE_EVALUATE(path) template score_t::basic_t eval_t::evaluate<path>(position_t& p, int alpha, int beta);
+FOR_EACH_CPU_PATH(INSTANTIATE_EVALUATE)
+
+namespace {
+    // runs score(eval, start, end) on contiguous chunks of [0, count), one thread and eval_t per chunk
+    template<typename F>
+    void splitBatch(size_t count, int threads, F score) {
+        auto worker = [&](size_t start, size_t end) {
+            eval_t eval;
+            score(eval, start, end);
+        };
+        threads = (int)std::max<size_t>(1, std::min<size_t>(Utils::clampThreads(threads), count));
+        if (threads == 1) {
+            worker(0, count);
+            return;
+        }
+        std::vector<std::thread> pool;
+        const size_t chunk = (count + threads - 1) / threads;
+        for (size_t start = 0; start < count; start += chunk) pool.emplace_back(worker, start, std::min(count, start + chunk));
+        for (auto& t : pool) t.join();
+    }
+}
+
+void scoreBatch(position_t* const positions[], basic_score_t scores[], size_t count, int threads) {
+    splitBatch(count, threads, [&](eval_t& eval, size_t start, size_t end) {
+        withCpuPath([&](auto path) {
+            for (size_t k = start; k < end; ++k) {
+                // the position after next is fetched while the next one brings in its material entry
+                if (k + 2 < end) __builtin_prefetch(positions[k + 2]);
+                if (k + 1 < end) eval.prefetch(*positions[k + 1]);
+                scores[k] = eval.evaluate<decltype(path)::value>(*positions[k], -MATE, MATE);
+            }
+        });
+    });
+}
+
+void scoreBatch(const std::string fens[], basic_score_t scores[], size_t count, int threads) {
+    splitBatch(count, threads, [&](eval_t& eval, size_t start, size_t end) {
+        position_t pos;
+        withCpuPath([&](auto path) {
+            for (size_t k = start; k < end; ++k) {
+                pos.setPosition(fens[k]);
+                scores[k] = eval.evaluate<decltype(path)::value>(pos, -MATE, MATE);
+            }
+        });
+    });
+}
@@ -6,18 +6,63 @@
 
 #pragma once
 
+#include <vector>
+#include <type_traits>
 #include "typedefs.h"
 #include "position.h"
+#include "params.h"
 
-struct eval_t {
-    void material(position_t& p);
-    void pawnstructure(position_t& p, int side);
-    void pieceactivity(position_t& p, int side);
-    void kingsafety(position_t& p, int side);
-    void threats(position_t& p, int side);
-    void passedpawns(position_t& p, int side);
-    void space(position_t& p, int side);
-    basic_score_t score(position_t& p);
+// what a traced evaluation is made of, for the tuner's gradients: the count of each tune_score_t term (white's
+// minus black's), the king attack units of each attacking side, the midgame and endgame sums and their
+// weights after phase and scale
+struct eval_trace_t {
+    void add(const tune_score_t& term, int side, int count) {
+        if (count) terms.push_back({ &term, side == WHITE ? count : -count });
+    }
+    std::vector<std::pair<const tune_score_t*, int>> terms;
+    std::vector<std::pair<const double*, int>> safety[2];
+    double mgweight = 0;
+    double egweight = 0;
+    double mg = 0, eg = 0; // the midgame and endgame sums that are blended, white's view
+    bool general = false; // false when a draw flag or an endgame evaluator gave the score
+};
+
+template<typename S>
+struct material_entry_t {
+    uint64_t key;
+    basic_material_t<S> mat;
+};
+static_assert(sizeof(material_entry_t<score_t>) == 16, "4096 entries should take 64 KB");
+
+// the evaluation for a score type: eval_t is the engine's, packed integer scores from EvalParam::Params,
+// tune_eval_t the tuner's, doubles from EvalParam::TuneParams. Both are this same code
+template<typename S>
+struct basic_eval_t {
+    typedef typename S::basic_t basic_t;
+    static constexpr const EvalParam::eval_params_t<S>& P = EvalParam::params<S>();
+    static constexpr bool Traced = std::is_same<S, tune_score_t>::value; // only the tuner's eval records traces
+
+    void material(position_t& p, basic_material_t<S>& mat);
+    basic_material_t<S>& getMaterial(position_t& p);
+    void prefetch(position_t& p);
+    template<int side> void initattacks(position_t& p);
+    template<int path, int side> void pawnstructure(position_t& p);
+    template<int path, int side, bool setwise> void pieceactivity(position_t& p);
+    template<int path, int side> void kingsafety(position_t& p);
+    template<int path, int side> void threats(position_t& p);
+    template<int side> void passedpawns(position_t& p);
+    template<int path, int side> void space(position_t& p);
+    template<int path> basic_t evaluate(position_t& p, int alpha, int beta); // the search calls this one
+    basic_t score(position_t& p, int alpha = -MATE, int beta = MATE); // evaluate of the cpu path, see Utils::withCpuPath
+    template<int side> void add(const S& term, int count = 1) {
+        scr[side] += term * count;
+        if constexpr (Traced) if (trace) trace->add(term, side, count);
+    }
+    template<int side> void addSafety(basic_t& bonus, const basic_t& weight, int count) {
+        bonus += weight * count;
+        if constexpr (Traced) if (trace && count) trace->safety[side].push_back({ &weight, count });
+    }
+    bool tracing() const { return Traced && trace != nullptr; }
     uint64_t pawnatks[2];
     uint64_t knightatks[2];
     uint64_t bishopatks[2];
@@ -28,6 +73,21 @@ struct eval_t {
     uint64_t kingzone[2];
     uint64_t pawnfillatks[2];
     uint64_t katkrs[2];
-    score_t scr[2];
-    basic_score_t phase;
+    S scr[2];
+    basic_t phase;
+    bool exact;
+    eval_trace_t* trace = nullptr; // only followed by tune_eval_t
+
+    // small per-thread cache of material imbalance entries keyed by position_t::stack.mhash
+    static constexpr int MaterialTableSize = 4096;
+    material_entry_t<S> mattable[MaterialTableSize] = {};
 };
+
+typedef basic_eval_t<score_t> eval_t;
+typedef basic_eval_t<tune_score_t> tune_eval_t;
+
+// scores positions from each side to move the way eval_t::score does, with the batch split in contiguous
+// chunks over threads that each keep their own eval_t
+extern void scoreBatch(position_t* const positions[], basic_score_t scores[], size_t count, int threads);
+// the same from fens, each thread parsing its own chunk into a single position_t
+extern void scoreBatch(const std::string fens[], basic_score_t scores[], size_t count, int threads);
@@ -12,8 +12,4 @@ int main(void) {
     interface.run();
 
     return 0;
-}
-
-// TODO:
-// Syzygy
-// NNUE
\ No newline at end of file
+}
\ No newline at end of file
@@ -13,106 +13,185 @@ using namespace Attacks;
 using namespace Utils;
 using namespace PositionData;
 
-enum move_type {
-    MT_PAWN, MT_PAWN2, MT_PAWNCAP, MT_PAWNPROM, MT_PAWNCAPPROM, MT_EP, MT_KNIGHT, MT_BISHOP, MT_ROOK, MT_QUEEM, MT_KING
-};
-static const std::function<uint64_t(int, uint64_t)> AttackFuncs[11] = {
-    pawnMovesBB, pawnMoves2BB, pawnAttacksBB, pawnMovesBB, pawnAttacksBB, pawnAttacksBB,
-    knightAttacksBB, bishopAttacksBB, rookAttacksBB, queenAttacksBB, kingAttacksBB
-};
-static const PieceTypes Pieces[11] = {
-    PAWN, PAWN, PAWN, PAWN, PAWN, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING
-};
-static const MoveFlags Flags[11] = {
-    MF_NORMAL, MF_PAWN2, MF_NORMAL, MF_PROMN, MF_PROMN, MF_ENPASSANT, MF_NORMAL, MF_NORMAL, MF_NORMAL, MF_NORMAL, MF_NORMAL
-};
-
-#define genMoves(mt, PCB, SP, TBB)\
-    for (uint64_t from, bits = getPieceBB(Pieces[mt], side) & PCB; bits;) \
-        for (uint64_t mvbits = AttackFuncs[mt](int(from = popFirstBit(bits)), SP) & TBB; mvbits;) \
-            mvlist.add(move_t(int(from), popFirstBit(mvbits), Flags[mt] ));
-
-#define genProms(mt, PCB, SP, TBB)\
-    for (uint64_t from, bits = getPieceBB(Pieces[mt], side) & PCB; bits;) \
-        for (uint64_t mvbits = AttackFuncs[mt](int(from = popFirstBit(bits)), SP) & TBB; mvbits;) \
-            for (int to = popFirstBit(mvbits), fl = MF_PROMN; fl <= MF_PROMQ; ++fl) \
-                mvlist.add(move_t(int(from), to, fl));
-
-#define genMovesPcs(PCB, TBB)\
-    genMoves(MT_KNIGHT, PCB, occupiedBB, TBB);\
-    genMoves(MT_BISHOP, PCB, occupiedBB, TBB);\
-    genMoves(MT_ROOK, PCB, occupiedBB, TBB);\
-    genMoves(MT_QUEEM, PCB, occupiedBB, TBB);
+namespace {
+    inline uint64_t pinRayBB(uint64_t pinned, int ksq, int from) {
+        return (pinned & BitMask[from]) ? DirBitmap[ksq][DirFromTo[ksq][from]] : FullBoardBB;
+    }
 
-void position_t::genLegal(movelist_t<220>& mvlist) {
-    if (kingIsInCheck())
-        genCheckEvasions(mvlist);
-    else {
-        movelist_t<220> mlt;
-        uint64_t pinned = pinnedPiecesBB(side);
-        genTacticalMoves(mlt);
-        genQuietMoves(mlt);
-        for (move_t m : mlt) {
-            if (!moveIsLegal(m, pinned, false)) continue;
-            mvlist.add(m);
+    template<int path, int pc>
+    inline uint64_t pieceMovesBB(int from, uint64_t occ) {
+        if constexpr (pc == KNIGHT) return knightMovesBB(from);
+        else if constexpr (pc == BISHOP) return bishopAttacksBB<path>(from, occ);
+        else if constexpr (pc == ROOK) return rookAttacksBB<path>(from, occ);
+        else if constexpr (pc == QUEEN) return queenAttacksBB<path>(from, occ);
+        else return kingMovesBB(from);
+    }
+
+    inline void addPawnMoves(movelist_t<220>& mvlist, uint64_t tobits, int delta, int flag) {
+        while (tobits) {
+            int to = popFirstBit(tobits);
+            mvlist.add(move_t(to - delta, to, flag));
+        }
+    }
+
+    inline void addPromotions(movelist_t<220>& mvlist, uint64_t tobits, int delta) {
+        while (tobits) {
+            int to = popFirstBit(tobits);
+            for (int fl = MF_PROMN; fl <= MF_PROMQ; ++fl)
+                mvlist.add(move_t(to - delta, to, fl));
         }
     }
 }
 
-void position_t::genQuietMoves(movelist_t<220>& mvlist) {
-    const int xside = side ^ 1;
-    if (canCastleKS(side) && !(occupiedBB & CastleSquareMask1[side][0]))
-        mvlist.add(move_t(CastleSquareFrom[side], CastleSquareTo[side][0], MF_CASTLE));
-    if (canCastleQS(side) && !(occupiedBB & CastleSquareMask1[side][1]))
-        mvlist.add(move_t(CastleSquareFrom[side], CastleSquareTo[side][1], MF_CASTLE));
-
-    genMoves(MT_PAWN, ~Rank7ByColorBB[side] & shift8BB[xside](~occupiedBB), side, ~occupiedBB);
-    genMoves(MT_PAWN2, Rank2ByColorBB[side] & shift8BB[xside](~occupiedBB) & shift16BB[xside](~occupiedBB), side, ~occupiedBB);
-    genMovesPcs(occupiedBB, ~occupiedBB);
-    genMoves(MT_KING, occupiedBB, 0, ~occupiedBB & ~kingMovesBB(kpos[xside]));
+// all generators below produce legal moves only: pinned pieces are restricted
+// to the ray from their king, and the king is kept off squares in xatks
+template<int path, int c, int pc>
+void position_t::genPieceMoves(movelist_t<220>& mvlist, uint64_t pinned, uint64_t frombits, uint64_t target) {
+    if constexpr (pc == KNIGHT) frombits &= ~pinned;
+    for (uint64_t bits = getPieceBB(pc, c) & frombits; bits;) {
+        int from = popFirstBit(bits);
+        uint64_t mvbits = pieceMovesBB<path, pc>(from, occupiedBB) & target;
+        if constexpr (pc != KNIGHT && pc != KING) mvbits &= pinRayBB(pinned, kpos[c], from);
+        while (mvbits) mvlist.add(move_t(from, popFirstBit(mvbits), MF_NORMAL));
+    }
 }
 
-void position_t::genTacticalMoves(movelist_t<220>& mvlist) {
-    const int xside = side ^ 1;
-    const uint64_t targetBB = colorBB[xside] & ~piecesBB[KING];
+// pushes must land on pushmask and captures on capmask; promotions count as tactical
+template<int c, GenTypes gt>
+void position_t::genPawnMoves(movelist_t<220>& mvlist, uint64_t pawns, uint64_t pushmask, uint64_t capmask) {
+    constexpr int up = (c == WHITE) ? 8 : -8;
+    constexpr int west = (c == WHITE) ? 7 : -9;
+    constexpr int east = (c == WHITE) ? 9 : -7;
+    const uint64_t prom = pawns & Rank7ByColorBB[c];
+    const uint64_t nonprom = pawns & ~Rank7ByColorBB[c];
+
+    if constexpr (gt != GEN_QUIET) {
+        addPromotions(mvlist, shift8BB<c>(prom) & ~occupiedBB & pushmask, up);
+        addPromotions(mvlist, pawnCapsWestBB<c>(prom) & capmask, west);
+        addPromotions(mvlist, pawnCapsEastBB<c>(prom) & capmask, east);
+        addPawnMoves(mvlist, pawnCapsWestBB<c>(nonprom) & capmask, west, MF_NORMAL);
+        addPawnMoves(mvlist, pawnCapsEastBB<c>(nonprom) & capmask, east, MF_NORMAL);
+    }
+    if constexpr (gt != GEN_TACTICAL) {
+        const uint64_t single = shift8BB<c>(nonprom) & ~occupiedBB;
+        addPawnMoves(mvlist, single & pushmask, up, MF_NORMAL);
+        addPawnMoves(mvlist, shift8BB<c>(single & Rank3ByColorBB[c]) & ~occupiedBB & pushmask, 2 * up, MF_PAWN2);
+    }
+}
+
+template<int path, int c, GenTypes gt>
+void position_t::genMoves(movelist_t<220>& mvlist) {
+    constexpr int xc = c ^ 1;
+    const int ksq = kpos[c];
+    const uint64_t pinned = stack.pinned;
+
+    if constexpr (gt == GEN_EVASION) {
+        const uint64_t checkersBB = getAttacksBB<path>(ksq, xc);
+        const uint64_t xatks = attackedSqsBB<path>(xc, occupiedBB ^ BitMask[ksq]);
+
+        genPieceMoves<path, c, KING>(mvlist, pinned, FullBoardBB, ~colorBB[c] & ~xatks);
+
+        if (checkersBB & (checkersBB - 1)) return;
+
+        const int sqchecker = getFirstBit(checkersBB);
+        const uint64_t notpinned = ~pinned;
+        const uint64_t targetBB = InBetween[sqchecker][ksq] | checkersBB;
 
-    if (stack.epsq != -1)
-        genMoves(MT_EP, pawnAttacksBB(stack.epsq, xside), side, BitMask[stack.epsq]);
+        genPawnMoves<c, GEN_EVASION>(mvlist, getPieceBB(PAWN, c) & notpinned, targetBB, checkersBB);
+        if (stack.epsq != -1 && (checkersBB & getPieceBB(PAWN, xc)) && shift8BB<c>(checkersBB) == BitMask[stack.epsq])
+            genEnPassant<path>(mvlist, notpinned);
+        genPieceMoves<path, c, KNIGHT>(mvlist, pinned, notpinned, targetBB);
+        genPieceMoves<path, c, BISHOP>(mvlist, pinned, notpinned, targetBB);
+        genPieceMoves<path, c, ROOK>(mvlist, pinned, notpinned, targetBB);
+        genPieceMoves<path, c, QUEEN>(mvlist, pinned, notpinned, targetBB);
+    }
+    else {
+        const uint64_t targetBB = (gt == GEN_TACTICAL) ? colorBB[xc] & ~piecesBB[KING] : ~occupiedBB;
+
+        uint64_t xatks = 0;
+
+        if constexpr (gt == GEN_TACTICAL) {
+            if (stack.epsq != -1) genEnPassant<path>(mvlist, FullBoardBB);
+            if (kingMovesBB(ksq) & targetBB) xatks = attackedSqsBB<path>(xc, occupiedBB ^ BitMask[ksq]);
+        }
+        else {
+            xatks = attackedSqsBB<path>(xc, occupiedBB ^ BitMask[ksq]);
+            if (canCastleKS(c) && !(occupiedBB & CastleSquareMask1[c][0]) && !(xatks & CastleSquareMask2[c][0]))
+                mvlist.add(move_t(CastleSquareFrom[c], CastleSquareTo[c][0], MF_CASTLE));
+            if (canCastleQS(c) && !(occupiedBB & CastleSquareMask1[c][1]) && !(xatks & CastleSquareMask2[c][1]))
+                mvlist.add(move_t(CastleSquareFrom[c], CastleSquareTo[c][1], MF_CASTLE));
+        }
 
-    genProms(MT_PAWNPROM, Rank7ByColorBB[side], side, ~occupiedBB);
-    genProms(MT_PAWNCAPPROM, Rank7ByColorBB[side], side, targetBB);
-    genMoves(MT_PAWNCAP, ~Rank7ByColorBB[side], side, targetBB);
-    genMovesPcs(occupiedBB, targetBB);
-    genMoves(MT_KING, occupiedBB, 0, targetBB & ~kingMovesBB(kpos[xside]));
+        genPawnMoves<c, gt>(mvlist, getPieceBB(PAWN, c) & ~pinned, FullBoardBB, targetBB);
+        for (uint64_t bits = getPieceBB(PAWN, c) & pinned; bits;) {
+            const uint64_t from = BitMask[popFirstBit(bits)];
+            const uint64_t ray = pinRayBB(pinned, ksq, getFirstBit(from));
+            genPawnMoves<c, gt>(mvlist, from, ray, targetBB & ray);
+        }
+        genPieceMoves<path, c, KNIGHT>(mvlist, pinned, FullBoardBB, targetBB);
+        genPieceMoves<path, c, BISHOP>(mvlist, pinned, FullBoardBB, targetBB);
+        genPieceMoves<path, c, ROOK>(mvlist, pinned, FullBoardBB, targetBB);
+        genPieceMoves<path, c, QUEEN>(mvlist, pinned, FullBoardBB, targetBB);
+        genPieceMoves<path, c, KING>(mvlist, pinned, FullBoardBB, targetBB & ~xatks);
+    }
 }
 
-void position_t::genCheckEvasions(movelist_t<220>& mvlist) {
-    const int xside = side ^ 1;
-    const int ksq = kpos[side];
-    const uint64_t checkersBB = getAttacksBB(ksq, xside);
+void position_t::genLegal(movelist_t<220>& mvlist) {
+    withCpuPath([&](auto path) { genLegal<decltype(path)::value>(mvlist); });
+}
+
+template<int path>
+void position_t::genLegal(movelist_t<220>& mvlist) {
+    if (kingIsInCheck<path>())
+        genCheckEvasions<path>(mvlist);
+    else {
+        genTacticalMoves<path>(mvlist);
+        genQuietMoves<path>(mvlist);
+    }
+}
 
-    genMoves(MT_KING, occupiedBB, 0, safeSqsBB(xside, occupiedBB ^ BitMask[ksq], kingMovesBB(ksq)) & ~colorBB[side] & ~kingMovesBB(kpos[xside]));
+template<int path>
+void position_t::genEnPassant(movelist_t<220>& mvlist, uint64_t frombits) {
+    for (uint64_t bits = frombits & getPieceBB(PAWN, side) & pawnAttacksBB(stack.epsq, side ^ 1); bits;) {
+        move_t m(popFirstBit(bits), stack.epsq, MF_ENPASSANT);
+        if (moveIsLegal<path>(m, false)) mvlist.add(m);
+    }
+}
 
-    if (checkersBB & (checkersBB - 1)) return;
+void position_t::genQuietMoves(movelist_t<220>& mvlist) {
+    withCpuPath([&](auto path) { genQuietMoves<decltype(path)::value>(mvlist); });
+}
 
-    const int sqchecker = getFirstBit(checkersBB);
-    const uint64_t notpinned = ~pinnedPiecesBB(side);
-    const uint64_t inbetweenBB = InBetween[sqchecker][ksq];
+template<int path>
+void position_t::genQuietMoves(movelist_t<220>& mvlist) {
+    if (side == WHITE) genMoves<path, WHITE, GEN_QUIET>(mvlist);
+    else genMoves<path, BLACK, GEN_QUIET>(mvlist);
+}
 
-    uint64_t pcbits = notpinned & pawnAttacksBB(sqchecker, xside);
-    genMoves(MT_PAWNCAP, pcbits & ~Rank7ByColorBB[side], side, checkersBB);
-    genProms(MT_PAWNCAPPROM, pcbits & Rank7ByColorBB[side], side, checkersBB);
+void position_t::genTacticalMoves(movelist_t<220>& mvlist) {
+    withCpuPath([&](auto path) { genTacticalMoves<decltype(path)::value>(mvlist); });
+}
 
-    if (checkersBB & getPieceBB(PAWN, xside) && (sqchecker + ((side == WHITE) ? 8 : -8)) == stack.epsq)
-        genMoves(MT_EP, notpinned, side, BitMask[stack.epsq]);
+template<int path>
+void position_t::genTacticalMoves(movelist_t<220>& mvlist) {
+    if (side == WHITE) genMoves<path, WHITE, GEN_TACTICAL>(mvlist);
+    else genMoves<path, BLACK, GEN_TACTICAL>(mvlist);
+}
 
-    genMovesPcs(notpinned, (inbetweenBB | checkersBB));
+void position_t::genCheckEvasions(movelist_t<220>& mvlist) {
+    withCpuPath([&](auto path) { genCheckEvasions<decltype(path)::value>(mvlist); });
+}
 
-    if (!inbetweenBB) return;
+template<int path>
+void position_t::genCheckEvasions(movelist_t<220>& mvlist) {
+    if (side == WHITE) genMoves<path, WHITE, GEN_EVASION>(mvlist);
+    else genMoves<path, BLACK, GEN_EVASION>(mvlist);
+}
 
-    pcbits = notpinned & shift8BB[xside](inbetweenBB);
-    genMoves(MT_PAWN, pcbits & ~Rank7ByColorBB[side], side, inbetweenBB);
-    genProms(MT_PAWNPROM, pcbits & Rank7ByColorBB[side], side, inbetweenBB);
-    pcbits = notpinned & shift8BB[xside](~occupiedBB) & shift16BB[xside](~occupiedBB) & shift16BB[xside](inbetweenBB);
-    genMoves(MT_PAWN2, pcbits & Rank2ByColorBB[side], side, inbetweenBB);
-}
\ No newline at end of file
+// the generators the search and perft call into
+#define INSTANTIATE_GENERATORS(path) \
+    template void position_t::genLegal<path>(movelist_t<220>& mvlist); \
+    template void position_t::genQuietMoves<path>(movelist_t<220>& mvlist); \
+    template void position_t::genTacticalMoves<path>(movelist_t<220>& mvlist); \
+    template void position_t::genCheckEvasions<path>(movelist_t<220>& mvlist);
+FOR_EACH_CPU_PATH(INSTANTIATE_GENERATORS)
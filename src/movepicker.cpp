@@ -5,32 +5,106 @@
 /**************************************************/
 
 #include <algorithm>
+#include <climits>
+#include <immintrin.h>
 #include "typedefs.h"
 #include "movepicker.h"
+#include "utils.h"
 
-movepicker_t::movepicker_t(search_t& search, bool inCheck, bool inQS, int marg, uint16_t hmove, uint16_t k1, uint16_t k2, uint16_t cm)
-    : s(search), pos(s.pos), idx(0), hashmove(hmove), killer1(k1), killer2(k2), counter(cm), inQSearch(inQS), margin(marg) {
-    pinned = pos.pinnedPiecesBB(pos.side);
+namespace {
+    // quiets with at least this much history are sorted up front, the rest are selected lazily
+    const int QuietSortLimit = -2000;
+
+    // lane-wise max of the scores from start to size
+    __m128i maxScoresSSE2(const int16_t* scores, int start, int size) {
+        __m128i m = _mm_set1_epi16(INT16_MIN);
+        for (int i = start & ~7; i < size; i += 8)
+            m = _mm_max_epi16(m, _mm_load_si128((const __m128i*)&scores[i]));
+        return m;
+    }
+    __attribute__((target("avx2"))) __m128i maxScoresAVX2(const int16_t* scores, int start, int size) {
+        __m256i best = _mm256_set1_epi16(INT16_MIN);
+        for (int i = start & ~15; i < size; i += 16)
+            best = _mm256_max_epi16(best, _mm256_load_si256((const __m256i*)&scores[i]));
+        return _mm_max_epi16(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+    }
+}
+
+template<int path>
+movepicker_t<path>::movepicker_t(search_t& search, bool inCheck, bool inQS, int marg, uint16_t hmove, uint16_t k1, uint16_t k2, uint16_t cm)
+    : s(search), pos(s.pos), idx(0), sortedend(0), hashmove(hmove), killer1(k1), killer2(k2), counter(cm), inQSearch(inQS), margin(marg), attackersknown(0), seeknown(0) {
     if (inCheck) {
-        pos.genCheckEvasions(mvlist);
+        pos.genCheckEvasions<path>(mvlist);
         scoreEvasions();
         stage = STG_EVASION;
     }
     else stage = STG_HTABLE;
 }
 
-move_t movepicker_t::getBestMoveFromIdx(int idx) {
-    int best_idx = idx;
-    for (int i = idx + 1; i < mvlist.size; ++i) {
-        if (mvlist[i].s > mvlist[best_idx].s)
-            best_idx = i;
+// first index at or after idx holding the highest score; scores of moves
+// already picked are INT16_MIN, so whole vectors can be scanned
+template<int path>
+int movepicker_t<path>::getBestIdx(int idx) {
+    __m128i m;
+    if constexpr (cpuLevel(path) >= CPU_AVX2) m = maxScoresAVX2(scores, idx, mvlist.size);
+    else m = maxScoresSSE2(scores, idx, mvlist.size);
+    m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_max_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    const __m128i target = _mm_set1_epi16(int16_t(_mm_cvtsi128_si32(m)));
+    for (int i = idx & ~7;; i += 8) {
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi16(target, _mm_load_si128((const __m128i*)&scores[i])));
+        if (i < idx) mask &= ~0u << (2 * (idx - i));
+        if (mask) return i + __builtin_ctz(mask) / 2;
     }
-    if (best_idx != idx)
+}
+
+template<int path>
+move_t movepicker_t<path>::getMoveAtIdx(int idx) {
+    move_t move = mvlist[idx];
+    move.s = scores[idx];
+    scores[idx] = INT16_MIN;
+    return move;
+}
+
+template<int path>
+move_t movepicker_t<path>::getBestMoveFromIdx(int idx) {
+    int best_idx = getBestIdx(idx);
+    if (best_idx != idx) {
         std::swap(mvlist[best_idx], mvlist[idx]);
-    return mvlist[idx];
+        std::swap(scores[best_idx], scores[idx]);
+    }
+    return getMoveAtIdx(idx);
+}
+
+template<int path>
+void movepicker_t<path>::padScores() {
+    for (int i = mvlist.size; i & 15; ++i) scores[i] = INT16_MIN;
+}
+
+// moves scoring at least limit are insertion sorted to the front, the rest are
+// left behind them in generation order for getBestMoveFromIdx
+template<int path>
+void movepicker_t<path>::sortQuiets(int first, int limit) {
+    sortedend = first;
+    for (int p = first; p < mvlist.size; ++p) {
+        if (scores[p] < limit) continue;
+        const move_t m = mvlist[p];
+        const int16_t sc = scores[p];
+        mvlist[p] = mvlist[sortedend];
+        scores[p] = scores[sortedend];
+        int q = sortedend++;
+        for (; q > first && scores[q - 1] < sc; --q) {
+            mvlist[q] = mvlist[q - 1];
+            scores[q] = scores[q - 1];
+        }
+        mvlist[q] = m;
+        scores[q] = sc;
+    }
 }
 
-bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
+template<int path>
+bool movepicker_t<path>::getMoves(move_t& move, bool skipquiets) {
     switch (stage) {
     case STG_EVASION:
         if (idx < mvlist.size) {
@@ -43,7 +117,7 @@ bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
         ++stage;
         if (hashmove != 0) {
             move.m = hashmove;
-            if (pos.moveIsValid(move, pinned) && pos.moveIsLegal(move, pinned, false))
+            if (pos.moveIsValid<path>(move) && pos.moveIsLegal<path>(move, false))
                 return true;
             else {
                 LogAndPrintOutput() << "Hashmove not valid!";
@@ -52,20 +126,19 @@ bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
             }
         }
     case STG_GENTACTICS:
-        pos.genTacticalMoves(mvlist);
+        pos.genTacticalMoves<path>(mvlist);
         scoreTactical();
         ++stage;
     case STG_WINTACTICS:
         while (idx < mvlist.size) {
             move = getBestMoveFromIdx(idx++);
             if (move.m == hashmove) continue;
-            if (move.s < 800 && !pos.staticExchangeEval(move, margin)) {
+            if (move.s < 800 && !see(move, margin)) {
                 if (!inQSearch)
                     mvlistbad.add(move);
                 continue;
             }
-            if (pos.moveIsLegal(move, pinned, false))
-                return true;
+            return true;
         }
         if (inQSearch) return false;
         ++stage;
@@ -73,39 +146,39 @@ bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
         ++stage;
         if (!skipquiets && killer1 != 0 && killer1 != hashmove) {
             move.m = killer1;
-            if (pos.moveIsValid(move, pinned) && pos.moveIsLegal(move, pinned, false))
+            if (pos.moveIsValid<path>(move) && pos.moveIsLegal<path>(move, false))
                 return true;
         }
     case STG_KILLER2:
         ++stage;
         if (!skipquiets  && killer2 != 0 && killer2 != hashmove) {
             move.m = killer2;
-            if (pos.moveIsValid(move, pinned) && pos.moveIsLegal(move, pinned, false))
+            if (pos.moveIsValid<path>(move) && pos.moveIsLegal<path>(move, false))
                 return true;
         }
     case STG_COUNTER:
         ++stage;
         if (!skipquiets && counter != 0 && counter != hashmove && counter != killer1 && counter != killer2) {
             move.m = counter;
-            if (pos.moveIsValid(move, pinned) && pos.moveIsLegal(move, pinned, false))
+            if (pos.moveIsValid<path>(move) && pos.moveIsLegal<path>(move, false))
                 return true;
         }
     case STG_GENQUIET:
         if (!skipquiets) {
-            pos.genQuietMoves(mvlist);
+            pos.genQuietMoves<path>(mvlist);
             scoreNonTactical();
+            sortQuiets(idx, QuietSortLimit);
         }
         ++stage;
     case STG_QUIET:
         if (!skipquiets) {
             while (idx < mvlist.size) {
-                move = getBestMoveFromIdx(idx++);
+                move = (idx < sortedend) ? getMoveAtIdx(idx++) : getBestMoveFromIdx(idx++);
                 if (move.m == hashmove) continue;
                 if (move.m == killer1) continue;
                 if (move.m == killer2) continue;
                 if (move.m == counter) continue;
-                if (pos.moveIsLegal(move, pinned, false))
-                    return true;
+                return true;
             }
         }
         ++stage;
@@ -114,8 +187,7 @@ bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
         while (idx < mvlistbad.size) { // no need to order, ordered already
             move = mvlistbad[idx++];
             if (move.m == hashmove) continue;
-            if (pos.moveIsLegal(move, pinned, false))
-                return true;
+            return true;
         }
         ++stage;
         idx = 0;
@@ -134,36 +206,73 @@ bool movepicker_t::getMoves(move_t& move, bool skipquiets) {
     return false;
 }
 
-void movepicker_t::scoreTactical() {
-    for (move_t& m : mvlist) {
+// SEE results are kept per node as bounds on the exchange value, so repeated
+// queries for a move, e.g. from the pruning in search, rarely need a recompute
+template<int path>
+bool movepicker_t<path>::see(move_t m, int threshold) {
+    const int slot = (m.m * 0x9E3779B1u) >> 26;
+    see_entry_t& entry = seecache[slot];
+    if (!(seeknown & (1ull << slot)) || entry.move != m.m) {
+        entry.move = m.m;
+        entry.lo = INT16_MIN;
+        entry.hi = INT16_MAX;
+        seeknown |= 1ull << slot;
+    }
+    else if (threshold <= entry.lo) return true;
+    else if (threshold > entry.hi) return false;
+
+    if (pos.staticExchangeEval<path>(m, threshold, attackersto, attackersknown)) {
+        entry.lo = std::max<int>(entry.lo, threshold);
+        return true;
+    }
+    entry.hi = std::min<int>(entry.hi, threshold - 1);
+    return false;
+}
+
+template<int path>
+void movepicker_t<path>::scoreTactical() {
+    for (int i = 0; i < mvlist.size; ++i) {
+        const move_t m = mvlist[i];
         int to = m.to();
         int piece = pos.getPiece(m.from());
         int cap = pos.pieces[to];
-        m.s = (cap + m.promoted()) * 6 - piece;
-        m.s += s.caphistory[piece][cap][to];
+        scores[i] = (cap + m.promoted()) * 6 - piece + s.caphistory[piece][cap][to];
     }
+    padScores();
 }
 
-void movepicker_t::scoreNonTactical() {
-    int h, ch, fh;
-    for (move_t& m : mvlist) {
-        s.getHistoryValues(h, ch, fh, m);
-        m.s = h + ch + fh;
-        //PrintOutput() << m.to_str() << " " << m.s;
+template<int path>
+void movepicker_t<path>::scoreNonTactical() {
+    // the quiets are appended after the tactical moves, which are all picked by now
+    const int16_t* history = &s.history[pos.side][0][0];
+    const int16_t* cmh = &s.cmh[pos.stack.movingpc][pos.stack.dest][0][0];
+    const int16_t* fmh = (s.ply > 1) ? &s.fmh[s.stack[s.ply - 1].movingpc][s.stack[s.ply - 1].dest][0][0] : nullptr;
+    for (int i = idx; i < mvlist.size; ++i) {
+        const move_t m = mvlist[i];
+        const int from = m.from(), to = m.to();
+        const int pcto = (pos.pieces[from] << 6) | to;
+        scores[i] = history[(from << 6) | to] + cmh[pcto] + (fmh ? fmh[pcto] : 0);
     }
+    padScores();
 }
 
-void movepicker_t::scoreEvasions() {
+template<int path>
+void movepicker_t<path>::scoreEvasions() {
     int h, ch, fh;
-    for (move_t& m : mvlist) {
-        if (m.m == hashmove) m.s = 10000;
-        else if (m.m == killer1) m.s = 5000;
-        else if (m.m == killer2) m.s = 4999;
-        else if (m.m == counter) m.s = 4998;
-        else if (pos.moveIsTactical(m)) m.s = 7000 + (pos.pieces[m.to()] + m.promoted()) * 10 - pos.pieces[m.from()];
+    for (int i = 0; i < mvlist.size; ++i) {
+        const move_t m = mvlist[i];
+        if (m.m == hashmove) scores[i] = 10000;
+        else if (m.m == killer1) scores[i] = 5000;
+        else if (m.m == killer2) scores[i] = 4999;
+        else if (m.m == counter) scores[i] = 4998;
+        else if (pos.moveIsTactical(m)) scores[i] = 7000 + (pos.pieces[m.to()] + m.promoted()) * 10 - pos.pieces[m.from()];
         else {
             s.getHistoryValues(h, ch, fh, m);
-            m.s = h + ch + fh;
+            scores[i] = h + ch + fh;
         }
     }
-}
\ No newline at end of file
+    padScores();
+}
+
+#define INSTANTIATE_MOVEPICKER(path) template struct movepicker_t<path>;
+FOR_EACH_CPU_PATH(INSTANTIATE_MOVEPICKER)
@@ -25,18 +25,31 @@ enum MoveGenStages {
     STG_DONE
 };
 
+struct see_entry_t {
+    uint16_t move;
+    int16_t lo; // the exchange is known to gain at least lo
+    int16_t hi; // and at most hi
+};
+
+// the move ordering of one cpu path, see Utils::withCpuPath
+template<int path>
 struct movepicker_t {
     movepicker_t(search_t& search, bool inCheck, bool inQS, int marg, uint16_t hmove = 0, uint16_t k1 = 0, uint16_t k2 = 0, uint16_t cm = 0);
     move_t getBestMoveFromIdx(int idx);
+    move_t getMoveAtIdx(int idx);
+    int getBestIdx(int idx);
+    void padScores();
+    void sortQuiets(int first, int limit);
     bool getMoves(move_t& move, bool skipquiets = false);
     void scoreTactical();
     void scoreNonTactical();
     void scoreEvasions();
+    bool see(move_t m, int threshold);
     int stage;
     int idx;
+    int sortedend;
     int margin;
     bool inQSearch;
-    uint64_t pinned;
     uint16_t hashmove;
     uint16_t killer1;
     uint16_t killer2;
@@ -44,6 +57,11 @@ struct movepicker_t {
     search_t& s;
     position_t& pos;
     movelist_t<220> mvlist;
+    alignas(32) int16_t scores[224]; // scores of mvlist, padded to a whole number of vectors
     movelist_t<80> mvlistbad;
     movelist_t<220> deferred;
+    uint64_t attackersto[64];
+    uint64_t attackersknown;
+    see_entry_t seecache[64];
+    uint64_t seeknown;
 };
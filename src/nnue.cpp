@@ -0,0 +1,214 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#include <cstdlib>
+#include <fstream>
+#include <immintrin.h>
+#include "typedefs.h"
+#include "nnue.h"
+#include "position.h"
+#include "utils.h"
+
+using namespace Utils;
+
+namespace {
+    struct network_t {
+        alignas(64) int16_t ftweights[NNUE::Inputs][NNUE::HiddenSize];
+        alignas(64) int16_t ftbias[NNUE::HiddenSize];
+        alignas(64) int16_t outweights[2][NNUE::HiddenSize];
+        int16_t outbias;
+    };
+    network_t Net;
+
+    // the output weights as int8 in the lane order of the int8 kernel in use, when they all fit in
+    // [-QB, QB]: maddubs then adds two 255 * 64 products without saturating and the result is exact
+    alignas(64) int8_t OutWeights8[2][NNUE::HiddenSize];
+    bool UseInt8 = false;
+
+    inline const int16_t* featureRow(int persp, int c, int pc, int sq) {
+        return Net.ftweights[(c != persp) * 384 + (pc - 1) * 64 + (persp == WHITE ? sq : sq ^ 56)];
+    }
+
+    // dst = src + the added rows - the removed rows
+    void updateSSE2(int16_t* dst, const int16_t* src, const int16_t* const add[], int nadd, const int16_t* const sub[], int nsub) {
+        for (int i = 0; i < NNUE::HiddenSize; i += 8) {
+            __m128i v = _mm_load_si128((const __m128i*)(src + i));
+            for (int r = 0; r < nadd; ++r) v = _mm_add_epi16(v, _mm_load_si128((const __m128i*)(add[r] + i)));
+            for (int r = 0; r < nsub; ++r) v = _mm_sub_epi16(v, _mm_load_si128((const __m128i*)(sub[r] + i)));
+            _mm_store_si128((__m128i*)(dst + i), v);
+        }
+    }
+    __attribute__((target("avx2"))) void updateAVX2(int16_t* dst, const int16_t* src, const int16_t* const add[], int nadd, const int16_t* const sub[], int nsub) {
+        for (int i = 0; i < NNUE::HiddenSize; i += 16) {
+            __m256i v = _mm256_load_si256((const __m256i*)(src + i));
+            for (int r = 0; r < nadd; ++r) v = _mm256_add_epi16(v, _mm256_load_si256((const __m256i*)(add[r] + i)));
+            for (int r = 0; r < nsub; ++r) v = _mm256_sub_epi16(v, _mm256_load_si256((const __m256i*)(sub[r] + i)));
+            _mm256_store_si256((__m256i*)(dst + i), v);
+        }
+    }
+    void update(int16_t* dst, const int16_t* src, const int16_t* const add[], int nadd, const int16_t* const sub[], int nsub) {
+        if (cpuHas(CPU_AVX2)) updateAVX2(dst, src, add, nadd, sub, nsub);
+        else updateSSE2(dst, src, add, nadd, sub, nsub);
+    }
+
+    // clipped relu of both accumulators dotted with the output weights
+    int outputSSE2(const int16_t* us, const int16_t* them) {
+        const __m128i zero = _mm_setzero_si128(), qa = _mm_set1_epi16(NNUE::QA);
+        __m128i sum = zero;
+        for (int k = 0; k < 2; ++k) {
+            const int16_t* acc = k ? them : us;
+            for (int i = 0; i < NNUE::HiddenSize; i += 8) {
+                const __m128i v = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(acc + i)), zero), qa);
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(v, _mm_load_si128((const __m128i*)(Net.outweights[k] + i))));
+            }
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+    __attribute__((target("avx2"))) int outputAVX2(const int16_t* us, const int16_t* them) {
+        const __m256i zero = _mm256_setzero_si256(), qa = _mm256_set1_epi16(NNUE::QA);
+        __m256i sum = zero;
+        for (int k = 0; k < 2; ++k) {
+            const int16_t* acc = k ? them : us;
+            for (int i = 0; i < NNUE::HiddenSize; i += 16) {
+                const __m256i v = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(acc + i)), zero), qa);
+                sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v, _mm256_load_si256((const __m256i*)(Net.outweights[k] + i))));
+            }
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    // int8 versions: packus clamps to [0, 255], which is the clipped relu, and maddubs takes the bytes
+    __attribute__((target("sse4.1"))) int outputSSE4(const int16_t* us, const int16_t* them) {
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i sum = _mm_setzero_si128();
+        for (int k = 0; k < 2; ++k) {
+            const int16_t* acc = k ? them : us;
+            for (int i = 0; i < NNUE::HiddenSize; i += 16) {
+                const __m128i v = _mm_packus_epi16(_mm_load_si128((const __m128i*)(acc + i)), _mm_load_si128((const __m128i*)(acc + i + 8)));
+                const __m128i p = _mm_maddubs_epi16(v, _mm_load_si128((const __m128i*)(OutWeights8[k] + i)));
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(p, ones));
+            }
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(sum);
+    }
+    __attribute__((target("avx2"))) int outputAVX2Int8(const int16_t* us, const int16_t* them) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < 2; ++k) {
+            const int16_t* acc = k ? them : us;
+            for (int i = 0; i < NNUE::HiddenSize; i += 32) {
+                const __m256i v = _mm256_packus_epi16(_mm256_load_si256((const __m256i*)(acc + i)), _mm256_load_si256((const __m256i*)(acc + i + 16)));
+                const __m256i p = _mm256_maddubs_epi16(v, _mm256_load_si256((const __m256i*)(OutWeights8[k] + i)));
+                sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+            }
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    // packs the output weights for the int8 kernels, if they fit
+    void prepareInt8() {
+        UseInt8 = false;
+        if (!cpuHas(CPU_AVX2) && !CpuSSE41) return;
+        for (int k = 0; k < 2; ++k)
+            for (int i = 0; i < NNUE::HiddenSize; ++i)
+                if (std::abs(Net.outweights[k][i]) > NNUE::QB) return;
+        for (int k = 0; k < 2; ++k) {
+            for (int i = 0; i < NNUE::HiddenSize; ++i) {
+                int j = i;
+                // _mm256_packus_epi16 interleaves its inputs per 128-bit lane: a0-7 b0-7 | a8-15 b8-15
+                if (cpuHas(CPU_AVX2)) j = (i & ~31) + (i & 16) / 2 + (i & 8) * 2 + (i & 7);
+                OutWeights8[k][i] = int8_t(Net.outweights[k][j]);
+            }
+        }
+        UseInt8 = true;
+    }
+
+    int output(const int16_t* us, const int16_t* them) {
+        if (cpuHas(CPU_AVX2)) return UseInt8 ? outputAVX2Int8(us, them) : outputAVX2(us, them);
+        return UseInt8 ? outputSSE4(us, them) : outputSSE2(us, them);
+    }
+
+    // brings cur up to date from prev and the pieces that changed in between
+    void apply(const NNUE::accumulator_t& prev, NNUE::accumulator_t& cur) {
+        for (int persp = WHITE; persp <= BLACK; ++persp) {
+            const int16_t* add[NNUE::MaxDirty];
+            const int16_t* sub[NNUE::MaxDirty];
+            int nadd = 0, nsub = 0;
+            for (int i = 0; i < cur.ndirty; ++i) {
+                const NNUE::dirty_piece_t& d = cur.dirty[i];
+                if (d.sign > 0) add[nadd++] = featureRow(persp, d.color, d.piece, d.sq);
+                else sub[nsub++] = featureRow(persp, d.color, d.piece, d.sq);
+            }
+            update(cur.values[persp], prev.values[persp], add, nadd, sub, nsub);
+        }
+        cur.computed = true;
+    }
+}
+
+namespace NNUE {
+    bool Enabled = false;
+
+    bool load(const std::string& path) {
+        Enabled = false;
+        if (path.empty() || path == "<empty>") return false;
+        std::ifstream file(path, std::ios::binary);
+        file.read((char*)Net.ftweights, sizeof(Net.ftweights));
+        file.read((char*)Net.ftbias, sizeof(Net.ftbias));
+        file.read((char*)Net.outweights, sizeof(Net.outweights));
+        file.read((char*)&Net.outbias, sizeof(Net.outbias));
+        if (!file || file.peek() != std::ifstream::traits_type::eof()) {
+            LogAndPrintOutput() << "info string failed to load network " << path;
+            return false;
+        }
+        prepareInt8();
+        LogAndPrintOutput() << "info string loaded network " << path << (UseInt8 ? " (int8 output)" : "");
+        return Enabled = true;
+    }
+
+    void refresh(position_t& pos, accumulator_t& acc) {
+        for (int persp = WHITE; persp <= BLACK; ++persp) {
+            const int16_t* add[32];
+            int nadd = 0;
+            for (uint64_t pcbits = pos.occupiedBB; pcbits;) {
+                int sq = popFirstBit(pcbits);
+                add[nadd++] = featureRow(persp, pos.getSide(sq), pos.getPiece(sq), sq);
+            }
+            update(acc.values[persp], Net.ftbias, add, nadd, nullptr, 0);
+        }
+        acc.computed = true;
+    }
+
+    int evaluate(position_t& pos) {
+        accumulator_t local;
+        accumulator_t* acc = pos.acc;
+        if (!acc) refresh(pos, *(acc = &local));
+        else if (!acc->computed) {
+            accumulator_t* last = acc;
+            while (!last->computed) --last;
+            for (; last != acc; ++last) apply(*last, *(last + 1));
+        }
+        const int16_t* us = acc->values[pos.side];
+        const int16_t* them = acc->values[pos.side ^ 1];
+        const int out = output(us, them);
+#ifdef DEBUG
+        refresh(pos, local);
+        for (int persp = WHITE; persp <= BLACK; ++persp)
+            for (int i = 0; i < HiddenSize; ++i) ASSERT(local.values[persp][i] == acc->values[persp][i]);
+        ASSERT(out == outputSSE2(us, them));
+#endif
+        return (out + Net.outbias) * Scale / (QA * QB);
+    }
+}
@@ -0,0 +1,46 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#pragma once
+
+#include <string>
+#include "typedefs.h"
+
+struct position_t;
+
+// (768 -> 256) x 2 -> 1 network: one feature per (color relative to the perspective, piece, square),
+// clipped relu on the accumulators of the side to move and of the other side, then a single output
+namespace NNUE {
+    constexpr int Inputs = 768;
+    constexpr int HiddenSize = 256;
+    constexpr int QA = 255; // accumulator quantization, also the clipped relu ceiling
+    constexpr int QB = 64; // output weight quantization
+    constexpr int Scale = 400; // network output to centipawns
+    constexpr int MaxDirty = 4; // castling moves two pieces, 2 off and 2 on; a capture promotion is 2 off, 1 on
+
+    // a piece put on or taken off the board by the move that led to an accumulator
+    struct dirty_piece_t {
+        uint8_t color;
+        uint8_t piece;
+        uint8_t sq;
+        int8_t sign;
+    };
+
+    // accumulators for both perspectives, updated lazily from the previous ply at evaluation time
+    struct accumulator_t {
+        alignas(32) int16_t values[2][HiddenSize];
+        bool computed;
+        int ndirty;
+        dirty_piece_t dirty[MaxDirty];
+        void reset() { computed = false, ndirty = 0; }
+        void add(int c, int pc, int sq, int sign) { ASSERT(ndirty < MaxDirty); dirty[ndirty++] = { uint8_t(c), uint8_t(pc), uint8_t(sq), int8_t(sign) }; }
+    };
+
+    extern bool Enabled;
+    extern bool load(const std::string& path);
+    extern void refresh(position_t& pos, accumulator_t& acc);
+    extern int evaluate(position_t& pos);
+}
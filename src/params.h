@@ -8,76 +8,109 @@
 
 #include "typedefs.h"
 
+struct eval_trace_t;
+
 namespace EvalParam {
-    extern score_t MaterialValues[7];
-
-    extern score_t PawnConnected;
-    extern score_t PawnDoubled;
-    extern score_t PawnIsolated;
-    extern score_t PawnBackward;
-    extern score_t PawnIsolatedOpen;
-    extern score_t PawnBackwardOpen;
-
-    extern score_t PasserDistOwn[8];
-    extern score_t PasserDistEnemy[8];
-    extern score_t PasserBonus[8];
-    extern score_t PasserNotBlocked[8];
-    extern score_t PasserSafePush[8];
-    extern score_t PasserSafeProm[8];
-
-    extern score_t KnightMob[9];
-    extern score_t BishopMob[14];
-    extern score_t RookMob[15];
-    extern score_t QueenMob[28];
-    extern score_t RookOn7th;
-    extern score_t RookOnSemiOpenFile;
-    extern score_t RookOnOpenFile;
-    extern score_t KnightOutpost;
-    extern score_t KnightXOutpost;
-    extern score_t BishopOutpost;
-    extern score_t BishopPawns;
-    extern score_t BishopCenterControl;
-    extern basic_score_t Tempo;
-
-    extern score_t PawnPush;
-    extern score_t WeakPawns;
-    extern score_t PawnsxMinors;
-    extern score_t MinorsxMinors;
-    extern score_t MajorsxWeakMinors;
-    extern score_t PawnsMinorsxMajors;
-    extern score_t AllxQueens;
-    extern score_t KingxMinors;
-    extern score_t KingxRooks;
-
-    extern basic_score_t KnightAtk;
-    extern basic_score_t BishopAtk;
-    extern basic_score_t RookAtk;
-    extern basic_score_t QueenAtk;
-    extern basic_score_t KingZoneAttacks;
-    extern basic_score_t WeakSquares;
-    extern basic_score_t EnemyPawns;
-    extern basic_score_t QueenSafeCheckValue;
-    extern basic_score_t RookSafeCheckValue;
-    extern basic_score_t BishopSafeCheckValue;
-    extern basic_score_t KnightSafeCheckValue;
-
-    extern basic_score_t KingShelter1;
-    extern basic_score_t KingShelter2;
-    extern basic_score_t KingShelterF1;
-    extern basic_score_t KingShelterF2;
-    extern basic_score_t KingStorm1;
-    extern basic_score_t KingStorm2;
-
-    extern score_t PieceSpace;
-    extern score_t EmptySpace;
-
-    extern basic_score_t KnightPhase;
-    extern basic_score_t BishopPhase;
-    extern basic_score_t RookPhase;
-    extern basic_score_t QueenPhase;
-
-    extern score_t ImbalanceInternal[6][6];
-    extern score_t ImbalanceExternal[6][6];
+    // the tunable weights. The engine evaluates with them as packed integer scores, the tuner adjusts a copy
+    // held in doubles, both starting from the values below
+    template<typename S>
+    struct eval_params_t {
+        typedef typename S::basic_t basic_t;
+        basic_t totalPhase() const { return QueenPhase * 2 + RookPhase * 4 + BishopPhase * 4 + KnightPhase * 4; }
+
+        S MaterialValues[7] = { {0, 0}, {100, 154}, {376, 412}, {404, 460}, {506, 821}, {1006, 1590}, {0, 0}, };
+
+        S ImbalanceInternal[6][6] = {
+            { {35, 68}, },
+            { {0, -1}, {0, 0}, },
+            { {-5, -7}, {0, 9}, {0, -6}, },
+            { {-2, 30}, {0, 4}, {6, 7}, {4, -11}, },
+            { {1, -14}, {-1, 5}, {0, 14}, {4, 25}, {-4, -2}, },
+            { {-7, -26}, {0, -4}, {-15, -5}, {-23, 24}, {-56, 37}, {50, -399}, },
+        };
+
+        S ImbalanceExternal[6][6] = {
+            { },
+            { {0, 1}, },
+            { {-1, 4}, {0, 5}, },
+            { {3, 14}, {0, 6}, {-1, -9}, },
+            { {-4, -10}, {-1, 7}, {-4, -11}, {-1, -7}, },
+            { {2, -25}, {2, 40}, {9, 81}, {3, 127}, {-102, 194}, },
+        };
+
+        S KnightMob[9] = { {-82, -78}, {-23, -75}, {-5, -10}, {6, 7}, {13, 14}, {15, 29}, {22, 32}, {28, 34}, {31, 29}, };
+        S BishopMob[14] = { {-61, -86}, {-20, -47}, {-12, 3}, {0, 24}, {13, 29}, {21, 39}, {25, 47}, {30, 51}, {31, 56}, {32, 59}, {33, 60}, {42, 53}, {47, 61}, {65, 46}, };
+        S RookMob[15] = { {-99, -149}, {-47, -88}, {-13, -17}, {-2, 5}, {5, 20}, {6, 33}, {6, 42}, {9, 42}, {13, 46}, {17, 52}, {16, 60}, {16, 65}, {14, 71}, {17, 72}, {18, 71}, };
+        S QueenMob[28] = { {-2271, -735}, {-736, 771}, {24, -527}, {8, -169}, {4, 49}, {25, 96}, {36, 24}, {39, 63}, {41, 86}, {45, 91}, {50, 93}, {54, 94}, {56, 105}, {59, 103}, {59, 113}, {60, 121}, {57, 133}, {60, 135}, {57, 135}, {53, 148}, {58, 140}, {65, 138}, {66, 126}, {58, 134}, {69, 125}, {118, 50}, {77, 49}, {389, -148}, };
+
+        S PasserDistOwn[8] = { {0, 0}, {-1, 3}, {2, -5}, {6, -13}, {0, -22}, {-8, -31}, {-13, -27}, {0, 0}, };
+        S PasserDistEnemy[8] = { {0, 0}, {-3, 3}, {-4, 6}, {-5, 16}, {-1, 33}, {1, 49}, {14, 42}, {0, 0}, };
+        S PasserBonus[8] = { {0, 0}, {-9, -5}, {-13, 11}, {-6, 2}, {23, 12}, {85, 28}, {121, 92}, {0, 0}, };
+        S PasserNotBlocked[8] = { {0, 0}, {6, 7}, {2, 1}, {4, 18}, {8, 29}, {19, 67}, {77, 114}, {0, 0}, };
+        S PasserSafePush[8] = { {0, 0}, {10, -5}, {12, -2}, {0, 10}, {-2, 18}, {22, 36}, {77, 23}, {0, 0}, };
+        S PasserSafeProm[8] = { {0, 0}, {-42, 25}, {-48, 14}, {-56, 36}, {-75, 67}, {-38, 129}, {-5, 213}, {0, 0}, };
+
+        S PawnConnected = { 8, 9 };
+        S PawnDoubled = { -9, -18 };
+        S PawnIsolated = { -3, -9 };
+        S PawnBackward = { 2, -11 };
+        S PawnIsolatedOpen = { -21, -21 };
+        S PawnBackwardOpen = { -20, -20 };
+
+        S RookOn7th = { -2, 48 };
+        S RookOnSemiOpenFile = { 14, 10 };
+        S RookOnOpenFile = { 41, 11 };
+        S KnightOutpost = { 32, 27 };
+        S KnightXOutpost = { 17, 14 };
+        S BishopOutpost = { 39, 1 };
+        S BishopPawns = { -6, -10 };
+        S BishopCenterControl = { 16, 1 };
+        S PieceSpace = { 3, 3 };
+        S EmptySpace = { 5, 0 };
+
+        S PawnPush = { 16, 13 };
+        S WeakPawns = { 7, 53 };
+        S PawnsxMinors = { 68, 30 };
+        S MinorsxMinors = { 29, 40 };
+        S MajorsxWeakMinors = { 31, 81 };
+        S PawnsMinorsxMajors = { 39, 29 };
+        S AllxQueens = { 29, 21 };
+        S KingxMinors = { 22, 67 };
+        S KingxRooks = { -28, 54 };
+
+        basic_t KnightAtk = 64;
+        basic_t BishopAtk = 34;
+        basic_t RookAtk = 29;
+        basic_t QueenAtk = 78;
+        basic_t KingZoneAttacks = 36;
+        basic_t WeakSquares = 32;
+        basic_t EnemyPawns = -15;
+        basic_t QueenSafeCheckValue = 75;
+        basic_t RookSafeCheckValue = 108;
+        basic_t BishopSafeCheckValue = 54;
+        basic_t KnightSafeCheckValue = 126;
+        basic_t KingShelter1 = -35;
+        basic_t KingShelter2 = -4;
+        basic_t KingShelterF1 = -57;
+        basic_t KingShelterF2 = -39;
+        basic_t KingStorm1 = 122;
+        basic_t KingStorm2 = 66;
+
+        basic_t KnightPhase = 2;
+        basic_t BishopPhase = 5;
+        basic_t RookPhase = 9;
+        basic_t QueenPhase = 24;
+        basic_t Tempo = 38;
+    };
+
+    extern eval_params_t<score_t> Params;
+    extern eval_params_t<tune_score_t> TuneParams;
+
+    template<typename S> constexpr const eval_params_t<S>& params();
+    template<> constexpr const eval_params_t<score_t>& params<score_t>() { return Params; }
+    template<> constexpr const eval_params_t<tune_score_t>& params<tune_score_t>() { return TuneParams; }
+
+    extern const int LazyMargin;
 
     extern score_t PcSqTab[2][8][64];
     extern uint64_t KingZoneBB[2][64];
@@ -86,11 +119,9 @@ namespace EvalParam {
     extern uint64_t KingShelter3BB[2][3];
 
     extern const int KingSquare[2][3];
-    extern const int MatMul[8];
 
     extern void initArr();
-    extern void initMaterial();
-    extern material_t& getMaterial(int idx1, int idx2);
     extern void displayPST();
-    extern score_t imbalance(const int pieceCount[2][6], int side);
-}
\ No newline at end of file
+    template<typename S>
+    S imbalance(const eval_params_t<S>& P, const int pieceCount[2][6], int side, eval_trace_t* trace = nullptr);
+}
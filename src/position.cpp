@@ -5,6 +5,7 @@
 /**************************************************/
 
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <sstream>
 
@@ -14,6 +15,7 @@
 #include "attacks.h"
 #include "eval.h"
 #include "params.h"
+#include "nnue.h"
 
 namespace PositionData {
     const uint64_t  CastleSquareMask1[2][2] = { { F1BB | G1BB, B1BB | C1BB | D1BB }, { F8BB | G8BB, B8BB | C8BB | D8BB } };
@@ -23,76 +25,127 @@ namespace PositionData {
     const int RookFrom[2][2] = { { A1, H1 },{ A8, H8 } };
     const int RookTo[2][2] = { { D1, F1 },{ D8, F8 } };
 
-    uint64_t DirBitmap[64][8];
-    uint64_t InBetween[64][64];
-    int DirFromTo[64][64];
-    int CastleMask[64];
-
-    uint64_t ZobPiece[2][8][64];
-    uint64_t ZobCastle[16];
-    uint64_t ZobEpsq[8];
-    uint64_t ZobColor;
-
-    static uint64_t xorshift128plus(void) {
-        static uint64_t s[2] = { 4123659995ull, 9981545732273789042ull };
-        uint64_t x = s[0];
-        uint64_t const y = s[1];
-        s[0] = y;
-        x ^= x << 23;
-        s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
-        return s[1] + y;
-    }
-
-    void initArr(void) {
-        const int kingd[8] = { -9, -1, 7, 8, 9, 1, -7, -8 };
-
-        memset(ZobPiece, 0, sizeof(ZobPiece));
-        memset(ZobCastle, 0, sizeof(ZobCastle));
-        memset(ZobEpsq, 0, sizeof(ZobEpsq));
-
+    constexpr std::array<std::array<uint64_t, 8>, 64> DirBitmap = [] {
+        std::array<std::array<uint64_t, 8>, 64> t{};
+        for (int sq = 0; sq < 64; ++sq)
+            for (int k = 0; k < 8; ++k) t[sq][k] = Attacks::rayBB(sq, Attacks::KingDirs[k]);
+        return t;
+    }();
+    constexpr std::array<std::array<int, 64>, 64> DirFromTo = [] {
+        std::array<std::array<int, 64>, 64> t{};
+        for (int sq = 0; sq < 64; ++sq) {
+            for (int sq2 = 0; sq2 < 64; ++sq2) {
+                t[sq][sq2] = 8;
+                for (int k = 0; k < 8; ++k)
+                    if (DirBitmap[sq][k] & BitMask[sq2]) t[sq][sq2] = k;
+            }
+        }
+        return t;
+    }();
+    constexpr std::array<std::array<uint64_t, 64>, 64> InBetween = [] {
+        std::array<std::array<uint64_t, 64>, 64> t{};
+        for (int sq = 0; sq < 64; ++sq) {
+            for (int sq2 = 0; sq2 < 64; ++sq2) {
+                int k = DirFromTo[sq][sq2];
+                if (k != 8) t[sq][sq2] = DirBitmap[sq][k] & DirBitmap[sq2][DirFromTo[sq2][sq]];
+            }
+        }
+        return t;
+    }();
+    constexpr std::array<int, 64> CastleMask = [] {
+        std::array<int, 64> t{};
+        for (int sq = 0; sq < 64; sq++) t[sq] = 0xF;
+        t[E1] &= ~(WCKS | WCQS);
+        t[H1] &= ~WCKS;
+        t[A1] &= ~WCQS;
+        t[E8] &= ~(BCKS | BCQS);
+        t[H8] &= ~BCKS;
+        t[A8] &= ~BCQS;
+        return t;
+    }();
+
+    struct zobrist_t {
+        uint64_t piece[2][8][64];
+        uint64_t castle[16];
+        uint64_t epsq[8];
+        uint64_t color;
+    };
+    constexpr zobrist_t Zobrist = [] {
+        zobrist_t z{};
+        uint64_t s[2] = { 4123659995ull, 9981545732273789042ull };
+        auto xorshift128plus = [&s] {
+            uint64_t x = s[0];
+            uint64_t const y = s[1];
+            s[0] = y;
+            x ^= x << 23;
+            s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+            return s[1] + y;
+        };
         for (int side = 0; side < 2; ++side) {
             for (int pc = 1; pc <= 6; ++pc) {
                 for (int sq = 0; sq < 64; ++sq) {
-                    ZobPiece[side][pc][sq] = xorshift128plus();
+                    z.piece[side][pc][sq] = xorshift128plus();
                 }
             }
         }
-        for (int sq = 1; sq < 16; ++sq) ZobCastle[sq] = xorshift128plus();
-        for (int sq = 0; sq < 8; ++sq) ZobEpsq[sq] = xorshift128plus();
-        ZobColor = xorshift128plus();
-
-        for (int sq = 0; sq < 64; sq++) CastleMask[sq] = 0xF;
-
-        CastleMask[E1] &= ~WCKS;
-        CastleMask[H1] &= ~WCKS;
-        CastleMask[E1] &= ~WCQS;
-        CastleMask[A1] &= ~WCQS;
-        CastleMask[E8] &= ~BCKS;
-        CastleMask[H8] &= ~BCKS;
-        CastleMask[E8] &= ~BCQS;
-        CastleMask[A8] &= ~BCQS;
-
-        for (int sq = 0; sq < 64; ++sq) {
-            for (int sq2 = 0; sq2 < 64; ++sq2) DirFromTo[sq][sq2] = 8;
-            for (int k = 0; k < 8; ++k) {
-                DirBitmap[sq][k] = 0;
-                for (int p = sq, n = sq + kingd[k]; n >= 0 && n < 64 && abs((n & 7) - (p & 7)) < 2; p = n, n += kingd[k]) {
-                    DirFromTo[sq][n] = k;
-                    DirBitmap[sq][k] |= BitMask[n];
+        for (int sq = 1; sq < 16; ++sq) z.castle[sq] = xorshift128plus();
+        for (int sq = 0; sq < 8; ++sq) z.epsq[sq] = xorshift128plus();
+        z.color = xorshift128plus();
+        return z;
+    }();
+    constexpr auto& ZobPiece = Zobrist.piece;
+    constexpr auto& ZobCastle = Zobrist.castle;
+    constexpr auto& ZobEpsq = Zobrist.epsq;
+    constexpr uint64_t ZobColor = Zobrist.color;
+
+    // cuckoo hash of the zobrist keys of all reversible piece moves
+    constexpr int cuckooH1(uint64_t key) { return key & 0x1fff; }
+    constexpr int cuckooH2(uint64_t key) { return (key >> 16) & 0x1fff; }
+    struct cuckoo_t {
+        uint64_t keys[8192];
+        uint16_t moves[8192];
+        int count;
+    };
+    constexpr cuckoo_t CuckooTable = [] {
+        cuckoo_t t{};
+        auto attacks = [](int pc, int s1) {
+            uint64_t atks = 0;
+            if (pc == KNIGHT || pc == KING) {
+                const int knightd[8] = { -17, -15, -10, -6, 6, 10, 15, 17 };
+                for (int k = 0; k < 8; ++k) {
+                    const int s2 = s1 + (pc == KNIGHT ? knightd[k] : Attacks::KingDirs[k]);
+                    if (Attacks::isStep(s1, s2, pc == KNIGHT ? 2 : 1)) atks |= BitMask[s2];
                 }
             }
-        }
-        for (int sq = 0; sq < 64; ++sq) {
-            for (int sq2 = 0; sq2 < 64; ++sq2) {
-                InBetween[sq][sq2] = uint64_t(0);
-                int k = DirFromTo[sq][sq2];
-                if (k != 8) {
-                    int k2 = DirFromTo[sq2][sq];
-                    InBetween[sq][sq2] = DirBitmap[sq][k] & DirBitmap[sq2][k2];
+            if (pc == BISHOP || pc == QUEEN) atks |= Attacks::slideAttacksBB(s1, 0, 0);
+            if (pc == ROOK || pc == QUEEN) atks |= Attacks::slideAttacksBB(s1, 0, 1);
+            return atks;
+        };
+        for (int c = 0; c < 2; ++c) {
+            for (int pc = KNIGHT; pc <= KING; ++pc) {
+                for (int s1 = 0; s1 < 64; ++s1) {
+                    const uint64_t atks = attacks(pc, s1);
+                    for (int s2 = s1 + 1; s2 < 64; ++s2) {
+                        if (!(atks & BitMask[s2])) continue;
+                        uint16_t move = uint16_t(s1 | (s2 << 6) | (MF_NORMAL << 12));
+                        uint64_t key = Zobrist.piece[c][pc][s1] ^ Zobrist.piece[c][pc][s2] ^ Zobrist.color;
+                        int i = cuckooH1(key);
+                        while (true) {
+                            const uint64_t k = t.keys[i]; t.keys[i] = key; key = k;
+                            const uint16_t m = t.moves[i]; t.moves[i] = move; move = m;
+                            if (move == 0) break;
+                            i = (i == cuckooH1(key)) ? cuckooH2(key) : cuckooH1(key);
+                        }
+                        ++t.count;
+                    }
                 }
             }
         }
-    }
+        return t;
+    }();
+    static_assert(CuckooTable.count == 3668);
+    constexpr auto& Cuckoo = CuckooTable.keys;
+    constexpr auto& CuckooMove = CuckooTable.moves;
 }
 
 using namespace Attacks;
@@ -106,9 +159,9 @@ void position_t::initPosition() {
     for (auto& pc : pieces) pc = EMPTY;
     occupiedBB = EmptyBoardBB;
     kpos[0] = kpos[1] = A1;
-    mat_idx[0] = mat_idx[1] = 0;
     side = WHITE;
-    history.size = 0;
+    acc = nullptr;
+    history.clear();
     stack.init();
 }
 
@@ -116,11 +169,13 @@ void position_t::undoNullMove(undo_t& undo, int& ply) {
     side ^= 1;
     stack = undo;
     --ply;
+    if (acc) --acc;
 }
 
 void position_t::doNullMove(undo_t& undo, int& ply) {
     undo = stack;
     ++ply;
+    if (acc) ++acc, acc->reset();
 
     stack.lastmove.m = 0;
     stack.epsq = -1;
@@ -134,6 +189,7 @@ void position_t::doNullMove(undo_t& undo, int& ply) {
 
     stack.hash ^= ZobColor;
     side ^= 1;
+    setCheckInfo();
 }
 
 void position_t::undoMove(undo_t& undo, int& ply) {
@@ -146,6 +202,7 @@ void position_t::undoMove(undo_t& undo, int& ply) {
 
     side = xside ^ 1;
     --ply;
+    if (acc) --acc;
 
     removePiece(false, to, side, pc);
     setPiece(false, from, side, pc);
@@ -165,9 +222,14 @@ void position_t::undoMove(undo_t& undo, int& ply) {
         break;
     }
     stack = undo;
-    --history.size;
+    history.pop_back();
 }
 
+void position_t::doMove(undo_t& undo, move_t m, int& ply) {
+    withCpuPath([&](auto path) { doMove<decltype(path)::value>(undo, m, ply); });
+}
+
+template<int path>
 void position_t::doMove(undo_t& undo, move_t m, int& ply) {
     const int from = m.from();
     const int to = m.to();
@@ -179,6 +241,7 @@ void position_t::doMove(undo_t& undo, move_t m, int& ply) {
 
     undo = stack;
     ++ply;
+    if (acc) ++acc, acc->reset();
 
     if (undo.epsq != -1) stack.hash ^= ZobEpsq[sqFile(undo.epsq)];
     stack.hash ^= ZobCastle[undo.castle];
@@ -195,8 +258,12 @@ void position_t::doMove(undo_t& undo, move_t m, int& ply) {
     stack.hash ^= ZobColor;
 
     removePiece(true, from, side, pc);
-    if (cap != EMPTY) removePiece(true, to, xside, cap);
-    setPiece(true, to, side, pc);
+    if (cap != EMPTY) {
+        removePiece(true, to, xside, cap);
+        stack.mhash ^= ZobPiece[xside][cap][bitCnt<path>(getPieceBB(cap, xside))];
+    }
+    // a promoting pawn lands as the new piece, so the accumulator sees at most two pieces change
+    setPiece(true, to, side, m.isPromotion() ? m.promoted() : pc);
     if (cap != EMPTY || pc == PAWN) stack.fifty = 0;
 
     switch (m.flags()) {
@@ -212,17 +279,39 @@ void position_t::doMove(undo_t& undo, move_t m, int& ply) {
         break;
     case MF_ENPASSANT:
         removePiece(true, (sqRank(from) << 3) + sqFile(to), xside, PAWN);
+        stack.mhash ^= ZobPiece[xside][PAWN][bitCnt<path>(getPieceBB(PAWN, xside))];
         break;
     case MF_PROMQ: case MF_PROMR: case MF_PROMB: case MF_PROMN:
-        removePiece(true, to, side, PAWN);
-        setPiece(true, to, side, m.promoted());
+        stack.mhash ^= ZobPiece[side][PAWN][bitCnt<path>(getPieceBB(PAWN, side))];
+        stack.mhash ^= ZobPiece[side][m.promoted()][bitCnt<path>(getPieceBB(m.promoted(), side)) - 1];
         break;
     }
     side = xside;
-    history.add(stack.hash);
+    history.push_back(stack.hash);
+    setCheckInfo<path>();
 
     ASSERT(hashIsValid());
     ASSERT(phashIsValid());
+    ASSERT(mhashIsValid());
+}
+
+void position_t::setCheckInfo() {
+    withCpuPath([&](auto path) { setCheckInfo<decltype(path)::value>(); });
+}
+
+// computed once per node, so legality and check detection are table lookups
+template<int path>
+void position_t::setCheckInfo() {
+    const int xside = side ^ 1;
+    const int eksq = kpos[xside];
+    stack.pinned = pinnedPiecesBB<path>(side);
+    stack.dcc = discoveredPiecesBB<path>(side);
+    stack.checksqs[PAWN] = pawnAttacksBB(eksq, xside);
+    stack.checksqs[KNIGHT] = knightMovesBB(eksq);
+    stack.checksqs[BISHOP] = bishopAttacksBB<path>(eksq, occupiedBB);
+    stack.checksqs[ROOK] = rookAttacksBB<path>(eksq, occupiedBB);
+    stack.checksqs[QUEEN] = stack.checksqs[BISHOP] | stack.checksqs[ROOK];
+    stack.checksqs[KING] = 0;
 }
 
 void position_t::setPiece(bool update, int sq, int c, int pc) {
@@ -231,8 +320,8 @@ void position_t::setPiece(bool update, int sq, int c, int pc) {
     colorBB[c] |= BitMask[sq];
     occupiedBB |= BitMask[sq];
     if (pc == KING) kpos[c] = sq;
-    mat_idx[c] += MatMul[pc];
     if (update) {
+        if (acc) acc->add(c, pc, sq, 1);
         stack.score[c] += PcSqTab[c][pc][sq];
         stack.hash ^= ZobPiece[c][pc][sq];
         if (pc == PAWN) stack.phash ^= ZobPiece[c][pc][sq];
@@ -244,8 +333,8 @@ void position_t::removePiece(bool update, int sq, int c, int pc) {
     piecesBB[pc] ^= BitMask[sq];
     colorBB[c] ^= BitMask[sq];
     occupiedBB ^= BitMask[sq];
-    mat_idx[c] -= MatMul[pc];
     if (update) {
+        if (acc) acc->add(c, pc, sq, -1);
         stack.score[c] -= PcSqTab[c][pc][sq];
         stack.hash ^= ZobPiece[c][pc][sq];
         if (pc == PAWN) stack.phash ^= ZobPiece[c][pc][sq];
@@ -279,9 +368,16 @@ void position_t::setPosition(const std::string& fenStr) {
     if (((ss >> col) && (col >= 'a' && col <= 'h')) && ((ss >> row) && (row == '3' || row == '6')))
         stack.epsq = (8 * (row - '1')) + (col - 'a');
     ss >> std::skipws >> stack.fifty;
+    completePosition();
+}
+
+// the hash terms and check info that follow from pieces, side, castling and en passant once they are set
+void position_t::completePosition() {
     if (stack.epsq != -1) stack.hash ^= ZobEpsq[sqFile(stack.epsq)];
     if (side == WHITE) stack.hash ^= ZobColor;
     stack.hash ^= ZobCastle[stack.castle];
+    stack.mhash = mhashFromScratch();
+    setCheckInfo();
 
     ASSERT(hashIsValid());
     ASSERT(phashIsValid());
@@ -316,7 +412,7 @@ std::string position_t::positionToFEN() {
         fen += sqFile(stack.epsq) + 'a';
         fen += '1' + sqRank(stack.epsq);
     }
-    fen += " " + std::to_string(stack.fifty) + " " + std::to_string(history.size + 1);
+    fen += " " + std::to_string(stack.fifty) + " " + std::to_string(history.size() + 1);
     return fen;
 }
 
@@ -344,25 +440,46 @@ std::string position_t::to_str() {
 }
 
 bool position_t::isRepeat() {
-    int idx_limit = std::max(history.size - stack.fifty, history.size - stack.pliesfromnull);
+    const int size = int(history.size());
+    int idx_limit = std::max(size - stack.fifty, size - stack.pliesfromnull);
     idx_limit = std::max(idx_limit, 0);
-    for (int idx = history.size - 5; idx >= idx_limit; idx -= 2) {
+    for (int idx = size - 5; idx >= idx_limit; idx -= 2) {
         if (history[idx] == stack.hash)
             return true;
     }
     return false;
 }
 
-bool position_t::isMatIdxValid() {
-#ifdef TUNE
-    return false;
-#else
-    return mat_idx[0] < 486 && mat_idx[1] < 486;
-#endif
+// returns how many plies back lies the nearest earlier position the side to move
+// can reach again with a single reversible move, or 0 if there is none
+int position_t::gameCycle() {
+    const int end = std::min(int(stack.fifty), stack.pliesfromnull - 1);
+    if (end < 3) return 0;
+
+    const int last = int(history.size()) - 1;
+    uint64_t other = stack.hash ^ history[last - 1] ^ ZobColor;
+    for (int i = 3; i <= end; i += 2) {
+        other ^= history[last - i + 1] ^ history[last - i] ^ ZobColor;
+        if (other) continue;
+
+        const uint64_t movekey = stack.hash ^ history[last - i];
+        int j = cuckooH1(movekey);
+        if (Cuckoo[j] != movekey && Cuckoo[j = cuckooH2(movekey)] != movekey) continue;
+
+        const move_t m(CuckooMove[j]);
+        if (InBetween[m.from()][m.to()] & occupiedBB) continue;
+        if (colorBB[side] & (BitMask[m.from()] | BitMask[m.to()])) return i;
+    }
+    return 0;
 }
 
 bool position_t::isMatDrawn() {
-    if (isMatIdxValid() && getMaterial(mat_idx[0], mat_idx[1]).flags & 1) return true;
+    if (piecesBB[PAWN] | piecesBB[ROOK] | piecesBB[QUEEN]) return false;
+    const uint64_t minors = piecesBB[KNIGHT] | piecesBB[BISHOP];
+    const int wminors = bitCnt(minors & colorBB[WHITE]);
+    const int bminors = bitCnt(minors & colorBB[BLACK]);
+    if (wminors < 2 && bminors < 2) return true; // minor vs minor
+    if (wminors + bminors == 2 && bitCnt(piecesBB[KNIGHT]) == 2) return true; // 2 knights
     return false;
 }
 
@@ -386,77 +503,93 @@ uint64_t position_t::rookSlidersBB(int c) {
     return (piecesBB[QUEEN] | piecesBB[ROOK]) & colorBB[c];
 }
 
+template<int path>
 uint64_t position_t::allAttackersToSqBB(int sq, uint64_t occupied) {
     return
         (colorBB[WHITE] & pawnAttacksBB(sq, BLACK) & piecesBB[PAWN]) |
         (colorBB[BLACK] & pawnAttacksBB(sq, WHITE) & piecesBB[PAWN]) |
         (knightMovesBB(sq) & piecesBB[KNIGHT]) |
         (kingMovesBB(sq) & piecesBB[KING]) |
-        (bishopAttacksBB(sq, occupied) & (piecesBB[BISHOP] | piecesBB[QUEEN])) |
-        (rookAttacksBB(sq, occupied) & (piecesBB[ROOK] | piecesBB[QUEEN]));
+        (bishopAttacksBB<path>(sq, occupied) & (piecesBB[BISHOP] | piecesBB[QUEEN])) |
+        (rookAttacksBB<path>(sq, occupied) & (piecesBB[ROOK] | piecesBB[QUEEN]));
 }
 
-uint64_t position_t::safeSqsBB(int c, uint64_t occ, uint64_t target) {
-    uint64_t bits = target;
-    while (target) {
-        int sq = popFirstBit(target);
-        if (sqIsAttacked(occ, sq, c))
-            bits ^= BitMask[sq];
-    }
-    return bits;
+template<int path>
+uint64_t position_t::attackedSqsBB(int c, uint64_t occ) {
+    uint64_t atks = pawnAttackBB(getPieceBB(PAWN, c), c) | kingMovesBB(kpos[c]);
+    for (uint64_t bits = getPieceBB(KNIGHT, c); bits;) atks |= knightMovesBB(popFirstBit(bits));
+    for (uint64_t bits = bishopSlidersBB(c); bits;) atks |= bishopAttacksBB<path>(popFirstBit(bits), occ);
+    for (uint64_t bits = rookSlidersBB(c); bits;) atks |= rookAttacksBB<path>(popFirstBit(bits), occ);
+    return atks;
 }
 
+template<int path>
 uint64_t position_t::pieceAttacksFromBB(int pc, int sq, uint64_t occ) {
     switch (pc) {
     case PAWN: return pawnAttacksBB(sq, side);
     case KNIGHT: return knightMovesBB(sq);
-    case BISHOP: return bishopAttacksBB(sq, occ);
-    case ROOK: return rookAttacksBB(sq, occ);
-    case QUEEN: return queenAttacksBB(sq, occ);
+    case BISHOP: return bishopAttacksBB<path>(sq, occ);
+    case ROOK: return rookAttacksBB<path>(sq, occ);
+    case QUEEN: return queenAttacksBB<path>(sq, occ);
     case KING: return kingMovesBB(sq);
     }
     return 0;
 }
 
+template<int path>
 uint64_t position_t::getAttacksBB(int sq, int c) {
     return colorBB[c] & ((pawnAttacksBB(sq, c ^ 1) & piecesBB[PAWN]) |
         (knightMovesBB(sq) & piecesBB[KNIGHT]) |
         (kingMovesBB(sq) & piecesBB[KING]) |
-        (bishopAttacksBB(sq, occupiedBB) & (piecesBB[BISHOP] | piecesBB[QUEEN])) |
-        (rookAttacksBB(sq, occupiedBB) & (piecesBB[ROOK] | piecesBB[QUEEN])));
+        (bishopAttacksBB<path>(sq, occupiedBB) & (piecesBB[BISHOP] | piecesBB[QUEEN])) |
+        (rookAttacksBB<path>(sq, occupiedBB) & (piecesBB[ROOK] | piecesBB[QUEEN])));
 }
 
+template<int path>
 uint64_t position_t::pinnedPiecesBB(int c) {
     uint64_t pinned = 0;
     const int ksq = kpos[c];
 
     uint64_t pinners = rookSlidersBB(c ^ 1);
-    pinners &= pinners ? rookAttacksBBX(ksq, occupiedBB) : 0;
+    pinners &= pinners ? rookAttacksBBX<path>(ksq, occupiedBB) : 0;
     while (pinners) pinned |= InBetween[popFirstBit(pinners)][ksq] & colorBB[c];
 
     pinners = bishopSlidersBB(c ^ 1);
-    pinners &= pinners ? bishopAttacksBBX(ksq, occupiedBB) : 0;
+    pinners &= pinners ? bishopAttacksBBX<path>(ksq, occupiedBB) : 0;
     while (pinners) pinned |= InBetween[popFirstBit(pinners)][ksq] & colorBB[c];
 
     return pinned;
 }
 
+template<int path>
 uint64_t position_t::discoveredPiecesBB(int c) {
     uint64_t pinned = 0;
     const int ksq = kpos[c ^ 1];
 
     uint64_t pinners = rookSlidersBB(c);
-    pinners &= pinners ? rookAttacksBBX(ksq, occupiedBB) : 0;
+    pinners &= pinners ? rookAttacksBBX<path>(ksq, occupiedBB) : 0;
     while (pinners) pinned |= InBetween[popFirstBit(pinners)][ksq] & colorBB[c] & ~rookSlidersBB(c);
 
     pinners = bishopSlidersBB(c);
-    pinners &= pinners ? bishopAttacksBBX(ksq, occupiedBB) : 0;
+    pinners &= pinners ? bishopAttacksBBX<path>(ksq, occupiedBB) : 0;
     while (pinners) pinned |= InBetween[popFirstBit(pinners)][ksq] & colorBB[c] & ~bishopSlidersBB(c);
 
     return pinned;
 }
 
 bool position_t::staticExchangeEval(move_t m, int threshold) {
+    uint64_t attackersto[64], known = 0;
+    return staticExchangeEval(m, threshold, attackersto, known);
+}
+
+bool position_t::staticExchangeEval(move_t m, int threshold, uint64_t attackersto[64], uint64_t& known) {
+    return withCpuPath([&](auto path) { return staticExchangeEval<decltype(path)::value>(m, threshold, attackersto, known); });
+}
+
+// attackersto[sq] caches allAttackersToSqBB(sq, occupiedBB) for each square set in known,
+// so several exchanges on the same square at a node share the slider lookups
+template<int path>
+bool position_t::staticExchangeEval(move_t m, int threshold, uint64_t attackersto[64], uint64_t& known) {
     static const int PieceVals[] = { 0, 100,  450,  450,  675, 1300, 0 };
 
     if (m.isCastle()) return true;
@@ -474,11 +607,22 @@ bool position_t::staticExchangeEval(move_t m, int threshold) {
     val -= PieceVals[pc];
     if (val >= 0) return true;
 
+    if (!(known & BitMask[to])) {
+        attackersto[to] = allAttackersToSqBB<path>(to, occupiedBB);
+        known |= BitMask[to];
+    }
+
     const uint64_t bishops = piecesBB[BISHOP] | piecesBB[QUEEN];
     const uint64_t rooks = piecesBB[ROOK] | piecesBB[QUEEN];
     uint64_t occupied = (occupiedBB ^ BitMask[from]) | BitMask[to];
-    if (enpassant) occupied ^= BitMask[stack.epsq];
-    uint64_t all = allAttackersToSqBB(to, occupied);
+    uint64_t all = attackersto[to];
+    const int dir = DirFromTo[to][from];
+    if (enpassant) {
+        // the captured pawn is beside the moving one, behind the destination
+        occupied ^= BitMask[(sqRank(from) << 3) + sqFile(to)];
+        all |= rookAttacksBB<path>(to, occupied) & rooks;
+    }
+    if (dir != 8) all |= (dir & 1) ? rookAttacksBB<path>(to, occupied) & rooks : bishopAttacksBB<path>(to, occupied) & bishops;
     int color = side ^ 1;
     for (uint64_t mask, attackers; attackers = (all &= occupied) & colorBB[color];) {
         for (pc = PAWN; !(mask = attackers & piecesBB[pc]); ++pc);
@@ -489,9 +633,9 @@ bool position_t::staticExchangeEval(move_t m, int threshold) {
         }
         occupied ^= BitMask[getFirstBit(mask)];
         if (pc == PAWN || pc == BISHOP || pc == QUEEN)
-            all |= bishopAttacksBB(to, occupied) & bishops;
+            all |= bishopAttacksBB<path>(to, occupied) & bishops;
         if (pc == ROOK || pc == QUEEN)
-            all |= rookAttacksBB(to, occupied) & rooks;
+            all |= rookAttacksBB<path>(to, occupied) & rooks;
     }
     return side != color;
 }
@@ -504,26 +648,38 @@ bool position_t::canCastleQS(int s) {
 }
 
 bool position_t::kingIsInCheck() {
-    return sqIsAttacked(occupiedBB, kpos[side], side ^ 1);
+    return withCpuPath([&](auto path) { return kingIsInCheck<decltype(path)::value>(); });
 }
 
+template<int path>
+bool position_t::kingIsInCheck() {
+    return sqIsAttacked<path>(occupiedBB, kpos[side], side ^ 1);
+}
+
+template<int path>
 bool position_t::areaIsAttacked(int c, uint64_t target) {
     while (target)
-        if (sqIsAttacked(occupiedBB, popFirstBit(target), c))
+        if (sqIsAttacked<path>(occupiedBB, popFirstBit(target), c))
             return true;
     return false;
 }
 
+template<int path>
 bool position_t::sqIsAttacked(uint64_t occ, int sq, int c) {
     return
-        (rookAttacksBB(sq, occ) & rookSlidersBB(c)) ||
-        (bishopAttacksBB(sq, occ) & bishopSlidersBB(c)) ||
+        (rookAttacksBB<path>(sq, occ) & rookSlidersBB(c)) ||
+        (bishopAttacksBB<path>(sq, occ) & bishopSlidersBB(c)) ||
         (knightMovesBB(sq) & piecesBB[KNIGHT] & colorBB[c]) ||
         ((pawnAttacksBB(sq, c ^ 1) & piecesBB[PAWN] & colorBB[c])) ||
         (kingMovesBB(sq) & piecesBB[KING] & colorBB[c]);
 }
 
-bool position_t::moveIsLegal(move_t move, uint64_t pinned, bool incheck) {
+bool position_t::moveIsLegal(move_t move, bool incheck) {
+    return withCpuPath([&](auto path) { return moveIsLegal<decltype(path)::value>(move, incheck); });
+}
+
+template<int path>
+bool position_t::moveIsLegal(move_t move, bool incheck) {
     if (incheck) return true;
 
     const int xside = side ^ 1;
@@ -533,18 +689,23 @@ bool position_t::moveIsLegal(move_t move, uint64_t pinned, bool incheck) {
 
     if (move.isEnPassant()) {
         uint64_t b = occupiedBB ^ BitMask[from] ^ BitMask[(sqRank(from) << 3) + sqFile(to)] ^ BitMask[to];
-        return !(rookAttacksBB(ksq, b) & rookSlidersBB(xside)) && !(bishopAttacksBB(ksq, b) & bishopSlidersBB(xside));
+        return !(rookAttacksBB<path>(ksq, b) & rookSlidersBB(xside)) && !(bishopAttacksBB<path>(ksq, b) & bishopSlidersBB(xside));
     }
     if (move.isCastle()) {
-        return !areaIsAttacked(xside, CastleSquareMask2[side][to > from ? 0 : 1]);
+        return !areaIsAttacked<path>(xside, CastleSquareMask2[side][to > from ? 0 : 1]);
     }
-    if (from == ksq) return !(sqIsAttacked(occupiedBB ^ BitMask[ksq], to, xside));
-    if (!(pinned & BitMask[from])) return true;
+    if (from == ksq) return !(sqIsAttacked<path>(occupiedBB ^ BitMask[ksq], to, xside));
+    if (!(stack.pinned & BitMask[from])) return true;
     if (DirFromTo[from][ksq] == DirFromTo[to][ksq]) return true;
     return false;
 }
 
-bool position_t::moveIsCheck(move_t move, uint64_t dcc) {
+bool position_t::moveIsCheck(move_t move) {
+    return withCpuPath([&](auto path) { return moveIsCheck<decltype(path)::value>(move); });
+}
+
+template<int path>
+bool position_t::moveIsCheck(move_t move) {
     const int xside = side ^ 1;
     const int from = move.from();
     const int to = move.to();
@@ -552,17 +713,22 @@ bool position_t::moveIsCheck(move_t move, uint64_t dcc) {
     const int pc = pieces[from];
     const int prom = move.promoted();
 
-    if ((dcc & BitMask[from]) && DirFromTo[from][enemy_ksq] != DirFromTo[to][enemy_ksq]) return true;
-    if (pc != PAWN && pc != KING && pieceAttacksFromBB(pc, enemy_ksq, occupiedBB)  & BitMask[to]) return true;
-    if (pc == PAWN && pawnAttacksBB(enemy_ksq, xside) & BitMask[to]) return true;
+    if ((stack.dcc & BitMask[from]) && DirFromTo[from][enemy_ksq] != DirFromTo[to][enemy_ksq]) return true;
+    if (stack.checksqs[pc] & BitMask[to]) return true;
+    if (!move.isSpecial()) return false;
     uint64_t tempOccBB = occupiedBB ^ BitMask[from] ^ BitMask[to];
-    if (move.isPromotion() && pieceAttacksFromBB(prom, enemy_ksq, tempOccBB)  & BitMask[to]) return true;
-    if (move.isEnPassant() && sqIsAttacked(tempOccBB ^ BitMask[(sqRank(from) << 3) + sqFile(to)], enemy_ksq, side)) return true;
-    if (move.isCastle() && rookAttacksBB(enemy_ksq, tempOccBB) & BitMask[RookTo[to / 56][(to % 8) > 5]]) return true;
+    if (move.isPromotion() && pieceAttacksFromBB<path>(prom, enemy_ksq, tempOccBB)  & BitMask[to]) return true;
+    if (move.isEnPassant() && sqIsAttacked<path>(tempOccBB ^ BitMask[(sqRank(from) << 3) + sqFile(to)], enemy_ksq, side)) return true;
+    if (move.isCastle() && rookAttacksBB<path>(enemy_ksq, tempOccBB) & BitMask[RookTo[to / 56][(to % 8) > 5]]) return true;
     return false;
 }
 
-bool position_t::moveIsValid(move_t m, uint64_t pinned) {
+bool position_t::moveIsValid(move_t move) {
+    return withCpuPath([&](auto path) { return moveIsValid<decltype(path)::value>(move); });
+}
+
+template<int path>
+bool position_t::moveIsValid(move_t m) {
     const int from = m.from();
     const int to = m.to();
     const int pc = pieces[from];
@@ -576,8 +742,8 @@ bool position_t::moveIsValid(move_t m, uint64_t pinned) {
     if (prom != EMPTY && (prom < KNIGHT || prom > QUEEN)) return false;
     if (getSide(from) != side) return false;
     if (cap != EMPTY && getSide(to) == side) return false;
-    if ((pinned & BitMask[from]) && (DirFromTo[from][kpos[side]] != DirFromTo[to][kpos[side]])) return false;
-    if (pc != PAWN && (pc != KING || absdiff != 2) && !(pieceAttacksFromBB(pc, from, occupiedBB) & BitMask[to])) return false;
+    if ((stack.pinned & BitMask[from]) && (DirFromTo[from][kpos[side]] != DirFromTo[to][kpos[side]])) return false;
+    if (pc != PAWN && (pc != KING || absdiff != 2) && !(pieceAttacksFromBB<path>(pc, from, occupiedBB) & BitMask[to])) return false;
     if (pc == KING) {
         if (BitMask[to] & kingMovesBB(kpos[side ^ 1])) return false;
         if (absdiff == 2 && flag != MF_CASTLE) return false;
@@ -611,12 +777,12 @@ bool position_t::moveIsValid(move_t m, uint64_t pinned) {
         if (to > from) {
             if (!canCastleKS(side)) return false;
             if (occupiedBB & CastleSquareMask1[side][0]) return false;
-            if (areaIsAttacked(side ^ 1, CastleSquareMask2[side][0])) return false;
+            if (areaIsAttacked<path>(side ^ 1, CastleSquareMask2[side][0])) return false;
         }
         if (to < from) {
             if (!canCastleQS(side)) return false;
             if (occupiedBB & CastleSquareMask1[side][1]) return false;
-            if (areaIsAttacked(side ^ 1, CastleSquareMask2[side][1])) return false;
+            if (areaIsAttacked<path>(side ^ 1, CastleSquareMask2[side][1])) return false;
         }
     } break;
     case MF_PROMN: case MF_PROMB: case MF_PROMR: case MF_PROMQ: {
@@ -651,4 +817,38 @@ bool position_t::phashIsValid() {
             hash ^= ZobPiece[getSide(sq)][PAWN][sq];
     }
     return stack.phash == hash;
-}
\ No newline at end of file
+}
+
+uint64_t PositionData::materialHash(const int counts[2][8]) {
+    uint64_t hash = 0;
+    for (int c = WHITE; c <= BLACK; ++c) {
+        for (int pc = PAWN; pc <= KING; ++pc) {
+            for (int n = counts[c][pc]; n > 0; --n) hash ^= ZobPiece[c][pc][n - 1];
+        }
+    }
+    return hash;
+}
+
+uint64_t position_t::mhashFromScratch() {
+    int counts[2][8] = {};
+    for (int c = WHITE; c <= BLACK; ++c) {
+        for (int pc = PAWN; pc <= KING; ++pc) counts[c][pc] = bitCnt(getPieceBB(pc, c));
+    }
+    return materialHash(counts);
+}
+
+bool position_t::mhashIsValid() {
+    return stack.mhash == mhashFromScratch();
+}
+
+// the kernels the move generator, the search and perft call into
+#define INSTANTIATE_POSITION_KERNELS(path) \
+    template void position_t::doMove<path>(undo_t& undo, move_t m, int& ply); \
+    template bool position_t::staticExchangeEval<path>(move_t m, int threshold, uint64_t attackersto[64], uint64_t& known); \
+    template bool position_t::kingIsInCheck<path>(); \
+    template bool position_t::moveIsLegal<path>(move_t move, bool incheck); \
+    template bool position_t::moveIsCheck<path>(move_t m); \
+    template bool position_t::moveIsValid<path>(move_t move); \
+    template uint64_t position_t::attackedSqsBB<path>(int c, uint64_t occ); \
+    template uint64_t position_t::getAttacksBB<path>(int sq, int c);
+FOR_EACH_CPU_PATH(INSTANTIATE_POSITION_KERNELS)
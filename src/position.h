@@ -6,44 +6,65 @@
 
 #pragma once
 
+#include <array>
+#include <vector>
+
+namespace NNUE { struct accumulator_t; }
+
 namespace PositionData {
-    extern uint64_t InBetween[64][64];
-    extern int DirFromTo[64][64];
+    extern const std::array<std::array<uint64_t, 64>, 64> InBetween;
+    extern const std::array<std::array<uint64_t, 8>, 64> DirBitmap;
+    extern const std::array<std::array<int, 64>, 64> DirFromTo;
     extern const uint64_t CastleSquareMask1[2][2];
     extern const uint64_t CastleSquareMask2[2][2];
     extern const int CastleSquareFrom[2];
     extern const int CastleSquareTo[2][2];
     extern const int RookFrom[2][2];
     extern const int RookTo[2][2];
-    extern void initArr(void);
+    extern uint64_t materialHash(const int counts[2][8]);
 }
 
+enum GenTypes {
+    GEN_TACTICAL,
+    GEN_QUIET,
+    GEN_EVASION
+};
+
 struct undo_t {
     void init() {
+        hash = 0;
+        phash = 0;
+        mhash = 0;
+        pinned = 0;
+        dcc = 0;
+        for (auto& c : checksqs) c = 0;
+        score[WHITE] = { 0, 0 };
+        score[BLACK] = { 0, 0 };
         lastmove = 0;
-        castle = 0;
         fifty = 0;
-        epsq = -1;
         pliesfromnull = 0;
-        phash = 0;
-        hash = 0;
+        castle = 0;
+        epsq = -1;
         capturedpc = EMPTY;
         movingpc = EMPTY;
         dest = 0;
-        score[WHITE] = { 0, 0 };
-        score[BLACK] = { 0, 0 };
     }
-    move_t lastmove;
-    int32_t castle;
-    int32_t fifty;
-    int32_t epsq;
-    int32_t capturedpc;
-    int32_t movingpc;
-    int32_t dest;
-    int32_t pliesfromnull;
-    score_t score[2];
-    uint64_t phash;
     uint64_t hash;
+    uint64_t phash;
+    uint64_t mhash; // material key: one zobrist key per piece count, see position_t::mhashFromScratch
+    // check info for the side to move, see position_t::setCheckInfo
+    uint64_t pinned;
+    uint64_t dcc;
+    uint64_t checksqs[7];
+    score_t score[2];
+    move_t lastmove;
+    uint16_t fifty;
+    uint16_t pliesfromnull;
+    uint8_t castle;
+    int8_t epsq;
+    uint8_t capturedpc;
+    uint8_t movingpc;
+    uint8_t dest;
 };
 
 struct position_t {
@@ -54,14 +75,18 @@ struct position_t {
     void doNullMove(undo_t& undo, int& ply);
     void undoMove(undo_t& undo, int& ply);
     void doMove(undo_t& undo, move_t m, int& ply);
+    template<int path> void doMove(undo_t& undo, move_t m, int& ply);
+    void setCheckInfo();
+    template<int path> void setCheckInfo();
     void setPiece(bool update, int sq, int c, int pc);
     void removePiece(bool update, int sq, int c, int pc);
     void setPosition(const std::string& fenstr);
+    void completePosition();
     std::string positionToFEN();
     std::string to_str();
 
     bool isRepeat();
-    bool isMatIdxValid();
+    int gameCycle();
     bool isMatDrawn();
     int getPiece(int sq);
     int getSide(int sq);
@@ -69,43 +94,61 @@ struct position_t {
     uint64_t getPieceBB(int pc, int c);
     uint64_t bishopSlidersBB(int c);
     uint64_t rookSlidersBB(int c);
-    uint64_t allAttackersToSqBB(int sq, uint64_t occupied);
-    uint64_t safeSqsBB(int c, uint64_t occ, uint64_t target);
-    uint64_t pieceAttacksFromBB(int pc, int sq, uint64_t occ);
-    uint64_t getAttacksBB(int sq, int c);
-    uint64_t pinnedPiecesBB(int c);
-    uint64_t discoveredPiecesBB(int c);
+    // the move, attack and exchange kernels are instantiated per cpu path, see Utils::withCpuPath. The
+    // search and perft call them with their own path, the non-template entry points switch on every call
+    template<int path> uint64_t allAttackersToSqBB(int sq, uint64_t occupied);
+    template<int path> uint64_t attackedSqsBB(int c, uint64_t occ);
+    template<int path> uint64_t pieceAttacksFromBB(int pc, int sq, uint64_t occ);
+    template<int path> uint64_t getAttacksBB(int sq, int c);
+    template<int path> uint64_t pinnedPiecesBB(int c);
+    template<int path> uint64_t discoveredPiecesBB(int c);
 
     bool staticExchangeEval(move_t m, int threshold);
+    bool staticExchangeEval(move_t m, int threshold, uint64_t attackersto[64], uint64_t& known);
+    template<int path> bool staticExchangeEval(move_t m, int threshold, uint64_t attackersto[64], uint64_t& known);
     bool canCastleKS(int s);
     bool canCastleQS(int s);
     bool kingIsInCheck();
-    bool areaIsAttacked(int c, uint64_t target);
-    bool sqIsAttacked(uint64_t occ, int sq, int c);
-    bool moveIsLegal(move_t move, uint64_t pinned, bool incheck);
-    bool moveIsCheck(move_t m, uint64_t dcc);
-    bool moveIsValid(move_t move, uint64_t pinned);
+    template<int path> bool kingIsInCheck();
+    template<int path> bool areaIsAttacked(int c, uint64_t target);
+    template<int path> bool sqIsAttacked(uint64_t occ, int sq, int c);
+    bool moveIsLegal(move_t move, bool incheck);
+    template<int path> bool moveIsLegal(move_t move, bool incheck);
+    bool moveIsCheck(move_t m);
+    template<int path> bool moveIsCheck(move_t m);
+    bool moveIsValid(move_t move);
+    template<int path> bool moveIsValid(move_t move);
     bool moveIsTactical(move_t m);
 
     bool hashIsValid();
     bool phashIsValid();
+    bool mhashIsValid();
+    uint64_t mhashFromScratch();
 
+    template<int path, int c, int pc>
+    void genPieceMoves(movelist_t<220>& mvlist, uint64_t pinned, uint64_t frombits, uint64_t target);
+    template<int c, GenTypes gt>
+    void genPawnMoves(movelist_t<220>& mvlist, uint64_t pawns, uint64_t pushmask, uint64_t capmask);
+    template<int path, int c, GenTypes gt>
+    void genMoves(movelist_t<220>& mvlist);
     void genLegal(movelist_t<220>& mvlist);
+    template<int path> void genLegal(movelist_t<220>& mvlist);
+    template<int path>
+    void genEnPassant(movelist_t<220>& mvlist, uint64_t frombits);
     void genQuietMoves(movelist_t<220>& mvlist);
+    template<int path> void genQuietMoves(movelist_t<220>& mvlist);
     void genTacticalMoves(movelist_t<220>& mvlist);
+    template<int path> void genTacticalMoves(movelist_t<220>& mvlist);
     void genCheckEvasions(movelist_t<220>& mvlist);
+    template<int path> void genCheckEvasions(movelist_t<220>& mvlist);
 
     uint64_t occupiedBB;
-#ifdef TUNE
-    container_t<uint64_t, 0> history;
-#else
-    container_t<uint64_t, 1024> history;
-#endif
     uint64_t piecesBB[7];
     uint64_t colorBB[2];
-    int pieces[64];
-    int kpos[2];
-    int mat_idx[2];
     undo_t stack;
+    std::vector<uint64_t> history; // hash after each move played, only the used part is copied
+    uint8_t pieces[64];
+    uint8_t kpos[2];
     int side;
+    NNUE::accumulator_t* acc = nullptr; // accumulator of the current ply when the network is in use
 };
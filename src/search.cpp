@@ -14,6 +14,7 @@
 #include "eval.h"
 #include "movepicker.h"
 #include "params.h"
+#include "tbprobe.h"
 
 namespace Search {
     const int CMHistDepth[2] = { 3, 2 };
@@ -61,44 +62,47 @@ void search_t::idleloop() {
     while (!exit_flag) {
         if (do_sleep) wait();
         else {
-            start();
+            Utils::withCpuPath([this](auto path) { start<decltype(path)::value>(); });
             do_sleep = true;
         }
     }
 }
 
+uint64_t search_t::perft(size_t depth) {
+    return Utils::withCpuPath([&](auto path) { return perft<decltype(path)::value>(depth); });
+}
+
+uint64_t search_t::perft2(int depth) {
+    return Utils::withCpuPath([&](auto path) { return perft2<decltype(path)::value>(depth); });
+}
+
 // use this for checking position routines: doMove and undoMove
+template<int path>
 uint64_t search_t::perft(size_t depth) {
     undo_t undo;
     uint64_t cnt = 0ull;
     if (depth == 0) return 1ull;
     movelist_t<220> mvlist;
-    bool inCheck = pos.kingIsInCheck();
-    if (inCheck) pos.genCheckEvasions(mvlist);
-    else {
-        pos.genTacticalMoves(mvlist);
-        pos.genQuietMoves(mvlist);
-    }
-    uint64_t pinned = pos.pinnedPiecesBB(pos.side);
+    pos.genLegal<path>(mvlist);
     for (move_t m : mvlist) {
-        if (!pos.moveIsLegal(m, pinned, inCheck)) continue;
-        pos.doMove(undo, m, ply);
-        cnt += perft(depth - 1);
+        pos.doMove<path>(undo, m, ply);
+        cnt += perft<path>(depth - 1);
         pos.undoMove(undo, ply);
     }
     return cnt;
 }
 
 // use this for checking move generation: faster
+template<int path>
 uint64_t search_t::perft2(int depth) {
     movelist_t<220> mvlist;
-    pos.genLegal(mvlist);
+    pos.genLegal<path>(mvlist);
     if (depth == 1) return mvlist.size;
     undo_t undo;
     uint64_t cnt = 0ull;
     for (move_t m : mvlist) {
-        pos.doMove(undo, m, ply);
-        cnt += perft2(depth - 1);
+        pos.doMove<path>(undo, m, ply);
+        cnt += perft2<path>(depth - 1);
         pos.undoMove(undo, ply);
     }
     return cnt;
@@ -122,10 +126,11 @@ void search_t::displayInfo(move_t bestmove, int depth, int alpha, int beta) {
     else
         logger << " score mate " << ((bestmove.s > 0) ? (MATE - bestmove.s + 1) / 2 : -(MATE + bestmove.s) / 2);
     uint64_t totalnodes = e.nodesearched();
-    logger << " time " << currtime << " nodes " << totalnodes << " nps " << (totalnodes * 1000 / currtime) << " pv";
+    logger << " time " << currtime << " nodes " << totalnodes << " nps " << (totalnodes * 1000 / currtime) << " tbhits " << e.tbhitcount() << " pv";
     for (move_t m : pvlist[0]) logger << " " << m.to_str();
 }
 
+template<int path>
 void search_t::start() {
     if (e.doNUMA) Utils::bindThisThread(thread_id); // NUMA bindings
 
@@ -139,7 +144,10 @@ void search_t::start() {
 
     ply = 0;
     nodecnt = 0;
-    bool inCheck = pos.kingIsInCheck();
+    tbhits = 0;
+    pos.acc = nullptr;
+    if (NNUE::Enabled) NNUE::refresh(pos, *(pos.acc = accstack));
+    bool inCheck = pos.kingIsInCheck<path>();
     int last_score = 0;
     int mate_count = 0;
 
@@ -148,7 +156,7 @@ void search_t::start() {
         maxplysearched = 0;
         while (true) {
             stop_iter = false;
-            search(true, true, e.alpha, e.beta, rdepth, inCheck);
+            search<path, NT_ROOT>(e.alpha, e.beta, rdepth, inCheck);
             if (e.stop || e.plysearched[rdepth - 1]) break;
             else if (stop_iter) {
                 if (e.resolve_iter) continue;
@@ -230,16 +238,29 @@ bool search_t::stopSearch() {
     return e.stop;
 }
 
-int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, bool inCheck) {
-    if (depth <= 0) return qsearch(inPv, alpha, beta, inCheck);
+template<int path, NodeTypes nt>
+int search_t::search(int alpha, int beta, int depth, bool inCheck) {
+    constexpr bool inRoot = nt == NT_ROOT;
+    constexpr bool inPv = nt != NT_NONPV;
+    constexpr NodeTypes childnt = inPv ? NT_PV : NT_NONPV;
+
+    if (depth <= 0) return qsearch<path, inPv>(alpha, beta, inCheck);
 
     pvlist[ply].size = 0;
 
-    if (!inRoot) {
+    if constexpr (!inRoot) {
         if (stopSearch()) return 0;
         if (inPv && ply > maxplysearched) maxplysearched = ply;
-        if (pos.stack.fifty > 99 || pos.isRepeat() || pos.isMatDrawn()) return 0;
-        if (ply >= MAXPLY) return et.retrieve(pos);
+        if (pos.stack.fifty > 99 || pos.isMatDrawn()) return 0;
+        if (const int cycle = pos.gameCycle()) {
+            // a repetition is always preceded by a cycle, so only scan for one here
+            if (pos.isRepeat()) return 0;
+            if (cycle < ply && alpha < 0) {
+                alpha = 0;
+                if (alpha >= beta) return alpha;
+            }
+        }
+        if (ply >= MAXPLY) return et.retrieve<path>(pos);
         alpha = std::max(alpha, -MATE + ply);
         beta = std::min(beta, MATE - ply - 1);
         if (alpha >= beta) return alpha;
@@ -249,16 +270,34 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
     tte.move.m = 0;
     int tscore = NOVALUE;
     if (e.tt.retrieve(pos.stack.hash, tte)) {
-        tscore = scoreFromTrans(tte.move.s, ply, MATE - MAXPLY);
+        tscore = scoreFromTrans(tte.move.s, ply, TBWIN - MAXPLY);
         if (!inPv && tte.depth >= depth && ((tscore >= beta)
             ? (tte.getBound() & TT_LOWER)
             : (tte.getBound() & TT_UPPER)))
             return tscore;
     }
 
-    int evalscore = evalvalue[ply] = (tscore != NOVALUE) ? tscore : et.retrieve(pos);
+    if constexpr (!inRoot) {
+        if (e.tbcardinality && pos.stack.fifty == 0 && !pos.stack.castle && Utils::bitCnt(pos.occupiedBB) <= e.tbcardinality) {
+            int state;
+            const int wdl = Tablebases::probeWDL(pos, state);
+            if (state != Tablebases::PS_FAIL) {
+                ++tbhits;
+                // cursed wins and blessed losses are draws under the 50 move rule, scored just off zero
+                const int score = wdl < -1 ? -TBWIN + ply : wdl > 1 ? TBWIN - ply : 2 * wdl;
+                const int bound = wdl < -1 ? TT_UPPER : wdl > 1 ? TT_LOWER : TT_EXACT;
+                if (bound == TT_EXACT || (bound == TT_LOWER ? score >= beta : score <= alpha)) {
+                    move_t tbmove(0);
+                    tbmove.s = scoreToTrans(score, ply, TBWIN - MAXPLY);
+                    e.tt.store(pos.stack.hash, tbmove, std::min(MAXPLY - 1, depth + 6), bound);
+                    return score;
+                }
+            }
+        }
+    }
+
+    int evalscore = evalvalue[ply] = (tscore != NOVALUE) ? tscore : et.retrieve<path>(pos);
     const bool nonpawnpcs = pos.colorBB[pos.side] & ~(pos.piecesBB[PAWN] | pos.piecesBB[KING]);
-    const uint64_t dcc = pos.discoveredPiecesBB(pos.side);
     undo_t& undo = stack[ply];
 
     if (!inPv && !inCheck) {
@@ -267,25 +306,25 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
         if (depth >= 2 && evalscore >= beta && nonpawnpcs && pos.stack.lastmove.m != 0) {
             int R = ((13 + depth) >> 2) + std::min(3, (evalscore - beta) / 185); // TODO: test
             pos.doNullMove(undo, ply);
-            int score = -search(false, false, -beta, -beta + 1, depth - R, false);
+            int score = -search<path, NT_NONPV>(-beta, -beta + 1, depth - R, false);
             pos.undoNullMove(undo, ply);
             if (e.stop || stop_iter) return 0;
             if (score >= beta) {
                 if (score >= MATE - MAXPLY) score = beta;
                 if (depth < 12 && abs(beta) < MATE - MAXPLY) return score;
-                int score2 = search(false, false, alpha, beta, depth - R, inCheck);
+                int score2 = search<path, NT_NONPV>(alpha, beta, depth - R, inCheck);
                 if (e.stop || stop_iter) return 0;
                 if (score2 >= beta) return score;
             }
         }
         if (depth >= 5 && std::abs(beta) < MATE - MAXPLY && evalscore >= beta) {
             int rbeta = std::min(beta + 100, MATE - MAXPLY);
-            movepicker_t mp(*this, inCheck, true, rbeta - evalscore);
+            movepicker_t<path> mp(*this, inCheck, true, rbeta - evalscore);
             for (move_t m; mp.getMoves(m);) {
-                bool moveGivesCheck = pos.moveIsCheck(m, dcc);
-                pos.doMove(undo, m, ply);
-                int score = -qsearch(inPv, -rbeta, -rbeta + 1, moveGivesCheck);
-                if (score >= rbeta) score = -search(false, false, -rbeta, -rbeta + 1, depth - 4, moveGivesCheck);
+                bool moveGivesCheck = pos.moveIsCheck<path>(m);
+                pos.doMove<path>(undo, m, ply);
+                int score = -qsearch<path, false>(-rbeta, -rbeta + 1, moveGivesCheck);
+                if (score >= rbeta) score = -search<path, NT_NONPV>(-rbeta, -rbeta + 1, depth - 4, moveGivesCheck);
                 pos.undoMove(undo, ply);
                 if (e.stop || stop_iter) return 0;
                 if (score >= rbeta) return score;
@@ -303,15 +342,16 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
     int score;
     move_t lm = pos.stack.lastmove;
     uint16_t cm = countermove[pos.side ^ 1][pos.stack.movingpc][pos.stack.dest];
-    movepicker_t mp(*this, inCheck, false, 1, tte.move.m, killer1[ply], killer2[ply], cm);
+    movepicker_t<path> mp(*this, inCheck, false, 1, tte.move.m, killer1[ply], killer2[ply], cm);
     bool skipquiets = false;
     playedmoves[ply].size = 0;
     playedcaps[ply].size = 0;
     for (move_t m; mp.getMoves(m, skipquiets);) {
+        if (inRoot && e.tbrootmoves.size && std::find(e.tbrootmoves.begin(), e.tbrootmoves.end(), m) == e.tbrootmoves.end()) continue;
         if (e.doSMP && mp.stage == STG_DEFERRED) movestried = m.s;
         else ++movestried;
 
-        bool moveGivesCheck = pos.moveIsCheck(m, dcc);
+        bool moveGivesCheck = pos.moveIsCheck<path>(m);
         bool isTactical = pos.moveIsTactical(m);
 
         if (best_score == NOVALUE) {
@@ -321,12 +361,12 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
             else if (!inRoot && depth >= 8 && tscore != NOVALUE && tte.move.m == m.m && tte.depth >= depth - 2 && tte.getBound() & TT_LOWER) {
                 int xbeta = std::max(tscore - depth * 2, -MATE), xscore = NOVALUE, quiets = 0, tactical = 0;
                 bool skipqx = false;
-                movepicker_t mpx(*this, inCheck, false, 1, tte.move.m, killer1[ply], killer2[ply], cm);
+                movepicker_t<path> mpx(*this, inCheck, false, 1, tte.move.m, killer1[ply], killer2[ply], cm);
                 for (move_t mx; mpx.getMoves(mx, skipqx);) {
                     if (mx.m == tte.move.m) continue;
-                    bool givesCheck = pos.moveIsCheck(mx, dcc);
-                    pos.doMove(undo, mx, ply);
-                    xscore = -search(false, inPv, -xbeta - 1, -xbeta, depth / 2 - 1, givesCheck);
+                    bool givesCheck = pos.moveIsCheck<path>(mx);
+                    pos.doMove<path>(undo, mx, ply);
+                    xscore = -search<path, childnt>(-xbeta - 1, -xbeta, depth / 2 - 1, givesCheck);
                     pos.undoMove(undo, ply);
                     if (e.stop || stop_iter) return 0;
                     if (xscore >= xbeta) break;
@@ -337,8 +377,8 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
                 if (xscore != NOVALUE && xscore < xbeta) extension = 1;
                 else if (xbeta >= beta) return xbeta;
             }
-            pos.doMove(undo, m, ply);
-            score = -search(false, inPv, -beta, -alpha, depth - 1 + extension, moveGivesCheck);
+            pos.doMove<path>(undo, m, ply);
+            score = -search<path, childnt>(-beta, -alpha, depth - 1 + extension, moveGivesCheck);
             pos.undoMove(undo, ply);
         }
         else {
@@ -346,7 +386,7 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
             const bool doABDADA = (e.doSMP && mp.stage != STG_DEFERRED && depth >= e.defer_depth && !inCheck);
             if (doABDADA) {
                 if (!inPv && mp.deferred.size > 0 && depth >= e.cutoffcheck_depth && e.tt.retrieve(pos.stack.hash, tte)) {
-                    tscore = scoreFromTrans(tte.move.s, ply, MATE - MAXPLY);
+                    tscore = scoreFromTrans(tte.move.s, ply, TBWIN - MAXPLY);
                     if (tte.depth >= depth && ((tscore >= beta)
                         ? (tte.getBound() & TT_LOWER)
                         : (tte.getBound() & TT_UPPER)))
@@ -371,13 +411,13 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
                 if (futilityHistory <= alpha && (h + ch + fh) < FPHistLimit[improving]) { skipquiets = true; continue; }
                 if (depth - R <= CMHistDepth[improving] && ch < CMHistLimit[improving]) continue;
                 if (depth - R <= FMHistDepth[improving] && fh < FMHistLimit[improving]) continue;
-                if (!pos.staticExchangeEval(m, -10 * depth * depth)) continue;
+                if (!mp.see(m, -10 * depth * depth)) continue;
             }
             if (!inPv && !inCheck && !moveGivesCheck && depth < 9 && mp.stage == STG_BADTACTICS) {
-                if (!pos.staticExchangeEval(m, -100 * depth)) continue;
+                if (!mp.see(m, -100 * depth)) continue;
             }
 
-            pos.doMove(undo, m, ply);
+            pos.doMove<path>(undo, m, ply);
 
             int reduction = 1;
             if (!inCheck && !moveGivesCheck && !isTactical && depth > 2) {
@@ -389,14 +429,14 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
             }
 
             if (doABDADA) e.mht.setBusy(move_hash, m.m, depth);
-            score = -search(false, false, -alpha - 1, -alpha, depth - reduction, moveGivesCheck);
+            score = -search<path, NT_NONPV>(-alpha - 1, -alpha, depth - reduction, moveGivesCheck);
             if (doABDADA) e.mht.resetBusy(move_hash, m.m, depth);
 
             if (reduction > 1 && !e.stop && !stop_iter && score > alpha)
-                score = -search(false, false, -alpha - 1, -alpha, depth - 1, moveGivesCheck);
+                score = -search<path, NT_NONPV>(-alpha - 1, -alpha, depth - 1, moveGivesCheck);
 
             if (inPv && !e.stop && !stop_iter && score > alpha)
-                score = -search(false, inPv, -beta, -alpha, depth - 1, moveGivesCheck);
+                score = -search<path, NT_PV>(-beta, -alpha, depth - 1, moveGivesCheck);
 
             pos.undoMove(undo, ply);
         }
@@ -406,7 +446,7 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
 
         if (score > best_score) {
             best_score = score;
-            if (inRoot) {
+            if constexpr (inRoot) {
                 rootmove.m = m.m;
                 rootmove.s = best_score;
                 updatePV(pvlist, m, ply);
@@ -428,24 +468,32 @@ int search_t::search(bool inRoot, bool inPv, int alpha, int beta, int depth, boo
         if (!pos.moveIsTactical(best_move)) updateHistory(best_move, depth);
         updateCapHistory(best_move, depth);
     }
-    best_move.s = scoreToTrans(best_score, ply, MATE - MAXPLY);
+    best_move.s = scoreToTrans(best_score, ply, TBWIN - MAXPLY);
     e.tt.store(pos.stack.hash, best_move, depth, (best_score >= beta) ? TT_LOWER : ((inPv && best_score > old_alpha) ? TT_EXACT : TT_UPPER));
     return best_score;
 }
 
-int search_t::qsearch(bool inPv, int alpha, int beta, bool inCheck) {
+template<int path, bool inPv>
+int search_t::qsearch(int alpha, int beta, bool inCheck) {
     pvlist[ply].size = 0;
     if (stopSearch()) return 0;
 
     if (inPv && ply > maxplysearched) maxplysearched = ply;
-    if (pos.stack.fifty > 99 || pos.isRepeat() || pos.isMatDrawn()) return 0;
-    if (ply >= MAXPLY) return et.retrieve(pos);
+    if (pos.stack.fifty > 99 || pos.isMatDrawn()) return 0;
+    if (const int cycle = pos.gameCycle()) {
+        if (pos.isRepeat()) return 0;
+        if (cycle < ply && alpha < 0) {
+            alpha = 0;
+            if (alpha >= beta) return alpha;
+        }
+    }
+    if (ply >= MAXPLY) return et.retrieve<path>(pos);
 
     tt_entry_t tte;
     tte.move.m = 0;
     int tscore = NOVALUE;
     if (e.tt.retrieve(pos.stack.hash, tte)) {
-        tscore = scoreFromTrans(tte.move.s, ply, MATE - MAXPLY);
+        tscore = scoreFromTrans(tte.move.s, ply, TBWIN - MAXPLY);
         if (!inPv && ((tscore >= beta)
             ? (tte.getBound() & TT_LOWER)
             : (tte.getBound() & TT_UPPER)))
@@ -455,7 +503,7 @@ int search_t::qsearch(bool inPv, int alpha, int beta, bool inCheck) {
     const int old_alpha = alpha;
     int best_score = NOVALUE;
     if (!inCheck) {
-        best_score = (tscore != NOVALUE) ? tscore : et.retrieve(pos);
+        best_score = (tscore != NOVALUE) ? tscore : et.retrieve<path>(pos, alpha, beta);
         if (best_score >= beta) return best_score;
         alpha = std::max(alpha, best_score);
     }
@@ -463,13 +511,12 @@ int search_t::qsearch(bool inPv, int alpha, int beta, bool inCheck) {
     undo_t& undo = stack[ply];
     move_t best_move(0);
     int movestried = 0;
-    movepicker_t mp(*this, inCheck, true, std::max(1, alpha - best_score - 100), tte.move.m);
-    uint64_t dcc = pos.discoveredPiecesBB(pos.side);
+    movepicker_t<path> mp(*this, inCheck, true, std::max(1, alpha - best_score - 100), tte.move.m);
     for (move_t m; mp.getMoves(m);) {
         ++movestried;
-        bool moveGivesCheck = pos.moveIsCheck(m, dcc);
-        pos.doMove(undo, m, ply);
-        int score = -qsearch(inPv, -beta, -alpha, moveGivesCheck);
+        bool moveGivesCheck = pos.moveIsCheck<path>(m);
+        pos.doMove<path>(undo, m, ply);
+        int score = -qsearch<path, inPv>(-beta, -alpha, moveGivesCheck);
         pos.undoMove(undo, ply);
         if (e.stop || stop_iter) return 0;
         if (score > best_score) {
@@ -484,7 +531,7 @@ int search_t::qsearch(bool inPv, int alpha, int beta, bool inCheck) {
         }
     }
     if (movestried == 0 && inCheck) return -MATE + ply;
-    best_move.s = scoreToTrans(best_score, ply, MATE - MAXPLY);
+    best_move.s = scoreToTrans(best_score, ply, TBWIN - MAXPLY);
     e.tt.store(pos.stack.hash, best_move, 0, (best_score >= beta) ? TT_LOWER : ((inPv && best_score > old_alpha) ? TT_EXACT : TT_UPPER));
     return best_score;
 }
@@ -10,11 +10,18 @@
 #include "trans.h"
 #include "utils.h"
 #include "eval.h"
+#include "nnue.h"
 
 namespace Search {
     void initArr();
 }
 
+enum NodeTypes {
+    NT_ROOT,
+    NT_PV,
+    NT_NONPV
+};
+
 class thread_t {
 public:
     thread_t(int _thread_id) : thread_id(_thread_id) {
@@ -54,13 +61,18 @@ struct search_t : public thread_t {
 
     void idleloop();
     uint64_t perft(size_t depth);
+    template<int path> uint64_t perft(size_t depth);
     uint64_t perft2(int depth);
+    template<int path> uint64_t perft2(int depth);
     void updateInfo();
     void displayInfo(move_t bestmove, int depth, int alpha, int beta);
-    void start();
+    // the search is instantiated per cpu path and idleloop picks one at each start, see Utils::withCpuPath
+    template<int path> void start();
     bool stopSearch();
-    int search(bool inRoot, bool inPv, int alpha, int beta, int depth, bool inCheck);
-    int qsearch(bool inPv, int alpha, int beta, bool inCheck);
+    template<int path, NodeTypes nt>
+    int search(int alpha, int beta, int depth, bool inCheck);
+    template<int path, bool inPv>
+    int qsearch(int alpha, int beta, bool inCheck);
     void updateHistoryValues(int16_t& sc, int delta);
     void updateHistory(move_t bm, int depth);
     void getHistoryValues(int& h, int& ch, int& fh, move_t m);
@@ -74,6 +86,7 @@ struct search_t : public thread_t {
     int ply;
     int rdepth;
     std::atomic<uint64_t> nodecnt;
+    std::atomic<uint64_t> tbhits;
     std::atomic<bool> stop_iter;
 
     move_t rootmove;
@@ -81,6 +94,7 @@ struct search_t : public thread_t {
     movelist_t<220> playedmoves[MAXPLYSIZE];
     movelist_t<80> playedcaps[MAXPLYSIZE];
     undo_t stack[MAXPLYSIZE];
+    NNUE::accumulator_t accstack[MAXPLYSIZE + 1];
     int evalvalue[MAXPLYSIZE];
     uint16_t killer1[MAXPLYSIZE];
     uint16_t killer2[MAXPLYSIZE];
@@ -0,0 +1,859 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+/*
+  The Syzygy probing code below is adapted from Stockfish's tbprobe.cpp, itself derived from
+  the original prober by Ronald de Man:
+
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2021 The Stockfish developers (see AUTHORS file)
+  Copyright (c) 2013 Ronald de Man
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+#include "typedefs.h"
+#include "tbprobe.h"
+#include "position.h"
+#include "attacks.h"
+#include "utils.h"
+
+using namespace Utils;
+using namespace Tablebases;
+
+namespace {
+    constexpr int TBPieces = 7;
+
+    enum TBTypes { TB_WDL, TB_DTZ };
+    enum TBFlags { TBF_STM = 1, TBF_MAPPED = 2, TBF_WINPLIES = 4, TBF_LOSSPLIES = 8, TBF_WIDE = 16, TBF_SINGLEVALUE = 128 };
+
+    // table data is little endian except the huffman streams, which are big endian
+    template<typename T>
+    inline T readLE(const void* p) {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        return v;
+    }
+#ifdef _MSC_VER
+    inline uint32_t readBE32(const void* p) { return _byteswap_ulong(readLE<uint32_t>(p)); }
+    inline uint64_t readBE64(const void* p) { return _byteswap_uint64(readLE<uint64_t>(p)); }
+#else
+    inline uint32_t readBE32(const void* p) { return __builtin_bswap32(readLE<uint32_t>(p)); }
+    inline uint64_t readBE64(const void* p) { return __builtin_bswap64(readLE<uint64_t>(p)); }
+#endif
+
+    inline int offA1H8(int sq) { return sqRank(sq) - sqFile(sq); }
+    inline int flipFile(int sq) { return sq ^ 7; }
+    inline int flipRank(int sq) { return sq ^ 56; }
+    inline int sign(int v) { return (v > 0) - (v < 0); }
+
+    int MapPawns[64];
+    int MapB1H1H7[64];
+    int MapA1D1D4[64];
+    int MapKK[10][64]; // [MapA1D1D4][sq]
+    int Binomial[6][64]; // [k][n]: ways to choose k squares out of n
+    int LeadPawnIdx[6][64]; // [lead pawn count][sq]
+    int LeadPawnsSize[6][4]; // [lead pawn count][FileA..FileD]
+
+    void initIndices() {
+        // squares below the a1-h8 diagonal to 0..27
+        int code = 0;
+        for (int sq = A1; sq <= H8; ++sq)
+            if (offA1H8(sq) < 0) MapB1H1H7[sq] = code++;
+
+        // the a1-d1-d4 triangle to 0..9, the diagonal squares last
+        std::vector<int> diagonal;
+        code = 0;
+        for (int sq = A1; sq <= D4; ++sq) {
+            if (offA1H8(sq) < 0 && sqFile(sq) <= FileD) MapA1D1D4[sq] = code++;
+            else if (!offA1H8(sq) && sqFile(sq) <= FileD) diagonal.push_back(sq);
+        }
+        for (int sq : diagonal) MapA1D1D4[sq] = code++;
+
+        // the 462 legal king pairs with the first king in the a1-d1-d4 triangle. With the first king
+        // on the diagonal the second is not above it, and pairs with both on the diagonal go last
+        std::vector<std::pair<int, int>> bothondiagonal;
+        code = 0;
+        for (int idx = 0; idx < 10; ++idx) {
+            for (int s1 = A1; s1 <= D4; ++s1) {
+                if (MapA1D1D4[s1] != idx || (!idx && s1 != B1)) continue;
+                for (int s2 = A1; s2 <= H8; ++s2) {
+                    if ((Attacks::kingMovesBB(s1) | BitMask[s1]) & BitMask[s2]) continue;
+                    else if (!offA1H8(s1) && offA1H8(s2) > 0) continue;
+                    else if (!offA1H8(s1) && !offA1H8(s2)) bothondiagonal.emplace_back(idx, s2);
+                    else MapKK[idx][s2] = code++;
+                }
+            }
+        }
+        for (auto& p : bothondiagonal) MapKK[p.first][p.second] = code++;
+
+        Binomial[0][0] = 1;
+        for (int n = 1; n < 64; ++n)
+            for (int k = 0; k < 6 && k <= n; ++k)
+                Binomial[k][n] = (k > 0 ? Binomial[k - 1][n - 1] : 0) + (k < n ? Binomial[k][n - 1] : 0);
+
+        // pawn squares a2-h7 to 47..0: the higher the value, the closer to the edge and the lower the rank.
+        // The pawn with the highest value leads, and the others cannot be on the squares mapped above it
+        int available = 47;
+        for (int leadpawns = 1; leadpawns <= 5; ++leadpawns) {
+            for (int f = FileA; f <= FileD; ++f) {
+                int idx = 0;
+                for (int r = Rank2; r <= Rank7; ++r) {
+                    const int sq = r * 8 + f;
+                    if (leadpawns == 1) {
+                        MapPawns[sq] = available--;
+                        MapPawns[flipFile(sq)] = available--;
+                    }
+                    LeadPawnIdx[leadpawns][sq] = idx;
+                    idx += Binomial[leadpawns - 1][MapPawns[sq]];
+                }
+                LeadPawnsSize[leadpawns][f] = idx;
+            }
+        }
+    }
+
+    typedef uint16_t sym_t;
+
+    struct sparse_entry_t {
+        uint8_t block[4];
+        uint8_t offset[2];
+    };
+    static_assert(sizeof(sparse_entry_t) == 6, "sparse index entries are packed");
+
+    // the left and right symbols a recursive pairing symbol expands to, 12 bits each
+    struct lr_t {
+        uint8_t lr[3];
+        sym_t left() const { return ((lr[1] & 0xF) << 8) | lr[0]; }
+        sym_t right() const { return (lr[2] << 4) | (lr[1] >> 4); }
+    };
+    static_assert(sizeof(lr_t) == 3, "btree entries are packed");
+
+    // one compressed subtable: a side to move, and for pawn tables a file of the leading pawn
+    struct pairs_data_t {
+        uint8_t flags;
+        size_t blocksize; // bytes per block
+        size_t span; // one sparse index entry about every span values
+        int numblocks;
+        int maxsymlen;
+        int minsymlen; // also the value itself for single value tables
+        const uint8_t* lowestsym; // lowestsym[l] is the lowest symbol of length l + minsymlen
+        const lr_t* btree;
+        const uint8_t* blocklength; // values per block minus one, uint16 each
+        int blocklengthsize;
+        const sparse_entry_t* sparseindex;
+        size_t sparseindexsize;
+        const uint8_t* data;
+        std::vector<uint64_t> base64; // base64[l] is the lowest symbol of length l + minsymlen, left aligned
+        std::vector<uint8_t> symlen; // values per symbol minus one
+        uint8_t pieces[TBPieces]; // piece order of the encoding, it defines the groups
+        uint64_t groupidx[TBPieces + 1];
+        int grouplen[TBPieces + 1];
+        uint16_t mapidx[4]; // dtz value maps of WDL_WIN, WDL_LOSS, WDL_CURSED_WIN, WDL_BLESSED_LOSS
+    };
+
+    struct tb_table_t {
+        tb_table_t(int _type, const std::string& _name) : type(_type), name(_name) {}
+        ~tb_table_t() { unmap(); }
+        pairs_data_t* get(int stm, int f) { return &items[type == TB_WDL ? stm : 0][haspawns ? f : 0]; }
+        bool map();
+        void unmap();
+        void decodeHeader(const uint8_t* data);
+
+        std::atomic<bool> ready = false;
+        int type;
+        std::string name; // KRvK, stronger side first
+        void* base = nullptr;
+        uint64_t mapsize = 0;
+#ifdef _WIN32
+        HANDLE mapping = nullptr;
+#endif
+        const uint8_t* dtzmap = nullptr;
+        uint64_t key; // material key with the stronger side white
+        uint64_t key2; // material key with the stronger side black
+        int piececnt;
+        bool haspawns;
+        bool hasunique;
+        uint8_t pawncnt[2]; // [leading color / other color]
+        pairs_data_t items[2][4]; // [stm][leading pawn file]
+    };
+
+    std::string Paths;
+
+    bool tb_table_t::map() {
+        static const uint8_t Magic[2][4] = { { 0x71, 0xE8, 0x23, 0x5D }, { 0xD7, 0x66, 0x0C, 0xA5 } };
+#ifndef _WIN32
+        const char sep = ':';
+#else
+        const char sep = ';';
+#endif
+        const std::string fname = name + (type == TB_WDL ? ".rtbw" : ".rtbz");
+        std::istringstream ss(Paths);
+        for (std::string dir; std::getline(ss, dir, sep);) {
+            const std::string path = dir + "/" + fname;
+#ifndef _WIN32
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd == -1) continue;
+            struct stat st;
+            fstat(fd, &st);
+            mapsize = st.st_size;
+            base = mmap(nullptr, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) {
+                base = nullptr;
+                return false;
+            }
+            madvise(base, mapsize, MADV_RANDOM);
+#else
+            HANDLE fd = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+            if (fd == INVALID_HANDLE_VALUE) continue;
+            DWORD sizehigh;
+            DWORD sizelow = GetFileSize(fd, &sizehigh);
+            mapsize = (uint64_t(sizehigh) << 32) | sizelow;
+            mapping = CreateFileMapping(fd, nullptr, PAGE_READONLY, sizehigh, sizelow, nullptr);
+            CloseHandle(fd);
+            if (!mapping) return false;
+            base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!base) return unmap(), false;
+#endif
+            if (mapsize % 64 != 16 || std::memcmp(base, Magic[type], 4)) {
+                LogAndPrintOutput() << "info string corrupt tablebase file " << path;
+                unmap();
+                return false;
+            }
+            decodeHeader((const uint8_t*)base + 4);
+            return true;
+        }
+        return false;
+    }
+
+    void tb_table_t::unmap() {
+#ifndef _WIN32
+        if (base) munmap(base, mapsize);
+#else
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        mapping = nullptr;
+#endif
+        base = nullptr;
+    }
+
+    // groups are encoded together: the leading group (pawns of the leading color, or the first three
+    // unique pieces, or the two kings), then runs of identical pieces in the order of pieces[]
+    void setGroups(tb_table_t& t, pairs_data_t* d, const int order[2], int f) {
+        int n = 0, firstlen = t.haspawns ? 0 : t.hasunique ? 3 : 2;
+        d->grouplen[n] = 1;
+        for (int i = 1; i < t.piececnt; ++i) {
+            if (--firstlen > 0 || d->pieces[i] == d->pieces[i - 1]) d->grouplen[n]++;
+            else d->grouplen[++n] = 1;
+        }
+        d->grouplen[++n] = 0;
+
+        // the file stores in which order the groups multiply into the index
+        const bool pp = t.haspawns && t.pawncnt[1];
+        int next = pp ? 2 : 1;
+        int freesquares = 64 - d->grouplen[0] - (pp ? d->grouplen[1] : 0);
+        uint64_t idx = 1;
+        for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+            if (k == order[0]) {
+                d->groupidx[0] = idx;
+                idx *= t.haspawns ? LeadPawnsSize[d->grouplen[0]][f] : t.hasunique ? 31332 : 462;
+            }
+            else if (k == order[1]) {
+                d->groupidx[1] = idx;
+                idx *= Binomial[d->grouplen[1]][48 - d->grouplen[0]];
+            }
+            else {
+                d->groupidx[next] = idx;
+                idx *= Binomial[d->grouplen[next]][freesquares];
+                freesquares -= d->grouplen[next++];
+            }
+        }
+        d->groupidx[n] = idx;
+    }
+
+    uint8_t setSymlen(pairs_data_t* d, sym_t s, std::vector<bool>& visited) {
+        visited[s] = true;
+        const sym_t sr = d->btree[s].right();
+        if (sr == 0xFFF) return 0;
+        const sym_t sl = d->btree[s].left();
+        if (!visited[sl]) d->symlen[sl] = setSymlen(d, sl, visited);
+        if (!visited[sr]) d->symlen[sr] = setSymlen(d, sr, visited);
+        return d->symlen[sl] + d->symlen[sr] + 1;
+    }
+
+    const uint8_t* setSizes(pairs_data_t* d, const uint8_t* data) {
+        d->flags = *data++;
+        if (d->flags & TBF_SINGLEVALUE) {
+            d->numblocks = d->blocklengthsize = 0;
+            d->span = d->sparseindexsize = 0;
+            d->minsymlen = *data++;
+            return data;
+        }
+
+        const uint64_t tbsize = d->groupidx[std::find(d->grouplen, d->grouplen + TBPieces, 0) - d->grouplen];
+        d->blocksize = size_t(1) << *data++;
+        d->span = size_t(1) << *data++;
+        d->sparseindexsize = size_t((tbsize + d->span - 1) / d->span);
+        const int padding = *data++;
+        d->numblocks = readLE<uint32_t>(data);
+        data += sizeof(uint32_t);
+        d->blocklengthsize = d->numblocks + padding; // so the sparse index never points past the end
+        d->maxsymlen = *data++;
+        d->minsymlen = *data++;
+        d->lowestsym = data;
+        d->base64.resize(d->maxsymlen - d->minsymlen + 1);
+
+        // canonical huffman: longer codes have lower values, so base64[] decreases with the length
+        for (int i = int(d->base64.size()) - 2; i >= 0; --i) {
+            d->base64[i] = (d->base64[i + 1] + readLE<sym_t>(d->lowestsym + 2 * i) - readLE<sym_t>(d->lowestsym + 2 * (i + 1))) / 2;
+        }
+        for (size_t i = 0; i < d->base64.size(); ++i) d->base64[i] <<= 64 - i - d->minsymlen;
+
+        data += d->base64.size() * sizeof(sym_t);
+        d->symlen.resize(readLE<uint16_t>(data));
+        data += sizeof(uint16_t);
+        d->btree = (const lr_t*)data;
+
+        std::vector<bool> visited(d->symlen.size());
+        for (size_t s = 0; s < d->symlen.size(); ++s) {
+            if (!visited[s]) d->symlen[s] = setSymlen(d, sym_t(s), visited);
+        }
+        return data + d->symlen.size() * sizeof(lr_t) + (d->symlen.size() & 1);
+    }
+
+    const uint8_t* setDTZMap(tb_table_t& t, const uint8_t* data, int maxfile) {
+        if (t.type != TB_DTZ) return data;
+        t.dtzmap = data;
+        for (int f = FileA; f <= maxfile; ++f) {
+            pairs_data_t* d = t.get(0, f);
+            if (!(d->flags & TBF_MAPPED)) continue;
+            if (d->flags & TBF_WIDE) {
+                data += uintptr_t(data) & 1;
+                for (int i = 0; i < 4; ++i) {
+                    d->mapidx[i] = uint16_t((data - t.dtzmap) / 2 + 1);
+                    data += 2 * readLE<uint16_t>(data) + 2;
+                }
+            }
+            else {
+                for (int i = 0; i < 4; ++i) {
+                    d->mapidx[i] = uint16_t(data - t.dtzmap + 1);
+                    data += *data + 1;
+                }
+            }
+        }
+        return data + (uintptr_t(data) & 1);
+    }
+
+    void tb_table_t::decodeHeader(const uint8_t* data) {
+        const int sides = type == TB_WDL && key != key2 ? 2 : 1;
+        const int maxfile = haspawns ? FileD : FileA;
+        const bool pp = haspawns && pawncnt[1];
+
+        ++data; // split and has pawns flags, already known
+        for (int f = FileA; f <= maxfile; ++f) {
+            for (int i = 0; i < sides; ++i) *get(i, f) = pairs_data_t();
+            const int order[2][2] = { { *data & 0xF, pp ? *(data + 1) & 0xF : 0xF },
+                                      { *data >> 4, pp ? *(data + 1) >> 4 : 0xF } };
+            data += 1 + pp;
+            for (int k = 0; k < piececnt; ++k, ++data)
+                for (int i = 0; i < sides; ++i) get(i, f)->pieces[k] = i ? *data >> 4 : *data & 0xF;
+            for (int i = 0; i < sides; ++i) setGroups(*this, get(i, f), order[i], f);
+        }
+        data += uintptr_t(data) & 1;
+
+        for (int f = FileA; f <= maxfile; ++f)
+            for (int i = 0; i < sides; ++i) data = setSizes(get(i, f), data);
+
+        data = setDTZMap(*this, data, maxfile);
+
+        for (int f = FileA; f <= maxfile; ++f) {
+            for (int i = 0; i < sides; ++i) {
+                pairs_data_t* d = get(i, f);
+                d->sparseindex = (const sparse_entry_t*)data;
+                data += d->sparseindexsize * sizeof(sparse_entry_t);
+            }
+        }
+        for (int f = FileA; f <= maxfile; ++f) {
+            for (int i = 0; i < sides; ++i) {
+                pairs_data_t* d = get(i, f);
+                d->blocklength = data;
+                data += d->blocklengthsize * sizeof(uint16_t);
+            }
+        }
+        for (int f = FileA; f <= maxfile; ++f) {
+            for (int i = 0; i < sides; ++i) {
+                pairs_data_t* d = get(i, f);
+                data = (const uint8_t*)((uintptr_t(data) + 0x3F) & ~uintptr_t(0x3F));
+                d->data = data;
+                data += d->numblocks * d->blocksize;
+            }
+        }
+    }
+
+    // maps the file on first use, so only the first probe of a table takes the lock
+    bool isMapped(tb_table_t& t) {
+        static std::mutex mutex;
+        if (t.ready.load(std::memory_order_acquire)) return t.base != nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!t.ready.load(std::memory_order_relaxed)) {
+            t.map();
+            t.ready.store(true, std::memory_order_release);
+        }
+        return t.base != nullptr;
+    }
+
+    // the value at index idx of a recursive pairing + canonical huffman compressed table
+    int decompressPairs(const pairs_data_t* d, uint64_t idx) {
+        if (d->flags & TBF_SINGLEVALUE) return d->minsymlen;
+
+        // the sparse index entry near idx gives a block and an offset in it, then walk to the right block
+        const uint32_t k = uint32_t(idx / d->span);
+        uint32_t block = readLE<uint32_t>(d->sparseindex[k].block);
+        int offset = readLE<uint16_t>(d->sparseindex[k].offset);
+        offset += int(idx % d->span) - int(d->span / 2);
+        while (offset < 0) offset += readLE<uint16_t>(d->blocklength + 2 * --block) + 1;
+        while (offset > readLE<uint16_t>(d->blocklength + 2 * block)) offset -= readLE<uint16_t>(d->blocklength + 2 * block++) + 1;
+
+        // decode symbols until the one covering offset
+        const uint8_t* ptr = d->data + uint64_t(block) * d->blocksize;
+        uint64_t buf64 = readBE64(ptr);
+        ptr += 8;
+        int buf64size = 64;
+        sym_t sym;
+        while (true) {
+            int len = 0;
+            while (buf64 < d->base64[len]) ++len;
+            sym = sym_t((buf64 - d->base64[len]) >> (64 - len - d->minsymlen));
+            sym += readLE<sym_t>(d->lowestsym + 2 * len);
+            if (offset < d->symlen[sym] + 1) break;
+            offset -= d->symlen[sym] + 1;
+            len += d->minsymlen;
+            buf64 <<= len;
+            buf64size -= len;
+            if (buf64size <= 32) {
+                buf64size += 32;
+                buf64 |= uint64_t(readBE32(ptr)) << (64 - buf64size);
+                ptr += 4;
+            }
+        }
+
+        // then expand the symbol pair by pair down to the value
+        while (d->symlen[sym]) {
+            const sym_t left = d->btree[sym].left();
+            if (offset < d->symlen[left] + 1) sym = left;
+            else {
+                offset -= d->symlen[left] + 1;
+                sym = d->btree[sym].right();
+            }
+        }
+        return d->btree[sym].left();
+    }
+
+    // dtz values are stored by frequency per wdl result, and in moves rather than plies unless flagged
+    int mapScore(tb_table_t& t, int f, int value, int wdl) {
+        if (t.type == TB_WDL) return value - 2;
+        static const int WDLMap[] = { 1, 3, 0, 2, 0 };
+        const pairs_data_t* d = t.get(0, f);
+        if (d->flags & TBF_MAPPED) {
+            if (d->flags & TBF_WIDE) value = readLE<uint16_t>(t.dtzmap + 2 * (d->mapidx[WDLMap[wdl + 2]] + value));
+            else value = t.dtzmap[d->mapidx[WDLMap[wdl + 2]] + value];
+        }
+        if ((wdl == WDL_WIN && !(d->flags & TBF_WINPLIES)) || (wdl == WDL_LOSS && !(d->flags & TBF_LOSSPLIES))
+            || wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS)
+            value *= 2;
+        return value + 1;
+    }
+
+    int probeTable(position_t& pos, tb_table_t& t, int wdl, int& state) {
+        int squares[TBPieces], pieces[TBPieces];
+        int size = 0, leadpawncnt = 0, tbfile = FileA;
+        uint64_t leadpawns = 0, idx;
+
+        // tables store the stronger side as white, and symmetric ones only white to move
+        const bool flip = (t.key == t.key2 && pos.side == BLACK) || pos.stack.mhash != t.key;
+        const int flipcolor = flip * 8, flipsquares = flip * 56;
+        const int stm = flip ^ pos.side;
+
+        auto pieceOn = [&](int sq) { return ((pos.getSide(sq) << 3) | pos.getPiece(sq)) ^ flipcolor; };
+        auto pawnsComp = [](int i, int j) { return MapPawns[i] < MapPawns[j]; };
+
+        // pawn tables are split by the file of the leading pawn, the one closest to the edge on the lowest rank
+        if (t.haspawns) {
+            const int pc = t.get(0, 0)->pieces[0] ^ flipcolor;
+            leadpawns = pos.getPieceBB(PAWN, pc >> 3);
+            for (uint64_t b = leadpawns; b;) squares[size++] = popFirstBit(b) ^ flipsquares;
+            leadpawncnt = size;
+            std::swap(squares[0], *std::max_element(squares, squares + leadpawncnt, pawnsComp));
+            tbfile = std::min(sqFile(squares[0]), FileH - sqFile(squares[0]));
+        }
+
+        if (t.type == TB_DTZ && (t.get(stm, tbfile)->flags & TBF_STM) != stm && !(t.key == t.key2 && !t.haspawns))
+            return state = PS_CHANGE_STM, 0;
+
+        for (uint64_t b = pos.occupiedBB ^ leadpawns; b;) {
+            const int sq = popFirstBit(b);
+            squares[size] = sq ^ flipsquares;
+            pieces[size++] = pieceOn(sq);
+        }
+
+        // reorder the pieces to the sequence of the table
+        pairs_data_t* d = t.get(stm, tbfile);
+        for (int i = leadpawncnt; i < size - 1; ++i) {
+            for (int j = i + 1; j < size; ++j) {
+                if (d->pieces[i] == pieces[j]) {
+                    std::swap(pieces[i], pieces[j]);
+                    std::swap(squares[i], squares[j]);
+                    break;
+                }
+            }
+        }
+
+        // the leading piece goes to the a1-d1-d4 triangle
+        if (sqFile(squares[0]) > FileD)
+            for (int i = 0; i < size; ++i) squares[i] = flipFile(squares[i]);
+
+        if (t.haspawns) {
+            idx = LeadPawnIdx[leadpawncnt][squares[0]];
+            std::stable_sort(squares + 1, squares + leadpawncnt, pawnsComp);
+            for (int i = 1; i < leadpawncnt; ++i) idx += Binomial[i][MapPawns[squares[i]]];
+        }
+        else {
+            if (sqRank(squares[0]) > Rank4)
+                for (int i = 0; i < size; ++i) squares[i] = flipRank(squares[i]);
+
+            // the first piece of the leading group off the a1-h8 diagonal goes below it
+            for (int i = 0; i < d->grouplen[0]; ++i) {
+                if (!offA1H8(squares[i])) continue;
+                if (offA1H8(squares[i]) > 0)
+                    for (int j = i; j < size; ++j) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                break;
+            }
+
+            if (t.hasunique) {
+                const int adjust1 = squares[1] > squares[0];
+                const int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+                if (offA1H8(squares[0]))
+                    idx = (MapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+                else if (offA1H8(squares[1]))
+                    idx = (6 * 63 + sqRank(squares[0]) * 28 + MapB1H1H7[squares[1]]) * 62 + squares[2] - adjust2;
+                else if (offA1H8(squares[2]))
+                    idx = 6 * 63 * 62 + 4 * 28 * 62 + sqRank(squares[0]) * 7 * 28
+                        + (sqRank(squares[1]) - adjust1) * 28 + MapB1H1H7[squares[2]];
+                else
+                    idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + sqRank(squares[0]) * 7 * 6
+                        + (sqRank(squares[1]) - adjust1) * 6 + (sqRank(squares[2]) - adjust2);
+            }
+            else idx = MapKK[MapA1D1D4[squares[0]]][squares[1]];
+        }
+
+        // the remaining groups, each as a combination of the squares left free by the previous ones
+        idx *= d->groupidx[0];
+        int* groupsq = squares + d->grouplen[0];
+        bool remainingpawns = t.haspawns && t.pawncnt[1];
+        for (int next = 1; d->grouplen[next]; ++next) {
+            std::stable_sort(groupsq, groupsq + d->grouplen[next]);
+            uint64_t n = 0;
+            for (int i = 0; i < d->grouplen[next]; ++i) {
+                const int adjust = int(std::count_if(squares, groupsq, [&](int sq) { return groupsq[i] > sq; }));
+                n += Binomial[i + 1][groupsq[i] - adjust - 8 * remainingpawns];
+            }
+            remainingpawns = false;
+            idx += n * d->groupidx[next];
+            groupsq += d->grouplen[next];
+        }
+
+        return mapScore(t, tbfile, decompressPairs(d, idx), wdl);
+    }
+
+    std::deque<tb_table_t> WDLTables, DTZTables;
+    std::unordered_map<uint64_t, std::pair<tb_table_t*, tb_table_t*>> TableIndex; // read only while searching
+
+    void addTable(const std::vector<int>& pcs) {
+        static const std::string PieceChars = " PNBRQK";
+        std::string name;
+        for (int pc : pcs) name += PieceChars[pc];
+        name.insert(name.find('K', 1), "v");
+
+        bool found = false;
+        std::istringstream ss(Paths);
+#ifndef _WIN32
+        for (std::string dir; !found && std::getline(ss, dir, ':');) found = std::ifstream(dir + "/" + name + ".rtbw").is_open();
+#else
+        for (std::string dir; !found && std::getline(ss, dir, ';');) found = std::ifstream(dir + "/" + name + ".rtbw").is_open();
+#endif
+        if (!found) return;
+
+        int counts[2][8] = {};
+        for (size_t i = 0, c = WHITE; i < name.size(); ++i) {
+            if (name[i] == 'v') c = BLACK;
+            else ++counts[c][PieceChars.find(name[i])];
+        }
+        tb_table_t& wdl = WDLTables.emplace_back(TB_WDL, name);
+        tb_table_t& dtz = DTZTables.emplace_back(TB_DTZ, name);
+        for (tb_table_t* t : { &wdl, &dtz }) {
+            t->key = PositionData::materialHash(counts);
+            std::swap(counts[WHITE], counts[BLACK]);
+            t->key2 = PositionData::materialHash(counts);
+            std::swap(counts[WHITE], counts[BLACK]);
+            t->piececnt = int(pcs.size());
+            t->haspawns = counts[WHITE][PAWN] + counts[BLACK][PAWN] > 0;
+            t->hasunique = false;
+            for (int c = WHITE; c <= BLACK; ++c)
+                for (int pc = PAWN; pc < KING; ++pc) t->hasunique |= counts[c][pc] == 1;
+            // with pawns on both sides the side with fewer pawns leads, it compresses better
+            const bool whiteleads = !counts[BLACK][PAWN] || (counts[WHITE][PAWN] && counts[BLACK][PAWN] >= counts[WHITE][PAWN]);
+            t->pawncnt[0] = counts[whiteleads ? WHITE : BLACK][PAWN];
+            t->pawncnt[1] = counts[whiteleads ? BLACK : WHITE][PAWN];
+        }
+        TableIndex[wdl.key] = TableIndex[wdl.key2] = { &wdl, &dtz };
+        MaxCardinality = std::max(MaxCardinality, int(pcs.size()));
+    }
+
+    int probeTable(position_t& pos, int type, int& state, int wdl = WDL_DRAW) {
+        if (bitCnt(pos.occupiedBB) == 2) return WDL_DRAW; // KvK
+        auto it = TableIndex.find(pos.stack.mhash);
+        if (it == TableIndex.end()) return state = PS_FAIL, 0;
+        tb_table_t& t = type == TB_WDL ? *it->second.first : *it->second.second;
+        if (!isMapped(t)) return state = PS_FAIL, 0;
+        return probeTable(pos, t, wdl, state);
+    }
+
+    bool isCapture(position_t& pos, move_t m) {
+        return pos.pieces[m.to()] != EMPTY || m.isEnPassant();
+    }
+
+    bool hasLegalMoves(position_t& pos) {
+        movelist_t<220> ml;
+        pos.genLegal(ml);
+        return ml.size > 0;
+    }
+
+    // the first history index since the last irreversible move, the positions before it cannot recur
+    int reversibleStart(position_t& pos) {
+        return std::max(0, int(pos.history.size()) - 1 - std::min<int>(pos.stack.fifty, pos.stack.pliesfromnull));
+    }
+
+    // how often the position at history index k occurred before it, back to index start
+    int repetitions(position_t& pos, int k, int start) {
+        int count = 0;
+        for (int idx = k - 4; idx >= start; idx -= 2) count += pos.history[idx] == pos.history[k];
+        return count;
+    }
+
+    // a draw the game itself already decided: the 50 move rule or a third occurrence of the position
+    bool isDrawnByGame(position_t& pos) {
+        if (pos.stack.fifty > 99 && (!pos.kingIsInCheck() || hasLegalMoves(pos))) return true;
+        return repetitions(pos, int(pos.history.size()) - 1, reversibleStart(pos)) >= 2;
+    }
+
+    int dtzBeforeZeroing(int wdl) {
+        return wdl == WDL_WIN ? 1 : wdl == WDL_CURSED_WIN ? 101 : wdl == WDL_BLESSED_LOSS ? -101 : wdl == WDL_LOSS ? -1 : 0;
+    }
+
+    // tables store "don't care" values where a capture (or for dtz a pawn move) is best, so those moves are
+    // searched and the best of them and the table value is the result
+    template<bool checkZeroing>
+    int search(position_t& pos, int& state) {
+        int value, best = WDL_LOSS, movecnt = 0, ply = 0;
+        undo_t undo;
+        movelist_t<220> ml;
+        pos.genLegal(ml);
+        for (move_t m : ml) {
+            if (!isCapture(pos, m) && (!checkZeroing || pos.pieces[m.from()] != PAWN)) continue;
+            ++movecnt;
+            pos.doMove(undo, m, ply);
+            value = -search<false>(pos, state);
+            pos.undoMove(undo, ply);
+            if (state == PS_FAIL) return WDL_DRAW;
+            if (value > best) {
+                best = value;
+                if (value >= WDL_WIN) return state = PS_ZEROING_BEST_MOVE, value;
+            }
+        }
+
+        // with every legal move searched the table value is not needed, and it is wrong for positions
+        // with en passant rights, which tables do not store
+        const bool nomoremoves = movecnt && movecnt == ml.size;
+        if (nomoremoves) value = best;
+        else {
+            value = probeTable(pos, TB_WDL, state);
+            if (state == PS_FAIL) return WDL_DRAW;
+        }
+        if (best >= value) return state = (best > WDL_DRAW || nomoremoves ? PS_ZEROING_BEST_MOVE : PS_OK), best;
+        return state = PS_OK, value;
+    }
+
+    int wdl(position_t& pos, int& state) {
+        state = PS_OK;
+        return search<false>(pos, state);
+    }
+
+    int dtz(position_t& pos, int& state) {
+        state = PS_OK;
+        const int wdl = search<true>(pos, state);
+        if (state == PS_FAIL || wdl == WDL_DRAW) return 0; // dtz tables do not store draws
+        if (state == PS_ZEROING_BEST_MOVE) return dtzBeforeZeroing(wdl);
+
+        int value = probeTable(pos, TB_DTZ, state, wdl);
+        if (state == PS_FAIL) return 0;
+        if (state != PS_CHANGE_STM) return (value + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * sign(wdl);
+
+        // the table stores the other side to move: take the best dtz one ply deeper
+        int mindtz = 0xFFFF, ply = 0;
+        undo_t undo;
+        movelist_t<220> ml;
+        pos.genLegal(ml);
+        for (move_t m : ml) {
+            const bool zeroing = isCapture(pos, m) || pos.pieces[m.from()] == PAWN;
+            pos.doMove(undo, m, ply);
+            // a zeroing move needs the dtz before it, the sign of the result after it says if it still wins
+            value = zeroing ? -dtzBeforeZeroing(search<false>(pos, state)) : -dtz(pos, state);
+            if (value == 1 && pos.kingIsInCheck() && !hasLegalMoves(pos)) mindtz = 1;
+            if (!zeroing) value += sign(value);
+            if (value < mindtz && sign(value) == sign(wdl)) mindtz = value;
+            pos.undoMove(undo, ply);
+            if (state == PS_FAIL) return 0;
+        }
+        return mindtz == 0xFFFF ? -1 : mindtz;
+    }
+
+    // the probes make and unmake moves below the current ply, keep them off the search accumulator stack
+    struct accumulator_guard_t {
+        accumulator_guard_t(position_t& _pos) : pos(_pos), acc(_pos.acc) { pos.acc = nullptr; }
+        ~accumulator_guard_t() { pos.acc = acc; }
+        position_t& pos;
+        NNUE::accumulator_t* acc;
+    };
+}
+
+namespace Tablebases {
+    int MaxCardinality = 0;
+
+    void init(const std::string& paths) {
+        static bool indices = (initIndices(), true);
+        (void)indices;
+
+        TableIndex.clear();
+        WDLTables.clear();
+        DTZTables.clear();
+        MaxCardinality = 0;
+        Paths = paths;
+        if (paths.empty() || paths == "<empty>") return;
+
+        // every material combination up to 7 pieces, stronger side first as in the file names
+        for (int p1 = PAWN; p1 < KING; ++p1) {
+            addTable({ KING, p1, KING });
+            for (int p2 = PAWN; p2 <= p1; ++p2) {
+                addTable({ KING, p1, p2, KING });
+                addTable({ KING, p1, KING, p2 });
+                for (int p3 = PAWN; p3 < KING; ++p3) addTable({ KING, p1, p2, KING, p3 });
+                for (int p3 = PAWN; p3 <= p2; ++p3) {
+                    addTable({ KING, p1, p2, p3, KING });
+                    for (int p4 = PAWN; p4 <= p3; ++p4) {
+                        addTable({ KING, p1, p2, p3, p4, KING });
+                        for (int p5 = PAWN; p5 <= p4; ++p5) addTable({ KING, p1, p2, p3, p4, p5, KING });
+                        for (int p5 = PAWN; p5 < KING; ++p5) addTable({ KING, p1, p2, p3, p4, KING, p5 });
+                    }
+                    for (int p4 = PAWN; p4 < KING; ++p4) {
+                        addTable({ KING, p1, p2, p3, KING, p4 });
+                        for (int p5 = PAWN; p5 <= p4; ++p5) addTable({ KING, p1, p2, p3, KING, p4, p5 });
+                    }
+                }
+                for (int p3 = PAWN; p3 <= p1; ++p3)
+                    for (int p4 = PAWN; p4 <= (p1 == p3 ? p2 : p3); ++p4) addTable({ KING, p1, p2, KING, p3, p4 });
+            }
+        }
+        LogAndPrintOutput() << "info string found " << WDLTables.size() << " tablebases";
+    }
+
+    int probeWDL(position_t& pos, int& state) {
+        accumulator_guard_t guard(pos);
+        return wdl(pos, state);
+    }
+
+    int probeDTZ(position_t& pos, int& state) {
+        accumulator_guard_t guard(pos);
+        return dtz(pos, state);
+    }
+
+    // ranks the root moves by dtz, or by wdl when the dtz tables are missing, and keeps the best ranked ones.
+    // Wins that cannot be converted before the 50 move rule, or that follow a repetition since the last
+    // irreversible move, rank lower the longer they take, so the search keeps making progress. Returns the
+    // number of moves probed, zero if the root is not in the tables
+    int rootProbe(position_t& pos, movelist_t<220>& moves, bool& searchprobes) {
+        static const int WDLRanks[] = { -1000, -899, 0, 899, 1000 };
+        if (!MaxCardinality || bitCnt(pos.occupiedBB) > MaxCardinality || pos.stack.castle) return 0;
+
+        accumulator_guard_t guard(pos);
+        movelist_t<220> ml;
+        int ranks[220], state = PS_OK, ply = 0;
+        const int cnt50 = pos.stack.fifty;
+        const int start = reversibleStart(pos);
+        bool rep = false;
+        for (int k = int(pos.history.size()) - 1; k >= start + 4 && !rep; --k) rep = repetitions(pos, k, start) > 0;
+        undo_t undo;
+        pos.genLegal(ml);
+        if (!ml.size) return 0;
+        bool dtzranks = true;
+        for (int i = 0; i < ml.size && state != PS_FAIL; ++i) {
+            pos.doMove(undo, ml[i], ply);
+            int value;
+            if (pos.stack.fifty == 0) value = dtzBeforeZeroing(-wdl(pos, state));
+            else if (isDrawnByGame(pos)) value = 0; // one ply from the root, so a repetition in the game itself
+            else {
+                value = -dtz(pos, state);
+                value += sign(value);
+            }
+            if (value == 2 && pos.kingIsInCheck() && !hasLegalMoves(pos)) value = 1;
+            pos.undoMove(undo, ply);
+            ranks[i] = value > 0 ? (value + cnt50 <= 99 && !rep ? 1000 : 1000 - (value + cnt50))
+                : value < 0 ? (-value * 2 + cnt50 < 100 ? -1000 : -1000 + (-value + cnt50)) : 0;
+        }
+        if (state == PS_FAIL) {
+            dtzranks = false;
+            state = PS_OK;
+            for (int i = 0; i < ml.size && state != PS_FAIL; ++i) {
+                pos.doMove(undo, ml[i], ply);
+                ranks[i] = WDLRanks[-wdl(pos, state) + 2];
+                pos.undoMove(undo, ply);
+            }
+            if (state == PS_FAIL) return 0;
+        }
+
+        const int best = *std::max_element(ranks, ranks + ml.size);
+        moves.size = 0;
+        for (int i = 0; i < ml.size; ++i)
+            if (ranks[i] == best) moves.add(ml[i]);
+
+        // dtz ranks already make progress, and probing cannot improve on a draw or a loss
+        searchprobes = !dtzranks && best > 0;
+        return ml.size;
+    }
+}
@@ -0,0 +1,37 @@
+/**************************************************/
+/*  Invictus 2021                                 */
+/*  Edsel Apostol                                 */
+/*  ed_apostol@yahoo.com                          */
+/**************************************************/
+
+#pragma once
+
+#include <string>
+#include "typedefs.h"
+
+struct position_t;
+
+// Syzygy WDL/DTZ tablebases. A table is memory mapped and its header decoded on first use under a lock,
+// after that every probe from every thread only reads the mapping
+namespace Tablebases {
+    enum WDLScores {
+        WDL_LOSS = -2,
+        WDL_BLESSED_LOSS, // a loss, but a draw under the 50 move rule
+        WDL_DRAW,
+        WDL_CURSED_WIN, // a win, but a draw under the 50 move rule
+        WDL_WIN
+    };
+
+    enum ProbeStates {
+        PS_FAIL,
+        PS_OK,
+        PS_CHANGE_STM, // the dtz table stores the other side to move
+        PS_ZEROING_BEST_MOVE // the best move is a capture or pawn move, the table value is unreliable
+    };
+
+    extern int MaxCardinality;
+    extern void init(const std::string& paths);
+    extern int probeWDL(position_t& pos, int& state);
+    extern int probeDTZ(position_t& pos, int& state);
+    extern int rootProbe(position_t& pos, movelist_t<220>& moves, bool& searchprobes);
+}
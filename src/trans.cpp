@@ -6,19 +6,39 @@
 
 #include "typedefs.h"
 #include "trans.h"
+#include "params.h"
+#include "nnue.h"
+#include "utils.h"
 
-int eval_table_t::retrieve(position_t& pos) {
-    eval_hash_entry_t *entry = &getEntry(pos.stack.hash).bucket[0], *replace = entry;
+template<int path>
+int eval_table_t::retrieve(position_t& pos, int alpha, int beta) {
+    eval_bucket_t& b = getEntry(pos.stack.hash);
+    eval_hash_entry_t *entry = &b.bucket[0], *replace = entry;
     uint32_t lock32 = lock(pos.stack.hash);
-    for (int t = 5; t--; ++entry) {
-        if (entry->hashlock == lock32)
-            return entry->eval;
+    for (int t = 0; t < 5; ++t, ++entry) {
+        if (entry->hashlock == lock32) {
+            if ((b.exact & (1 << t)) || entry->eval - EvalParam::LazyMargin >= beta || entry->eval + EvalParam::LazyMargin <= alpha)
+                return entry->eval;
+            replace = entry;
+            break;
+        }
     }
+    const int idx = int(replace - &b.bucket[0]);
     replace->hashlock = lock32;
-    replace->eval = eval.score(pos);
+    if (NNUE::Enabled) {
+        replace->eval = NNUE::evaluate(pos);
+        b.exact |= 1 << idx;
+        return replace->eval;
+    }
+    replace->eval = eval.evaluate<path>(pos, alpha, beta);
+    if (eval.exact) b.exact |= 1 << idx;
+    else b.exact &= ~(1 << idx);
     return replace->eval;
 }
 
+#define INSTANTIATE_RETRIEVE(path) template int eval_table_t::retrieve<path>(position_t& pos, int alpha, int beta);
+FOR_EACH_CPU_PATH(INSTANTIATE_RETRIEVE)
+
 bool trans_table_t::retrieve(const uint64_t hash, tt_entry_t& ttentry) {
     tt_entry_t *entry = &getEntry(hash).bucket[0];
     for (int t = 3; t--; ++entry) {
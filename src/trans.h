@@ -7,23 +7,35 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include "typedefs.h"
 #include "eval.h"
+#include "utils.h"
 
 template <typename T>
 class hashtable_t {
 public:
     hashtable_t() : table(nullptr), size(0), mask(0) {}
-    ~hashtable_t() { delete[] table; }
+    ~hashtable_t() { free(table); }
     void clear() { memset(table, 0, size * sizeof(T)); }
     T& getEntry(const uint64_t hash) { return table[hash & mask]; }
     void init(uint64_t mb) {
         for (size = (1 << 20) / sizeof(T), mb <<= 19; size * sizeof(T) <= mb; size <<= 1);
+        free(table);
+        // calloc hands back lazily zeroed pages, so a large table costs nothing until probed. If the size
+        // asked for can't be had, halve it until it can
+        const uint64_t wanted = size;
+        while (!(table = static_cast<T*>(calloc(size, sizeof(T)))) && size > 1) size >>= 1;
+        if (!table) {
+            PrintOutput() << "info string cannot allocate a hash table";
+            exit(EXIT_FAILURE);
+        }
+        if (size != wanted) {
+            PrintOutput() << "info string hash table of " << ((wanted * sizeof(T)) >> 20) << " MB failed, using "
+                << ((size * sizeof(T)) >> 20) << " MB";
+        }
         mask = size - 1;
-        delete[] table;
-        table = new T[size];
-        clear();
     }
     uint32_t lock(uint64_t hash) const { return hash >> 32; }
 
@@ -42,12 +54,12 @@ struct eval_hash_entry_t {
 
 struct eval_bucket_t {
     eval_hash_entry_t bucket[5];
-    uint16_t padding;
+    uint16_t exact; // bit n set if bucket[n] holds a full evaluation rather than a lazy one
 };
 
 class eval_table_t : public hashtable_t < eval_bucket_t > {
 public:
-    int retrieve(position_t& pos);
+    template<int path> int retrieve(position_t& pos, int alpha = -MATE, int beta = MATE);
     eval_t eval;
 };
 
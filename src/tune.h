@@ -10,6 +10,23 @@
 #include <algorithm>
 #include <random>
 #include <sstream>
+#include <unordered_map>
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 #include "typedefs.h"
 #include "utils.h"
@@ -18,12 +35,11 @@
 
 #define N(v) (#v)
 
-#ifdef TUNE
 namespace Tuner {
     using namespace EvalParam;
 
     double K = 1.36749;
-    const int NumThreads = 4;
+    int NumThreads = 4; // set from the tune command
 
     const int TuneAll = 1;
     const int TuneMaterial = 1;
@@ -36,51 +52,230 @@ namespace Tuner {
     const int TunePassedPawns = 0;
     const int TunePhase = 0;
 
+    // a training position in 26 bytes: the occupied squares, then a nibble per occupied square in square
+    // order holding color << 3 | piece, the side to move and the result (0 loss, 1 draw, 2 win for white)
+    struct PackedSample {
+        uint8_t occupancy[8]; // little endian
+        uint8_t pieces[16];
+        uint8_t side;
+        uint8_t result;
+    };
+    const char PackedMagic[8] = { 'I', 'N', 'V', 'T', 'U', 'N', 'E', '1' };
+
     struct PositionResults {
-        position_t* p;
-        float result;
+        const PackedSample* sample;
+        size_t trace; // index in Traces
+        float result() const { return sample->result * 0.5f; }
+    };
+
+    void Pack(position_t& pos, float result, PackedSample& s) {
+        std::memset(&s, 0, sizeof(s));
+        for (int i = 0; i < 8; ++i) s.occupancy[i] = uint8_t(pos.occupiedBB >> (8 * i));
+        int n = 0;
+        for (uint64_t pcbits = pos.occupiedBB; pcbits; ++n) {
+            const int sq = Utils::popFirstBit(pcbits);
+            s.pieces[n / 2] |= ((pos.getSide(sq) << 3) | pos.getPiece(sq)) << (4 * (n & 1));
+        }
+        s.side = pos.side;
+        s.result = uint8_t(result * 2);
+    }
+
+    void Unpack(const PackedSample& s, position_t& pos) {
+        uint64_t occupied = 0;
+        for (int i = 0; i < 8; ++i) occupied |= uint64_t(s.occupancy[i]) << (8 * i);
+        pos.initPosition();
+        int n = 0;
+        for (uint64_t pcbits = occupied; pcbits; ++n) {
+            const int sq = Utils::popFirstBit(pcbits);
+            const int nibble = (s.pieces[n / 2] >> (4 * (n & 1))) & 15;
+            pos.setPiece(true, sq, nibble >> 3, nibble & 7);
+        }
+        pos.side = s.side;
+        pos.completePosition();
+    }
+
+    // a packed sample file mapped read only, samples are read in place
+    struct SampleFile {
+        ~SampleFile() {
+#ifndef _WIN32
+            if (base) munmap(base, mapsize);
+#else
+            if (base) UnmapViewOfFile(base);
+            if (mapping) CloseHandle(mapping);
+#endif
+        }
+        bool map(const std::string& filename) {
+#ifndef _WIN32
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd == -1) return false;
+            struct stat st;
+            fstat(fd, &st);
+            mapsize = st.st_size;
+            base = mapsize ? mmap(nullptr, mapsize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (base == MAP_FAILED) return base = nullptr, false;
+#else
+            HANDLE fd = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+            if (fd == INVALID_HANDLE_VALUE) return false;
+            DWORD sizehigh;
+            DWORD sizelow = GetFileSize(fd, &sizehigh);
+            mapsize = (uint64_t(sizehigh) << 32) | sizelow;
+            mapping = CreateFileMapping(fd, nullptr, PAGE_READONLY, sizehigh, sizelow, nullptr);
+            CloseHandle(fd);
+            if (!mapping) return false;
+            base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (!base) return false;
+#endif
+            if (mapsize < sizeof(PackedMagic) || (mapsize - sizeof(PackedMagic)) % sizeof(PackedSample)
+                || std::memcmp(base, PackedMagic, sizeof(PackedMagic))) {
+                PrintOutput() << "Not a packed sample file = " << filename;
+                return false;
+            }
+            samples = (const PackedSample*)((const char*)base + sizeof(PackedMagic));
+            count = (mapsize - sizeof(PackedMagic)) / sizeof(PackedSample);
+            return true;
+        }
+        const PackedSample* samples = nullptr;
+        size_t count = 0;
+        void* base = nullptr;
+        uint64_t mapsize = 0;
+#ifdef _WIN32
+        HANDLE mapping = nullptr;
+#endif
     };
 
     struct TunerParam {
-        TunerParam(basic_score_t& v, std::string n) : val(&v), name(n) {}
-        basic_score_t *val;
+        TunerParam(double& v, std::string n) : val(&v), name(n) {}
+        double *val;
         std::string name;
-        operator basic_score_t&() { return *val; }
-        operator const basic_score_t&()const { return *val; }
-        void operator=(const basic_score_t& value) { *val = value; }
+        operator double&() { return *val; }
+        operator const double&()const { return *val; }
+        void operator=(const double& value) { *val = value; }
     };
 
     double Sigmoid(double score) {
         return 1.0 / (1.0 + std::pow(10.0, -K * score / 400.0));
     }
 
-    double Error(std::vector<PositionResults>& data, size_t batchsize) {
-        static uint64_t counter = 0;
-        static uint64_t lasttime = Utils::getTime();
-        std::vector<double> errors(batchsize, 0);
-        std::thread threads[NumThreads];
-
-        auto threaded = [&](size_t start, size_t end) {
-            eval_t eval;
-            for (size_t k = start; k < end; k += NumThreads) {
-                basic_score_t scr = eval.score(*data[k].p) * (data[k].p->side == WHITE ? +1.0 : -1.0);
-                errors[k] = std::pow(data[k].result - Sigmoid(scr), 2);
+    // workers that live for the whole tuning run, run() hands every worker the same job and waits for all
+    class TunerPool {
+    public:
+        ~TunerPool() {
+            stop();
+        }
+        void resize(int n) {
+            stop();
+            exiting = false;
+            for (int t = 0; t < n; ++t) workers.emplace_back([this, t, seen = generation]() { loop(t, seen); });
+        }
+        void run(const std::function<void(int)>& f) {
+            std::unique_lock<std::mutex> lk(lock);
+            job = &f;
+            pending = workers.size();
+            ++generation;
+            wake.notify_all();
+            done.wait(lk, [this]() { return pending == 0; });
+            job = nullptr;
+        }
+    private:
+        void loop(int t, uint64_t seen) {
+            std::unique_lock<std::mutex> lk(lock);
+            while (true) {
+                wake.wait(lk, [&]() { return exiting || generation != seen; });
+                if (exiting) return;
+                seen = generation;
+                const std::function<void(int)>* f = job;
+                lk.unlock();
+                (*f)(t);
+                lk.lock();
+                if (--pending == 0) done.notify_one();
             }
-        };
-        for (int t = 0; t < NumThreads; ++t) {
-            threads[t] = std::thread(threaded, t, batchsize);
         }
-        for (int t = 0; t < NumThreads; ++t) {
-            threads[t].join();
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                exiting = true;
+            }
+            wake.notify_all();
+            for (auto& w : workers) w.join();
+            workers.clear();
         }
-        // Neumaier Sum
-        double sum = 0.0, c = 0.0;
-        for (auto e : errors) {
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable wake, done;
+        const std::function<void(int)>* job = nullptr;
+        size_t pending = 0;
+        uint64_t generation = 0;
+        bool exiting = false;
+    };
+
+    // compensated sum, kept per worker and then combined
+    struct NeumaierSum {
+        void add(double e) {
             double t = sum + e;
             if (fabs(sum) >= fabs(e)) c += (sum - t) + e;
             else c += (e - t) + sum;
             sum = t;
         }
+        double total() const { return sum + c; }
+        double sum = 0.0, c = 0.0;
+    };
+
+    // a position's score from white's view as a function of the tuned parameters, rebuilt from its eval trace:
+    // linear entries carry count x phase/scale weight, safety entries the king attack units of each side.
+    // The phase entries only feed the gradient: d(score)/d(weight) of the phase weights at the traced values
+    struct TracedPosition {
+        double constant; // everything the tuned parameters don't change
+        double mgweight, egweight;
+        double safetybase[2]; // king attack units from parameters that are not tuned
+        uint32_t linear, safety[2], phase, end; // entry ranges in TraceEntries
+    };
+    struct TraceEntry {
+        uint32_t index;
+        float weight;
+    };
+
+    // what each worker keeps between jobs
+    struct TunerWorker {
+        tune_eval_t eval;
+        position_t pos;
+        NeumaierSum error;
+        std::vector<double> gradients;
+        std::vector<TracedPosition> traces; // of this worker's range, before they are joined
+        std::vector<TraceEntry> entries;
+    };
+
+    TunerPool Pool;
+    std::vector<std::unique_ptr<TunerWorker>> Workers;
+
+    void StartWorkers(int threads) {
+        NumThreads = std::max(1, threads);
+        Workers.clear();
+        for (int t = 0; t < NumThreads; ++t) Workers.emplace_back(new TunerWorker);
+        Pool.resize(NumThreads);
+    }
+
+    // the range of [0, count) that worker t works on
+    inline size_t WorkBegin(size_t count, int t) {
+        return count * t / NumThreads;
+    }
+
+    double Error(std::vector<PositionResults>& data, size_t batchsize) {
+        static uint64_t counter = 0;
+        static uint64_t lasttime = Utils::getTime();
+        Pool.run([&](int t) {
+            TunerWorker& w = *Workers[t];
+            // the parameters may have changed since the material entries were made
+            for (auto& entry : w.eval.mattable) entry.key = 0;
+            w.error = NeumaierSum();
+            for (size_t k = WorkBegin(batchsize, t); k < WorkBegin(batchsize, t + 1); ++k) {
+                Unpack(*data[k].sample, w.pos);
+                double scr = w.eval.score(w.pos) * (w.pos.side == WHITE ? +1.0 : -1.0);
+                w.error.add(std::pow(data[k].result() - Sigmoid(scr), 2));
+            }
+        });
+        NeumaierSum sum;
+        for (auto& w : Workers) sum.add(w->error.total());
         counter += batchsize;
         uint64_t timenow = Utils::getTime();
         if (timenow - lasttime > 10000) {
@@ -88,7 +283,7 @@ namespace Tuner {
             counter = 0;
             lasttime = timenow;
         }
-        return (sum + c) / batchsize;
+        return sum.total() / batchsize;
     }
 
     void Randomize(std::vector<PositionResults>& data) {
@@ -117,14 +312,14 @@ namespace Tuner {
 
     void PrintWeights(std::ostringstream& out) {
         if (TuneAll || TuneMaterial) {
-            out << "score_t MaterialValues[7] = { "; for (auto a : MaterialValues) out << a.to_str() + ", "; out << "};\n\n";
+            out << "score_t MaterialValues[7] = { "; for (auto a : TuneParams.MaterialValues) out << a.to_str() + ", "; out << "};\n\n";
         }
         if (TuneAll || Imbalance) {
             out << "score_t ImbalanceInternal[6][6] = {\n";
             for (int pt1 = 0; pt1 <= QUEEN; ++pt1) {
                 out << "{ ";
                 for (int pt2 = 0; pt2 <= pt1; ++pt2) {
-                    out << ImbalanceInternal[pt1][pt2].to_str() + ", ";
+                    out << TuneParams.ImbalanceInternal[pt1][pt2].to_str() + ", ";
                 }
                 out << "},\n";
             }
@@ -133,82 +328,82 @@ namespace Tuner {
             for (int pt1 = 0; pt1 <= QUEEN; ++pt1) {
                 out << "{ ";
                 for (int pt2 = 0; pt2 < pt1; ++pt2) {
-                    out << ImbalanceExternal[pt1][pt2].to_str() + ", ";
+                    out << TuneParams.ImbalanceExternal[pt1][pt2].to_str() + ", ";
                 }
                 out << "},\n";
             }
             out << "};\n\n";
         }
         if (TuneAll || TuneMobility) {
-            out << "score_t KnightMob[9] = { "; for (auto a : KnightMob) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t BishopMob[14] = { "; for (auto a : BishopMob) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t RookMob[15] = { "; for (auto a : RookMob) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t QueenMob[28] = { "; for (auto a : QueenMob) out << a.to_str() + ", "; out << "};\n\n";
+            out << "score_t KnightMob[9] = { "; for (auto a : TuneParams.KnightMob) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t BishopMob[14] = { "; for (auto a : TuneParams.BishopMob) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t RookMob[15] = { "; for (auto a : TuneParams.RookMob) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t QueenMob[28] = { "; for (auto a : TuneParams.QueenMob) out << a.to_str() + ", "; out << "};\n\n";
         }
         if (TuneAll || TunePassedPawns) {
-            out << "score_t PasserDistOwn[8] = { "; for (auto a : PasserDistOwn) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t PasserDistEnemy[8] = { "; for (auto a : PasserDistEnemy) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t PasserBonus[8] = { "; for (auto a : PasserBonus) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t PasserNotBlocked[8] = { "; for (auto a : PasserNotBlocked) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t PasserSafePush[8] = { "; for (auto a : PasserSafePush) out << a.to_str() + ", "; out << "};\n";
-            out << "score_t PasserSafeProm[8] = { "; for (auto a : PasserSafeProm) out << a.to_str() + ", "; out << "};\n\n";
+            out << "score_t PasserDistOwn[8] = { "; for (auto a : TuneParams.PasserDistOwn) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t PasserDistEnemy[8] = { "; for (auto a : TuneParams.PasserDistEnemy) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t PasserBonus[8] = { "; for (auto a : TuneParams.PasserBonus) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t PasserNotBlocked[8] = { "; for (auto a : TuneParams.PasserNotBlocked) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t PasserSafePush[8] = { "; for (auto a : TuneParams.PasserSafePush) out << a.to_str() + ", "; out << "};\n";
+            out << "score_t PasserSafeProm[8] = { "; for (auto a : TuneParams.PasserSafeProm) out << a.to_str() + ", "; out << "};\n\n";
         }
         if (TuneAll || TunePawnStructure) {
-            out << "score_t PawnConnected = " + PawnConnected.to_str() + ";\n";
-            out << "score_t PawnDoubled = " + PawnDoubled.to_str() + ";\n";
-            out << "score_t PawnIsolated = " + PawnIsolated.to_str() + ";\n";
-            out << "score_t PawnBackward = " + PawnBackward.to_str() + ";\n";
-            out << "score_t PawnIsolatedOpen = " + PawnIsolatedOpen.to_str() + ";\n";
-            out << "score_t PawnBackwardOpen = " + PawnBackwardOpen.to_str() + ";\n\n";
+            out << "score_t PawnConnected = " + TuneParams.PawnConnected.to_str() + ";\n";
+            out << "score_t PawnDoubled = " + TuneParams.PawnDoubled.to_str() + ";\n";
+            out << "score_t PawnIsolated = " + TuneParams.PawnIsolated.to_str() + ";\n";
+            out << "score_t PawnBackward = " + TuneParams.PawnBackward.to_str() + ";\n";
+            out << "score_t PawnIsolatedOpen = " + TuneParams.PawnIsolatedOpen.to_str() + ";\n";
+            out << "score_t PawnBackwardOpen = " + TuneParams.PawnBackwardOpen.to_str() + ";\n\n";
         }
         if (TuneAll || TuneActivity) {
-            out << "score_t RookOn7th = " + RookOn7th.to_str() + ";\n";
-            out << "score_t RookOnSemiOpenFile = " + RookOnSemiOpenFile.to_str() + ";\n";
-            out << "score_t RookOnOpenFile = " + RookOnOpenFile.to_str() + ";\n";
-            out << "score_t KnightOutpost = " + KnightOutpost.to_str() + ";\n";
-            out << "score_t KnightXOutpost = " + KnightXOutpost.to_str() + ";\n";
-            out << "score_t BishopOutpost = " + BishopOutpost.to_str() + ";\n";
-            out << "score_t BishopPawns = " + BishopPawns.to_str() + ";\n";
-            out << "score_t BishopCenterControl = " + BishopCenterControl.to_str() + ";\n";
-            out << "score_t PieceSpace = " + PieceSpace.to_str() + ";\n";
-            out << "score_t EmptySpace = " + EmptySpace.to_str() + ";\n\n";
+            out << "score_t RookOn7th = " + TuneParams.RookOn7th.to_str() + ";\n";
+            out << "score_t RookOnSemiOpenFile = " + TuneParams.RookOnSemiOpenFile.to_str() + ";\n";
+            out << "score_t RookOnOpenFile = " + TuneParams.RookOnOpenFile.to_str() + ";\n";
+            out << "score_t KnightOutpost = " + TuneParams.KnightOutpost.to_str() + ";\n";
+            out << "score_t KnightXOutpost = " + TuneParams.KnightXOutpost.to_str() + ";\n";
+            out << "score_t BishopOutpost = " + TuneParams.BishopOutpost.to_str() + ";\n";
+            out << "score_t BishopPawns = " + TuneParams.BishopPawns.to_str() + ";\n";
+            out << "score_t BishopCenterControl = " + TuneParams.BishopCenterControl.to_str() + ";\n";
+            out << "score_t PieceSpace = " + TuneParams.PieceSpace.to_str() + ";\n";
+            out << "score_t EmptySpace = " + TuneParams.EmptySpace.to_str() + ";\n\n";
         }
         if (TuneAll || TuneThreats) {
-            out << "score_t PawnPush = " + PawnPush.to_str() + ";\n";
-            out << "score_t WeakPawns = " + WeakPawns.to_str() + ";\n";
-            out << "score_t PawnsxMinors = " + PawnsxMinors.to_str() + ";\n";
-            out << "score_t MinorsxMinors = " + MinorsxMinors.to_str() + ";\n";
-            out << "score_t MajorsxWeakMinors = " + MajorsxWeakMinors.to_str() + ";\n";
-            out << "score_t PawnsMinorsxMajors = " + PawnsMinorsxMajors.to_str() + ";\n";
-            out << "score_t AllxQueens = " + AllxQueens.to_str() + ";\n";
-            out << "score_t KingxMinors = " + KingxMinors.to_str() + ";\n";
-            out << "score_t KingxRooks = " + KingxRooks.to_str() + ";\n\n";
+            out << "score_t PawnPush = " + TuneParams.PawnPush.to_str() + ";\n";
+            out << "score_t WeakPawns = " + TuneParams.WeakPawns.to_str() + ";\n";
+            out << "score_t PawnsxMinors = " + TuneParams.PawnsxMinors.to_str() + ";\n";
+            out << "score_t MinorsxMinors = " + TuneParams.MinorsxMinors.to_str() + ";\n";
+            out << "score_t MajorsxWeakMinors = " + TuneParams.MajorsxWeakMinors.to_str() + ";\n";
+            out << "score_t PawnsMinorsxMajors = " + TuneParams.PawnsMinorsxMajors.to_str() + ";\n";
+            out << "score_t AllxQueens = " + TuneParams.AllxQueens.to_str() + ";\n";
+            out << "score_t KingxMinors = " + TuneParams.KingxMinors.to_str() + ";\n";
+            out << "score_t KingxRooks = " + TuneParams.KingxRooks.to_str() + ";\n\n";
         }
         if (TuneAll || TuneKingSafety) {
-            out << "basic_score_t KnightAtk = " << (int)std::round(KnightAtk) << ";\n";
-            out << "basic_score_t BishopAtk = " << (int)std::round(BishopAtk) << ";\n";
-            out << "basic_score_t RookAtk = " << (int)std::round(RookAtk) << ";\n";
-            out << "basic_score_t QueenAtk = " << (int)std::round(QueenAtk) << ";\n";
-            out << "basic_score_t KingZoneAttacks = " << (int)std::round(KingZoneAttacks) << ";\n";
-            out << "basic_score_t WeakSquares = " << (int)std::round(WeakSquares) << ";\n";
-            out << "basic_score_t EnemyPawns = " << (int)std::round(EnemyPawns) << ";\n";
-            out << "basic_score_t QueenSafeCheckValue = " << (int)std::round(QueenSafeCheckValue) << ";\n";
-            out << "basic_score_t RookSafeCheckValue = " << (int)std::round(RookSafeCheckValue) << ";\n";
-            out << "basic_score_t BishopSafeCheckValue = " << (int)std::round(BishopSafeCheckValue) << ";\n";
-            out << "basic_score_t KnightSafeCheckValue = " << (int)std::round(KnightSafeCheckValue) << ";\n";
-            out << "basic_score_t KingShelter1 = " << (int)std::round(KingShelter1) << ";\n";
-            out << "basic_score_t KingShelter2 = " << (int)std::round(KingShelter2) << ";\n";
-            out << "basic_score_t KingShelterF1 = " << (int)std::round(KingShelterF1) << ";\n";
-            out << "basic_score_t KingShelterF2 = " << (int)std::round(KingShelterF2) << ";\n";
-            out << "basic_score_t KingStorm1 = " << (int)std::round(KingStorm1) << ";\n";
-            out << "basic_score_t KingStorm2 = " << (int)std::round(KingStorm2) << ";\n\n";
+            out << "basic_score_t KnightAtk = " << (int)std::round(TuneParams.KnightAtk) << ";\n";
+            out << "basic_score_t BishopAtk = " << (int)std::round(TuneParams.BishopAtk) << ";\n";
+            out << "basic_score_t RookAtk = " << (int)std::round(TuneParams.RookAtk) << ";\n";
+            out << "basic_score_t QueenAtk = " << (int)std::round(TuneParams.QueenAtk) << ";\n";
+            out << "basic_score_t KingZoneAttacks = " << (int)std::round(TuneParams.KingZoneAttacks) << ";\n";
+            out << "basic_score_t WeakSquares = " << (int)std::round(TuneParams.WeakSquares) << ";\n";
+            out << "basic_score_t EnemyPawns = " << (int)std::round(TuneParams.EnemyPawns) << ";\n";
+            out << "basic_score_t QueenSafeCheckValue = " << (int)std::round(TuneParams.QueenSafeCheckValue) << ";\n";
+            out << "basic_score_t RookSafeCheckValue = " << (int)std::round(TuneParams.RookSafeCheckValue) << ";\n";
+            out << "basic_score_t BishopSafeCheckValue = " << (int)std::round(TuneParams.BishopSafeCheckValue) << ";\n";
+            out << "basic_score_t KnightSafeCheckValue = " << (int)std::round(TuneParams.KnightSafeCheckValue) << ";\n";
+            out << "basic_score_t KingShelter1 = " << (int)std::round(TuneParams.KingShelter1) << ";\n";
+            out << "basic_score_t KingShelter2 = " << (int)std::round(TuneParams.KingShelter2) << ";\n";
+            out << "basic_score_t KingShelterF1 = " << (int)std::round(TuneParams.KingShelterF1) << ";\n";
+            out << "basic_score_t KingShelterF2 = " << (int)std::round(TuneParams.KingShelterF2) << ";\n";
+            out << "basic_score_t KingStorm1 = " << (int)std::round(TuneParams.KingStorm1) << ";\n";
+            out << "basic_score_t KingStorm2 = " << (int)std::round(TuneParams.KingStorm2) << ";\n\n";
         }
         if (TuneAll || TunePhase) {
-            out << "basic_score_t KnightPhase = " << (int)std::round(KnightPhase) << ";\n";
-            out << "basic_score_t BishopPhase = " << (int)std::round(BishopPhase) << ";\n";
-            out << "basic_score_t RookPhase = " << (int)std::round(RookPhase) << ";\n";
-            out << "basic_score_t QueenPhase = " << (int)std::round(QueenPhase) << ";\n";
-            out << "basic_score_t Tempo = " << (int)std::round(Tempo) << ";\n\n";
+            out << "basic_score_t KnightPhase = " << (int)std::round(TuneParams.KnightPhase) << ";\n";
+            out << "basic_score_t BishopPhase = " << (int)std::round(TuneParams.BishopPhase) << ";\n";
+            out << "basic_score_t RookPhase = " << (int)std::round(TuneParams.RookPhase) << ";\n";
+            out << "basic_score_t QueenPhase = " << (int)std::round(TuneParams.QueenPhase) << ";\n";
+            out << "basic_score_t Tempo = " << (int)std::round(TuneParams.Tempo) << ";\n\n";
         }
     }
 
@@ -223,17 +418,146 @@ namespace Tuner {
         outfile.flush();
     }
 
-    void CalculateGradients(std::vector<double>& gradients, std::vector<TunerParam>& params,
-        std::vector<PositionResults>& data, size_t batchsize, double last) {
-        int k = 0;
-        for (auto& par : params) {
-            const basic_score_t oldvalue = par;
-            par = oldvalue + 2.0;
-            double ep1 = Error(data, batchsize);
-            gradients[k] = (ep1 - last) / 2.0;
-            par = oldvalue;
-            ++k;
+    std::vector<TracedPosition> Traces;
+    std::vector<TraceEntry> TraceEntries;
+
+    // a trace holds the mg/eg weights the phase weights gave, so tuning those needs fresh traces of every batch
+    bool IsPhaseWeight(const TunerParam& par) {
+        return par.val == &TuneParams.KnightPhase || par.val == &TuneParams.BishopPhase || par.val == &TuneParams.RookPhase || par.val == &TuneParams.QueenPhase;
+    }
+
+    double TracedScore(const TracedPosition& tp, std::vector<TunerParam>& params, double units[2],
+        const std::vector<TraceEntry>& entries = TraceEntries) {
+        double score = tp.constant;
+        for (uint32_t k = tp.linear; k < tp.safety[WHITE]; ++k) score += *params[entries[k].index].val * entries[k].weight;
+        for (int side = WHITE; side <= BLACK; ++side) {
+            units[side] = tp.safetybase[side];
+            for (uint32_t k = tp.safety[side]; k < (side == WHITE ? tp.safety[BLACK] : tp.phase); ++k)
+                units[side] += *params[entries[k].index].val * entries[k].weight;
+            if (units[side] > 0)
+                score += (side == WHITE ? 1 : -1) * (units[side] * units[side] / 1024 * tp.mgweight + units[side] / 20 * tp.egweight);
+        }
+        return score;
+    }
+
+    // one evaluation pass on the workers that records the traces of the first count positions at the current parameters
+    void TraceAll(std::vector<PositionResults>& data, size_t count, std::vector<TunerParam>& params) {
+        std::unordered_map<const double*, uint32_t> index;
+        for (uint32_t k = 0; k < params.size(); ++k) index[params[k].val] = k;
+        auto find = [&](const double* par) { auto it = index.find(par); return it == index.end() ? -1 : int(it->second); };
+        const double* phases[4] = { &TuneParams.KnightPhase, &TuneParams.BishopPhase, &TuneParams.RookPhase, &TuneParams.QueenPhase };
+        const double total = TuneParams.totalPhase();
+
+        Pool.run([&](int t) {
+            TunerWorker& w = *Workers[t];
+            eval_trace_t trace;
+            w.eval.trace = &trace;
+            w.traces.clear();
+            w.entries.clear();
+            for (size_t n = WorkBegin(count, t); n < WorkBegin(count, t + 1); ++n) {
+                PositionResults& d = data[n];
+                Unpack(*d.sample, w.pos);
+                trace = eval_trace_t();
+                const int sign = w.pos.side == WHITE ? 1 : -1;
+                const double score = w.eval.score(w.pos) * sign;
+                TracedPosition tp = {};
+                tp.mgweight = trace.mgweight;
+                tp.egweight = trace.egweight;
+                tp.linear = w.entries.size();
+                if (trace.general) {
+                    for (auto& term : trace.terms) {
+                        int k = find(&term.first->m);
+                        if (k >= 0) w.entries.push_back({ uint32_t(k), float(term.second * tp.mgweight) });
+                        k = find(&term.first->e);
+                        if (k >= 0) w.entries.push_back({ uint32_t(k), float(term.second * tp.egweight) });
+                    }
+                    const int k = find(&TuneParams.Tempo);
+                    if (k >= 0) w.entries.push_back({ uint32_t(k), float(sign) });
+                }
+                for (int side = WHITE; side <= BLACK; ++side) {
+                    tp.safety[side] = w.entries.size();
+                    for (auto& u : trace.safety[side]) {
+                        const int k = find(u.first);
+                        if (k >= 0) w.entries.push_back({ uint32_t(k), float(u.second) });
+                        else tp.safetybase[side] += *u.first * u.second;
+                    }
+                }
+                tp.phase = w.entries.size();
+                // score = mg x mgweight + eg x egweight + tempo, with mgweight = phase / total x scale / 32 and egweight
+                // the rest of scale / 32. Below the clamp a phase weight moves phase by the count of its pieces and
+                // total by its share of the starting material, at the clamp both move together and nothing changes
+                const double scaled = tp.mgweight + tp.egweight, ratio = scaled > 0 ? tp.mgweight / scaled : 1.0;
+                if (trace.general && ratio < 1.0) {
+                    const int shares[4] = { 4, 4, 4, 2 };
+                    for (int pc = KNIGHT; pc <= QUEEN; ++pc) {
+                        const int k = find(phases[pc - KNIGHT]);
+                        const double dmgweight = scaled * (Utils::bitCnt(w.pos.piecesBB[pc]) - ratio * shares[pc - KNIGHT]) / total;
+                        if (k >= 0) w.entries.push_back({ uint32_t(k), float((trace.mg - trace.eg) * dmgweight) });
+                    }
+                }
+                tp.end = w.entries.size();
+                double units[2];
+                tp.constant = score - TracedScore(tp, params, units, w.entries);
+                d.trace = w.traces.size();
+                w.traces.push_back(tp);
+            }
+            w.eval.trace = nullptr;
+        });
+
+        // join the workers' traces in order, shifting their indices by what the workers before them recorded
+        std::vector<size_t> tracebase(NumThreads + 1, 0), entrybase(NumThreads + 1, 0);
+        for (int t = 0; t < NumThreads; ++t) {
+            tracebase[t + 1] = tracebase[t] + Workers[t]->traces.size();
+            entrybase[t + 1] = entrybase[t] + Workers[t]->entries.size();
+        }
+        Traces.resize(tracebase[NumThreads]);
+        TraceEntries.resize(entrybase[NumThreads]);
+        Pool.run([&](int t) {
+            TunerWorker& w = *Workers[t];
+            const uint32_t shift = uint32_t(entrybase[t]);
+            std::copy(w.entries.begin(), w.entries.end(), TraceEntries.begin() + entrybase[t]);
+            for (size_t k = 0; k < w.traces.size(); ++k) {
+                TracedPosition tp = w.traces[k];
+                tp.linear += shift, tp.safety[WHITE] += shift, tp.safety[BLACK] += shift, tp.phase += shift, tp.end += shift;
+                Traces[tracebase[t] + k] = tp;
+            }
+            for (size_t n = WorkBegin(count, t); n < WorkBegin(count, t + 1); ++n) data[n].trace += tracebase[t];
+        });
+    }
+
+    // the error of the batch and its exact gradient for every tuned parameter, in one pass over the traces
+    double TracedGradients(std::vector<double>& gradients, std::vector<TunerParam>& params,
+        std::vector<PositionResults>& data, size_t batchsize) {
+        Pool.run([&](int t) {
+            TunerWorker& w = *Workers[t];
+            w.gradients.assign(params.size(), 0.0);
+            w.error = NeumaierSum();
+            for (size_t k = WorkBegin(batchsize, t); k < WorkBegin(batchsize, t + 1); ++k) {
+                const TracedPosition& tp = Traces[data[k].trace];
+                double units[2];
+                const double sigmoid = Sigmoid(TracedScore(tp, params, units));
+                const double diff = data[k].result() - sigmoid;
+                w.error.add(diff * diff);
+                // d(error)/d(score) through the sigmoid
+                const double derror = -2.0 * diff * sigmoid * (1.0 - sigmoid) * K * std::log(10.0) / 400.0;
+                for (uint32_t j = tp.linear; j < tp.safety[WHITE]; ++j) w.gradients[TraceEntries[j].index] += derror * TraceEntries[j].weight;
+                for (int side = WHITE; side <= BLACK; ++side) {
+                    if (units[side] <= 0) continue;
+                    const double dunits = (side == WHITE ? 1 : -1) * (2 * units[side] / 1024 * tp.mgweight + tp.egweight / 20);
+                    for (uint32_t j = tp.safety[side]; j < (side == WHITE ? tp.safety[BLACK] : tp.phase); ++j)
+                        w.gradients[TraceEntries[j].index] += derror * dunits * TraceEntries[j].weight;
+                }
+                for (uint32_t j = tp.phase; j < tp.end; ++j) w.gradients[TraceEntries[j].index] += derror * TraceEntries[j].weight;
+            }
+        });
+        NeumaierSum error;
+        for (size_t k = 0; k < params.size(); ++k) {
+            gradients[k] = 0.0;
+            for (auto& w : Workers) gradients[k] += w->gradients[k];
+            gradients[k] /= batchsize;
         }
+        for (auto& w : Workers) error.add(w->error.total());
+        return error.total() / batchsize;
     }
 
     void AdamDemonOptimizer(std::vector<TunerParam>& params, std::vector<PositionResults>& data, const size_t batchsize) {
@@ -250,40 +574,34 @@ namespace Tuner {
         FindBestK(data);
         PrintOutput() << "Best K " << K;
 
+        const bool retrace = std::any_of(params.begin(), params.end(), IsPhaseWeight);
+        if (!retrace) TraceAll(data, data.size(), params);
+
         for (int epoch = 1; epoch <= MaxEpoch; ++epoch) {
             uint64_t starttime = Utils::getTime();
             PrintOutput() << "\n\nEpoch = " << epoch;
             Randomize(data);
-
-            double baseError = Error(data, batchsize);
-            PrintOutput() << "Base Error: " << baseError;
+            if (retrace) TraceAll(data, batchsize, params);
 
             PrintOutput() << "Computing gradients...";
-            CalculateGradients(G, params, data, batchsize, baseError);
+            double baseError = TracedGradients(G, params, data, batchsize);
+            PrintOutput() << "Base Error: " << baseError;
 
             double decay = 1.0 - double(epoch) / double(MaxEpoch);
             double Beta1 = Beta1_ * decay / ((1.0 - Beta1_) + Beta1_ * decay);
             double Alpha = Alpha_ * sqrt(1.0 - pow(Beta2, epoch)) / (1.0 - pow(Beta1, epoch));
 
-            auto threaded = [&](size_t start, size_t end) {
-                for (size_t k = start; k < end; k += NumThreads) {
+            Pool.run([&](int t) {
+                for (size_t k = WorkBegin(params.size(), t); k < WorkBegin(params.size(), t + 1); ++k) {
                     double g = G[k];
                     M[k] = Beta1 * M[k] + (1.0 - Beta1) * g;
                     V[k] = Beta2 * V[k] + (1.0 - Beta2) * g * g;
                     double delta = Alpha * M[k] / (sqrt(V[k]) + Epsilon);
-                    //const basic_score_t oldpar = params[k];
+                    //const double oldpar = params[k];
                     params[k] = params[k] - delta;
                     //if (par != oldpar) PrintOutput() << par.name << "\t\t" << oldpar << " --> " << par;
                 }
-            };
-
-            std::thread threads[NumThreads];
-            for (int t = 0; t < NumThreads; ++t) {
-                threads[t] = std::thread(threaded, t, params.size());
-            }
-            for (int t = 0; t < NumThreads; ++t) {
-                threads[t].join();
-            }
+            });
 
             double currError = Error(data, batchsize);
             PrintOutput() << "Base error = " << baseError << " Current error = " << currError << " diff = " << (baseError - currError) * 10e6;
@@ -316,7 +634,7 @@ namespace Tuner {
                     ++k;
                     if (stability[k] >= 10) continue; // didn't change value in 5 epochs
                     for (int t = 0; t < 2; ++t) {
-                        basic_score_t oldpar = par;
+                        double oldpar = par;
                         par = oldpar + (direction[k] * stepsize[k]);
                         double error = Error(data, data.size());
                         if (error < currError) {
@@ -341,145 +659,145 @@ namespace Tuner {
 
     void DeclareParams(std::vector<TunerParam>& input) {
         if (TuneAll || TuneMaterial) {
-            //input.push_back({MaterialValues[PAWN].m, N(PawnVal.m"}); // peg to 100
-            input.push_back({ MaterialValues[PAWN].e, N(PawnVal.e) });
-            input.push_back({ MaterialValues[KNIGHT].m, N(KnightVal.m) });
-            input.push_back({ MaterialValues[KNIGHT].e, N(KnightVal.e) });
-            input.push_back({ MaterialValues[BISHOP].m, N(BishopVal.m) });
-            input.push_back({ MaterialValues[BISHOP].e, N(BishopVal.e) });
-            input.push_back({ MaterialValues[ROOK].m, N(RookVal.m) });
-            input.push_back({ MaterialValues[ROOK].e, N(RookVal.e) });
-            input.push_back({ MaterialValues[QUEEN].m, N(QueenVal.m) });
-            input.push_back({ MaterialValues[QUEEN].e, N(QueenVal.e) });
+            //input.push_back({TuneParams.MaterialValues[PAWN].m, N(PawnVal.m"}); // peg to 100
+            input.push_back({ TuneParams.MaterialValues[PAWN].e, N(PawnVal.e) });
+            input.push_back({ TuneParams.MaterialValues[KNIGHT].m, N(KnightVal.m) });
+            input.push_back({ TuneParams.MaterialValues[KNIGHT].e, N(KnightVal.e) });
+            input.push_back({ TuneParams.MaterialValues[BISHOP].m, N(BishopVal.m) });
+            input.push_back({ TuneParams.MaterialValues[BISHOP].e, N(BishopVal.e) });
+            input.push_back({ TuneParams.MaterialValues[ROOK].m, N(RookVal.m) });
+            input.push_back({ TuneParams.MaterialValues[ROOK].e, N(RookVal.e) });
+            input.push_back({ TuneParams.MaterialValues[QUEEN].m, N(QueenVal.m) });
+            input.push_back({ TuneParams.MaterialValues[QUEEN].e, N(QueenVal.e) });
         }
         if (TuneAll || Imbalance) {
             for (int pt1 = 0; pt1 <= QUEEN; ++pt1) {
                 for (int pt2 = 0; pt2 < pt1; ++pt2) {
-                    input.push_back({ ImbalanceInternal[pt1][pt2].m, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].m" });
-                    input.push_back({ ImbalanceInternal[pt1][pt2].e, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].e" });
-                    input.push_back({ ImbalanceExternal[pt1][pt2].m, "Theirs[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].m" });
-                    input.push_back({ ImbalanceExternal[pt1][pt2].e, "Theirs[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].e" });
+                    input.push_back({ TuneParams.ImbalanceInternal[pt1][pt2].m, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].m" });
+                    input.push_back({ TuneParams.ImbalanceInternal[pt1][pt2].e, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].e" });
+                    input.push_back({ TuneParams.ImbalanceExternal[pt1][pt2].m, "Theirs[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].m" });
+                    input.push_back({ TuneParams.ImbalanceExternal[pt1][pt2].e, "Theirs[" + std::to_string(pt1) + "][" + std::to_string(pt2) + "].e" });
                 }
-                input.push_back({ ImbalanceInternal[pt1][pt1].m, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt1) + "].m" });
-                input.push_back({ ImbalanceInternal[pt1][pt1].e, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt1) + "].e" });
+                input.push_back({ TuneParams.ImbalanceInternal[pt1][pt1].m, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt1) + "].m" });
+                input.push_back({ TuneParams.ImbalanceInternal[pt1][pt1].e, "Ours[" + std::to_string(pt1) + "][" + std::to_string(pt1) + "].e" });
             }
         }
 
         if (TuneAll || TuneMobility) {
             for (int cnt = 0; cnt < 9; ++cnt) {
-                input.push_back({ KnightMob[cnt].m, "KnightMob[" + std::to_string(cnt) + "].m" });
-                input.push_back({ KnightMob[cnt].e, "KnightMob[" + std::to_string(cnt) + "].e" });
+                input.push_back({ TuneParams.KnightMob[cnt].m, "KnightMob[" + std::to_string(cnt) + "].m" });
+                input.push_back({ TuneParams.KnightMob[cnt].e, "KnightMob[" + std::to_string(cnt) + "].e" });
             }
             for (int cnt = 0; cnt < 14; ++cnt) {
-                input.push_back({ BishopMob[cnt].m, "BishopMob[" + std::to_string(cnt) + "].m" });
-                input.push_back({ BishopMob[cnt].e, "BishopMob[" + std::to_string(cnt) + "].e" });
+                input.push_back({ TuneParams.BishopMob[cnt].m, "BishopMob[" + std::to_string(cnt) + "].m" });
+                input.push_back({ TuneParams.BishopMob[cnt].e, "BishopMob[" + std::to_string(cnt) + "].e" });
             }
             for (int cnt = 0; cnt < 15; ++cnt) {
-                input.push_back({ RookMob[cnt].m, "RookMob[" + std::to_string(cnt) + "].m" });
-                input.push_back({ RookMob[cnt].e, "RookMob[" + std::to_string(cnt) + "].e" });
+                input.push_back({ TuneParams.RookMob[cnt].m, "RookMob[" + std::to_string(cnt) + "].m" });
+                input.push_back({ TuneParams.RookMob[cnt].e, "RookMob[" + std::to_string(cnt) + "].e" });
             }
             for (int cnt = 0; cnt < 28; ++cnt) {
-                input.push_back({ QueenMob[cnt].m, "QueenMob[" + std::to_string(cnt) + "].m" });
-                input.push_back({ QueenMob[cnt].e, "QueenMob[" + std::to_string(cnt) + "].e" });
+                input.push_back({ TuneParams.QueenMob[cnt].m, "QueenMob[" + std::to_string(cnt) + "].m" });
+                input.push_back({ TuneParams.QueenMob[cnt].e, "QueenMob[" + std::to_string(cnt) + "].e" });
             }
         }
         if (TuneAll || TunePassedPawns) {
             for (int rank = 1; rank <= 6; ++rank) {
-                input.push_back({ PasserDistOwn[rank].m, "PasserDistOwn[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserDistOwn[rank].e, "PasserDistOwn[" + std::to_string(rank) + "].e" });
-                input.push_back({ PasserDistEnemy[rank].m, "PasserDistEnemy[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserDistEnemy[rank].e, "PasserDistEnemy[" + std::to_string(rank) + "].e" });
-                input.push_back({ PasserBonus[rank].m, "PasserBonus[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserBonus[rank].e, "PasserBonus[" + std::to_string(rank) + "].e" });
-                input.push_back({ PasserNotBlocked[rank].m, "PasserNotBlocked[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserNotBlocked[rank].e, "PasserNotBlocked[" + std::to_string(rank) + "].e" });
-                input.push_back({ PasserSafePush[rank].m, "PasserSafePush[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserSafePush[rank].e, "PasserSafePush[" + std::to_string(rank) + "].e" });
-                input.push_back({ PasserSafeProm[rank].m, "PasserSafeProm[" + std::to_string(rank) + "].m" });
-                input.push_back({ PasserSafeProm[rank].e, "PasserSafeProm[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserDistOwn[rank].m, "PasserDistOwn[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserDistOwn[rank].e, "PasserDistOwn[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserDistEnemy[rank].m, "PasserDistEnemy[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserDistEnemy[rank].e, "PasserDistEnemy[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserBonus[rank].m, "PasserBonus[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserBonus[rank].e, "PasserBonus[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserNotBlocked[rank].m, "PasserNotBlocked[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserNotBlocked[rank].e, "PasserNotBlocked[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserSafePush[rank].m, "PasserSafePush[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserSafePush[rank].e, "PasserSafePush[" + std::to_string(rank) + "].e" });
+                input.push_back({ TuneParams.PasserSafeProm[rank].m, "PasserSafeProm[" + std::to_string(rank) + "].m" });
+                input.push_back({ TuneParams.PasserSafeProm[rank].e, "PasserSafeProm[" + std::to_string(rank) + "].e" });
             }
         }
         if (TuneAll || TunePawnStructure) {
-            input.push_back({ PawnConnected.m, N(PawnConnected.m) });
-            input.push_back({ PawnConnected.e, N(PawnConnected.e) });
-            input.push_back({ PawnDoubled.m, N(PawnDoubled.m) });
-            input.push_back({ PawnDoubled.e, N(PawnDoubled.e) });
-            input.push_back({ PawnIsolated.m, N(PawnIsolated.m) });
-            input.push_back({ PawnIsolated.e, N(PawnIsolated.e) });
-            input.push_back({ PawnBackward.m, N(PawnBackward.m) });
-            input.push_back({ PawnBackward.e, N(PawnBackward.e) });
-            input.push_back({ PawnIsolatedOpen.m, N(PawnIsolatedOpen.m) });
-            input.push_back({ PawnIsolatedOpen.e, N(PawnIsolatedOpen.e) });
-            input.push_back({ PawnBackwardOpen.m, N(PawnBackwardOpen.m) });
-            input.push_back({ PawnBackwardOpen.e, N(PawnBackwardOpen.e) });
+            input.push_back({ TuneParams.PawnConnected.m, N(PawnConnected.m) });
+            input.push_back({ TuneParams.PawnConnected.e, N(PawnConnected.e) });
+            input.push_back({ TuneParams.PawnDoubled.m, N(PawnDoubled.m) });
+            input.push_back({ TuneParams.PawnDoubled.e, N(PawnDoubled.e) });
+            input.push_back({ TuneParams.PawnIsolated.m, N(PawnIsolated.m) });
+            input.push_back({ TuneParams.PawnIsolated.e, N(PawnIsolated.e) });
+            input.push_back({ TuneParams.PawnBackward.m, N(PawnBackward.m) });
+            input.push_back({ TuneParams.PawnBackward.e, N(PawnBackward.e) });
+            input.push_back({ TuneParams.PawnIsolatedOpen.m, N(PawnIsolatedOpen.m) });
+            input.push_back({ TuneParams.PawnIsolatedOpen.e, N(PawnIsolatedOpen.e) });
+            input.push_back({ TuneParams.PawnBackwardOpen.m, N(PawnBackwardOpen.m) });
+            input.push_back({ TuneParams.PawnBackwardOpen.e, N(PawnBackwardOpen.e) });
         }
         if (TuneAll || TuneActivity) {
-            input.push_back({ RookOn7th.m, N(RookOn7th.m) });
-            input.push_back({ RookOn7th.e, N(RookOn7th.e) });
-            input.push_back({ RookOnSemiOpenFile.m, N(RookOnSemiOpenFile.m) });
-            input.push_back({ RookOnSemiOpenFile.e, N(RookOnSemiOpenFile.e) });
-            input.push_back({ RookOnOpenFile.m, N(RookOnOpenFile.m) });
-            input.push_back({ RookOnOpenFile.e, N(RookOnOpenFile.e) });
-            input.push_back({ KnightOutpost.m, N(KnightOutpost.m) });
-            input.push_back({ KnightOutpost.e, N(KnightOutpost.e) });
-            input.push_back({ KnightXOutpost.m, N(KnightXOutpost.m) });
-            input.push_back({ KnightXOutpost.e, N(KnightXOutpost.e) });
-            input.push_back({ BishopOutpost.m, N(BishopOutpost.m) });
-            input.push_back({ BishopOutpost.e, N(BishopOutpost.e) });
-            input.push_back({ BishopPawns.m, N(BishopPawns.m) });
-            input.push_back({ BishopPawns.e, N(BishopPawns.e) });
-            input.push_back({ BishopCenterControl.m, N(BishopCenterControl.m) });
-            input.push_back({ BishopCenterControl.e, N(BishopCenterControl.e) });
-            input.push_back({ PieceSpace.m, N(PieceSpace.m) });
-            input.push_back({ PieceSpace.e, N(PieceSpace.e) });
-            input.push_back({ EmptySpace.m, N(EmptySpace.m) });
-            input.push_back({ EmptySpace.e, N(EmptySpace.e) });
+            input.push_back({ TuneParams.RookOn7th.m, N(RookOn7th.m) });
+            input.push_back({ TuneParams.RookOn7th.e, N(RookOn7th.e) });
+            input.push_back({ TuneParams.RookOnSemiOpenFile.m, N(RookOnSemiOpenFile.m) });
+            input.push_back({ TuneParams.RookOnSemiOpenFile.e, N(RookOnSemiOpenFile.e) });
+            input.push_back({ TuneParams.RookOnOpenFile.m, N(RookOnOpenFile.m) });
+            input.push_back({ TuneParams.RookOnOpenFile.e, N(RookOnOpenFile.e) });
+            input.push_back({ TuneParams.KnightOutpost.m, N(KnightOutpost.m) });
+            input.push_back({ TuneParams.KnightOutpost.e, N(KnightOutpost.e) });
+            input.push_back({ TuneParams.KnightXOutpost.m, N(KnightXOutpost.m) });
+            input.push_back({ TuneParams.KnightXOutpost.e, N(KnightXOutpost.e) });
+            input.push_back({ TuneParams.BishopOutpost.m, N(BishopOutpost.m) });
+            input.push_back({ TuneParams.BishopOutpost.e, N(BishopOutpost.e) });
+            input.push_back({ TuneParams.BishopPawns.m, N(BishopPawns.m) });
+            input.push_back({ TuneParams.BishopPawns.e, N(BishopPawns.e) });
+            input.push_back({ TuneParams.BishopCenterControl.m, N(BishopCenterControl.m) });
+            input.push_back({ TuneParams.BishopCenterControl.e, N(BishopCenterControl.e) });
+            input.push_back({ TuneParams.PieceSpace.m, N(PieceSpace.m) });
+            input.push_back({ TuneParams.PieceSpace.e, N(PieceSpace.e) });
+            input.push_back({ TuneParams.EmptySpace.m, N(EmptySpace.m) });
+            input.push_back({ TuneParams.EmptySpace.e, N(EmptySpace.e) });
         }
         if (TuneAll || TuneThreats) {
-            input.push_back({ PawnPush.m, N(PawnPush.m) });
-            input.push_back({ PawnPush.e, N(PawnPush.e) });
-            input.push_back({ WeakPawns.m, N(WeakPawns.m) });
-            input.push_back({ WeakPawns.e, N(WeakPawns.e) });
-            input.push_back({ PawnsxMinors.m, N(PawnsxMinors.m) });
-            input.push_back({ PawnsxMinors.e, N(PawnsxMinors.e) });
-            input.push_back({ MinorsxMinors.m, N(MinorsxMinors.m) });
-            input.push_back({ MinorsxMinors.e, N(MinorsxMinors.e) });
-            input.push_back({ MajorsxWeakMinors.m, N(MajorsxWeakMinors.m) });
-            input.push_back({ MajorsxWeakMinors.e, N(MajorsxWeakMinors.e) });
-            input.push_back({ PawnsMinorsxMajors.m, N(PawnsMinorsxMajors.m) });
-            input.push_back({ PawnsMinorsxMajors.e, N(PawnsMinorsxMajors.e) });
-            input.push_back({ AllxQueens.m, N(AllxQueens.m) });
-            input.push_back({ AllxQueens.e, N(AllxQueens.e) });
-            input.push_back({ KingxMinors.m, N(KingxMinors.m) });
-            input.push_back({ KingxMinors.e, N(KingxMinors.e) });
-            input.push_back({ KingxRooks.m, N(KingxRooks.m) });
-            input.push_back({ KingxRooks.e, N(KingxRooks.e) });
+            input.push_back({ TuneParams.PawnPush.m, N(PawnPush.m) });
+            input.push_back({ TuneParams.PawnPush.e, N(PawnPush.e) });
+            input.push_back({ TuneParams.WeakPawns.m, N(WeakPawns.m) });
+            input.push_back({ TuneParams.WeakPawns.e, N(WeakPawns.e) });
+            input.push_back({ TuneParams.PawnsxMinors.m, N(PawnsxMinors.m) });
+            input.push_back({ TuneParams.PawnsxMinors.e, N(PawnsxMinors.e) });
+            input.push_back({ TuneParams.MinorsxMinors.m, N(MinorsxMinors.m) });
+            input.push_back({ TuneParams.MinorsxMinors.e, N(MinorsxMinors.e) });
+            input.push_back({ TuneParams.MajorsxWeakMinors.m, N(MajorsxWeakMinors.m) });
+            input.push_back({ TuneParams.MajorsxWeakMinors.e, N(MajorsxWeakMinors.e) });
+            input.push_back({ TuneParams.PawnsMinorsxMajors.m, N(PawnsMinorsxMajors.m) });
+            input.push_back({ TuneParams.PawnsMinorsxMajors.e, N(PawnsMinorsxMajors.e) });
+            input.push_back({ TuneParams.AllxQueens.m, N(AllxQueens.m) });
+            input.push_back({ TuneParams.AllxQueens.e, N(AllxQueens.e) });
+            input.push_back({ TuneParams.KingxMinors.m, N(KingxMinors.m) });
+            input.push_back({ TuneParams.KingxMinors.e, N(KingxMinors.e) });
+            input.push_back({ TuneParams.KingxRooks.m, N(KingxRooks.m) });
+            input.push_back({ TuneParams.KingxRooks.e, N(KingxRooks.e) });
         }
         if (TuneAll || TuneKingSafety) {
-            input.push_back({ KnightAtk, N(KnightAtk) });
-            input.push_back({ BishopAtk, N(BishopAtk) });
-            input.push_back({ RookAtk, N(RookAtk) });
-            input.push_back({ QueenAtk, N(QueenAtk) });
-            input.push_back({ KingZoneAttacks, N(KingZoneAttacks) });
-            input.push_back({ WeakSquares, N(WeakSquares) });
-            input.push_back({ EnemyPawns, N(EnemyPawns) });
-            input.push_back({ QueenSafeCheckValue, N(QueenSafeCheckValue) });
-            input.push_back({ RookSafeCheckValue, N(RookSafeCheckValue) });
-            input.push_back({ BishopSafeCheckValue, N(BishopSafeCheckValue) });
-            input.push_back({ KnightSafeCheckValue, N(KnightSafeCheckValue) });
-            input.push_back({ KingShelter1, N(KingShelter1) });
-            input.push_back({ KingShelter2, N(KingShelter2) });
-            input.push_back({ KingShelterF1, N(KingShelterF1) });
-            input.push_back({ KingShelterF2, N(KingShelterF2) });
-            input.push_back({ KingStorm1, N(KingStorm1) });
-            input.push_back({ KingStorm2, N(KingStorm2) });
+            input.push_back({ TuneParams.KnightAtk, N(KnightAtk) });
+            input.push_back({ TuneParams.BishopAtk, N(BishopAtk) });
+            input.push_back({ TuneParams.RookAtk, N(RookAtk) });
+            input.push_back({ TuneParams.QueenAtk, N(QueenAtk) });
+            input.push_back({ TuneParams.KingZoneAttacks, N(KingZoneAttacks) });
+            input.push_back({ TuneParams.WeakSquares, N(WeakSquares) });
+            input.push_back({ TuneParams.EnemyPawns, N(EnemyPawns) });
+            input.push_back({ TuneParams.QueenSafeCheckValue, N(QueenSafeCheckValue) });
+            input.push_back({ TuneParams.RookSafeCheckValue, N(RookSafeCheckValue) });
+            input.push_back({ TuneParams.BishopSafeCheckValue, N(BishopSafeCheckValue) });
+            input.push_back({ TuneParams.KnightSafeCheckValue, N(KnightSafeCheckValue) });
+            input.push_back({ TuneParams.KingShelter1, N(KingShelter1) });
+            input.push_back({ TuneParams.KingShelter2, N(KingShelter2) });
+            input.push_back({ TuneParams.KingShelterF1, N(KingShelterF1) });
+            input.push_back({ TuneParams.KingShelterF2, N(KingShelterF2) });
+            input.push_back({ TuneParams.KingStorm1, N(KingStorm1) });
+            input.push_back({ TuneParams.KingStorm2, N(KingStorm2) });
         }
         if (TuneAll || TunePhase) {
-            input.push_back({ KnightPhase, N(KnightPhase) });
-            input.push_back({ BishopPhase, N(BishopPhase) });
-            input.push_back({ RookPhase, N(RookPhase) });
-            input.push_back({ QueenPhase, N(QueenPhase) });
-            input.push_back({ Tempo, N(Tempo) });
+            input.push_back({ TuneParams.KnightPhase, N(KnightPhase) });
+            input.push_back({ TuneParams.BishopPhase, N(BishopPhase) });
+            input.push_back({ TuneParams.RookPhase, N(RookPhase) });
+            input.push_back({ TuneParams.QueenPhase, N(QueenPhase) });
+            input.push_back({ TuneParams.Tempo, N(Tempo) });
         }
     }
 
@@ -491,22 +809,39 @@ namespace Tuner {
         return 0.5;
     }
 
-    void Tune(const std::string& filename) {
+    // converts a text file of "fen|result" lines into a packed sample file
+    void PackFile(const std::string& textname, const std::string& binname) {
+        std::ifstream file(textname);
+        if (!file) {
+            PrintOutput() << "File not found = " << textname;
+            return;
+        }
+        std::ofstream out(binname, std::ios::binary);
+        out.write(PackedMagic, sizeof(PackedMagic));
+        position_t pos;
+        PackedSample sample;
+        size_t count = 0;
+        for (std::string line; getline(file, line);) {
+            pos.setPosition(line);
+            Pack(pos, getResult(line.substr(line.find("|") + 1)), sample);
+            out.write((const char*)&sample, sizeof(sample));
+            if (++count % 1000000 == 0) PrintOutput() << "Packed: " << count << " entries!";
+        }
+        PrintOutput() << "Packed " << count << " entries into " << binname;
+    }
+
+    void Tune(const std::string& filename, int threads) {
         std::vector<PositionResults> data;
         std::vector<TunerParam> input;
 
-        PrintOutput() << "Tuning with file = " << filename;
-        std::ifstream file = std::ifstream(filename);
-        if (!file) {
-            PrintOutput() << "File not found = " << filename;
+        PrintOutput() << "Tuning with file = " << filename << " threads = " << threads;
+        SampleFile file;
+        if (!file.map(filename)) {
+            PrintOutput() << "Cannot map file = " << filename;
             return;
         }
-        std::string line;
-        while (getline(file, line)) {
-            data.push_back({ new position_t(line), getResult(line.substr(line.find("|") + 1)) });
-            if (data.size() % 100000 == 0) PrintOutput() << "Processed: " << data.size() << " entries!";
-        }
-        file.close();
+        data.reserve(file.count);
+        for (size_t k = 0; k < file.count; ++k) data.push_back({ &file.samples[k], 0 });
         PrintOutput() << "Data size : " << data.size();
 
         //size_t batchSize = data.size();
@@ -515,13 +850,11 @@ namespace Tuner {
         //size_t batchSize = 8192;
 
         DeclareParams(input);
+        StartWorkers(threads);
 
-        //AdamDemonOptimizer(input, data, batchSize);
-        LocalSearch(input, data);
+        AdamDemonOptimizer(input, data, batchSize);
+        //LocalSearch(input, data);
 
         PrintOutput() << "\nTuning finished: see tuned.txt file!!!\n";
-
-        for (auto &d : data) delete d.p;
     }
 }
-#endif
\ No newline at end of file
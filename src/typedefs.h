@@ -18,10 +18,14 @@
 #include <sstream>
 #include <string>
 
-//#define TUNE
 //#define DEBUG
-//#define NOPOPCNT
-#define USE_PEXT
+#define USE_PEXT // also build the pext slider tables, used when the cpu has fast bmi2
+//#define USE_PEXT16 // compact 16-bit slider tables, needs USE_PEXT
+//#define USE_KOGGE_STONE // eval attack maps from avx2 set-wise fills when the cpu has avx2
+
+#if defined(USE_PEXT16) && !defined(USE_PEXT)
+#error "USE_PEXT16 needs USE_PEXT"
+#endif
 
 #ifdef DEBUG
 #define ASSERT(a) if (!(a)) \
@@ -65,6 +69,7 @@ const std::string StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq
 const int MAXPLY = 127;
 const int MAXPLYSIZE = 128;
 const int MATE = 32750;
+const int TBWIN = MATE - MAXPLY - 1; // tablebase wins score TBWIN - ply, below every mate score
 const int NOVALUE = -32751;
 
 enum Square {
@@ -136,37 +141,71 @@ struct container_t : public std::array<T, capacity> {
 template<int N>
 struct movelist_t : public container_t<move_t, N> {};
 
-#ifdef TUNE
-typedef double basic_score_t;
-#else
 typedef int16_t basic_score_t;
-#endif
 
+// midgame and endgame halves packed in one int, endgame in the upper 16 bits, so sums and scaling by
+// an int are a single operation. Either half must stay within basic_score_t
 struct score_t {
-    score_t() : m(0), e(0) {};
-    score_t(basic_score_t mm, basic_score_t ee) : m(mm), e(ee) {}
-    inline score_t operator+(const score_t &d) { return score_t(m + d.m, e + d.e); }
-    inline score_t operator-(const score_t &d) { return score_t(m - d.m, e - d.e); }
-    inline score_t operator/(const score_t &d) { return score_t(m / d.m, e / d.e); }
-    inline score_t operator*(const score_t &d) { return score_t(m * d.m, e * d.e); }
-    inline score_t operator+(const basic_score_t x) { return score_t(m + x, e + x); }
-    inline score_t operator-(const basic_score_t x) { return score_t(m - x, e - x); }
-    inline score_t operator/(const basic_score_t x) { return score_t(m / x, e / x); }
-    inline score_t operator*(const basic_score_t x) { return score_t(m * x, e * x); }
-    inline score_t& operator+=(const score_t &d) { m += d.m, e += d.e; return *this; }
-    inline score_t& operator-=(const score_t &d) { m -= d.m, e -= d.e; return *this; }
-    inline score_t& operator/=(const score_t &d) { m /= d.m, e /= d.e; return *this; }
-    inline score_t& operator*=(const score_t &d) { m *= d.m, e *= d.e; return *this; }
-    inline score_t& operator+=(const basic_score_t x) { m += x, e += x; return *this; }
-    inline score_t& operator-=(const basic_score_t x) { m -= x, e -= x; return *this; }
-    inline score_t& operator/=(const basic_score_t x) { m /= x, e /= x; return *this; }
-    inline score_t& operator*=(const basic_score_t x) { m *= x, e *= x; return *this; }
-    inline bool operator==(const score_t &d) { return (d.e == e) && (d.m == m); }
+    typedef basic_score_t basic_t;
+    constexpr score_t() : v(0) {}
+    constexpr score_t(int mm, int ee) : v((int32_t)((uint32_t)ee << 16) + mm) {}
+    inline score_t operator+(const score_t &d) const { return raw(v + d.v); }
+    inline score_t operator-(const score_t &d) const { return raw(v - d.v); }
+    inline score_t operator/(const score_t &d) const { return score_t(mg() / d.mg(), eg() / d.eg()); }
+    inline score_t operator*(const score_t &d) const { return score_t(mg() * d.mg(), eg() * d.eg()); }
+    inline score_t operator+(const basic_score_t x) const { return score_t(mg() + x, eg() + x); }
+    inline score_t operator-(const basic_score_t x) const { return score_t(mg() - x, eg() - x); }
+    inline score_t operator/(const basic_score_t x) const { return score_t(mg() / x, eg() / x); }
+    inline score_t operator*(const int x) const { return raw(v * x); }
+    inline score_t& operator+=(const score_t &d) { v += d.v; return *this; }
+    inline score_t& operator-=(const score_t &d) { v -= d.v; return *this; }
+    inline score_t& operator/=(const score_t &d) { return *this = *this / d; }
+    inline score_t& operator*=(const score_t &d) { return *this = *this * d; }
+    inline score_t& operator+=(const basic_score_t x) { return *this = *this + x; }
+    inline score_t& operator-=(const basic_score_t x) { return *this = *this - x; }
+    inline score_t& operator/=(const basic_score_t x) { return *this = *this / x; }
+    inline score_t& operator*=(const int x) { v *= x; return *this; }
+    inline bool operator==(const score_t &d) const { return v == d.v; }
+    inline std::string to_str() {
+        return  "{" + std::to_string(mg()) + ", " + std::to_string(eg()) + "}";
+    }
+    constexpr basic_score_t mg() const { return (int16_t)(uint16_t)(uint32_t)v; }
+    // the carry of a negative midgame half is taken back by rounding
+    constexpr basic_score_t eg() const { return (int16_t)(uint16_t)((uint32_t)(v + 0x8000) >> 16); }
+    static inline score_t raw(int32_t x) { score_t s; s.v = x; return s; }
+    int32_t v;
+};
+
+// the tuner's score, in double precision so gradient steps smaller than a centipawn accumulate
+struct tune_score_t {
+    typedef double basic_t;
+    tune_score_t() : m(0), e(0) {};
+    tune_score_t(double mm, double ee) : m(mm), e(ee) {}
+    explicit tune_score_t(const score_t& s) : m(s.mg()), e(s.eg()) {}
+    inline tune_score_t operator+(const tune_score_t &d) const { return tune_score_t(m + d.m, e + d.e); }
+    inline tune_score_t operator-(const tune_score_t &d) const { return tune_score_t(m - d.m, e - d.e); }
+    inline tune_score_t operator/(const tune_score_t &d) const { return tune_score_t(m / d.m, e / d.e); }
+    inline tune_score_t operator*(const tune_score_t &d) const { return tune_score_t(m * d.m, e * d.e); }
+    inline tune_score_t operator+(const double x) const { return tune_score_t(m + x, e + x); }
+    inline tune_score_t operator-(const double x) const { return tune_score_t(m - x, e - x); }
+    inline tune_score_t operator/(const double x) const { return tune_score_t(m / x, e / x); }
+    inline tune_score_t operator*(const double x) const { return tune_score_t(m * x, e * x); }
+    inline tune_score_t& operator+=(const tune_score_t &d) { m += d.m, e += d.e; return *this; }
+    inline tune_score_t& operator-=(const tune_score_t &d) { m -= d.m, e -= d.e; return *this; }
+    inline tune_score_t& operator/=(const tune_score_t &d) { m /= d.m, e /= d.e; return *this; }
+    inline tune_score_t& operator*=(const tune_score_t &d) { m *= d.m, e *= d.e; return *this; }
+    inline tune_score_t& operator+=(const double x) { m += x, e += x; return *this; }
+    inline tune_score_t& operator-=(const double x) { m -= x, e -= x; return *this; }
+    inline tune_score_t& operator/=(const double x) { m /= x, e /= x; return *this; }
+    inline tune_score_t& operator*=(const double x) { m *= x, e *= x; return *this; }
+    inline bool operator==(const tune_score_t &d) const { return (d.e == e) && (d.m == m); }
+    inline double mg() const { return m; }
+    inline double eg() const { return e; }
     inline std::string to_str() {
         return  "{" + std::to_string((int)std::round(m)) + ", " + std::to_string((int)std::round(e)) + "}";
     }
-    basic_score_t m;
-    basic_score_t e;
+    double m;
+    double e;
 };
 
 class spinlock_t {
@@ -184,11 +223,33 @@ private:
     std::atomic_flag mLock = ATOMIC_FLAG_INIT;
 };
 
-struct material_t {
-    score_t value;
+struct position_t;
+// a specialised evaluator of a material signature, from the view of the strong side, see endgame.h
+typedef basic_score_t(*endgame_fn)(position_t& p, int strong);
+
+// what a material signature decides apart from its score, the same for every score type. Kept to
+// 4 bytes so a material table entry of score_t stays 16 bytes
+struct material_info_t {
     int16_t phase;
-    int16_t flags;
+    uint8_t flags; // 1: drawn, 2: scaled to 1/32, 4: black is the strong side of the ending
+    uint8_t ending; // index of the specialised evaluator in Endgames::Evaluators, 0 for none
+    int strong() const { return (flags >> 2) & 1; }
+};
+
+template<typename S>
+struct basic_material_t : material_info_t {
+    S value;
+};
+typedef basic_material_t<score_t> material_t;
+
+// instruction set levels selected at startup from cpuid, each one includes the ones before it. A path is
+// a level, plus CPU_MAGICS where pext is too slow for the slider lookups, so the sliders stay on magics
+enum CpuPaths {
+    CPU_GENERIC, CPU_POPCNT, CPU_BMI2, CPU_AVX2,
+    CPU_MAGICS = 4
 };
+constexpr int cpuLevel(int path) { return path & 3; }
+constexpr bool pextSliders(int path) { return cpuLevel(path) >= CPU_BMI2 && !(path & CPU_MAGICS); }
 
 enum LogLevel {
     logIN, logOUT, logINFO
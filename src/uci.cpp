@@ -8,28 +8,45 @@
 #include "utils.h"
 #include "uci.h"
 #include "search.h"
+#include "movepicker.h"
 #include "attacks.h"
 #include "eval.h"
 #include "params.h"
 #include "tune.h"
+#include "nnue.h"
+#include "tbprobe.h"
+#include "bitbase.h"
+
+#include <random>
 
 const std::string uci_t::name = "Invictus";
 const std::string uci_t::author = "Edsel Apostol";
 const std::string uci_t::year = "2021";
 const std::string uci_t::version = "r391";
 
+const std::vector<std::string> uci_t::BenchPositions = {
+    "r3k2r/pbpnqp2/1p1ppn1p/6p1/2PP4/2PBPNB1/P4PPP/R2Q1RK1 w kq - 2 12",
+    "2kr3r/pbpn1pq1/1p3n2/3p1R2/3P3p/2P2Q2/P1BN2PP/R3B2K w - - 4 22",
+    "r2n1rk1/1pq2ppp/p2pbn2/8/P3Pp2/2PBB2P/2PNQ1P1/1R3RK1 w - - 0 17",
+    "1r2r2k/1p4qp/p3bp2/4p2R/n3P3/2PB4/2PB1QPK/1R6 w - - 1 32",
+    "1b3r1k/rb1q3p/pp2pppP/3n1n2/1P2N3/P2B1NPQ/1B3P2/2R1R1K1 b - - 1 32",
+    "1r1r1qk1/pn1p2p1/1pp1npBp/8/2PB2QP/4R1P1/P4PK1/3R4 w - - 0 1",
+    "3rr1k1/1b2nnpp/1p1q1p2/pP1p1P2/P1pP2P1/2N1P1QP/3N1RB1/2R3K1 w - - 0 1",
+    "r1bqk1nr/ppp2pbp/2n1p1p1/7P/3Pp3/2N2N2/PPP2PP1/R1BQKB1R w KQkq - 0 7",
+    "1r3rk1/3bb1pp/1qn1p3/3pP3/3P1N2/2Q2N2/2P3PP/R1BR3K w - - 0 1",
+    "rn1q1rk1/2pbb3/pn2p3/1p1pPpp1/3P4/1PNBBN2/P1P1Q1PP/R4R1K w - - 0 1"
+};
+
 void uci_t::info() {
     LogAndPrintOutput() << name << " " << version;
     LogAndPrintOutput() << "Copyright (C) " << year << " " << author;
+    LogAndPrintOutput() << "info string cpu path: " << Utils::cpuPathName() << ", sliders: " << Attacks::sliderBackend();
     LogAndPrintOutput() << "Use UCI commands\n";
 }
 
 uci_t::uci_t() {
     std::cout.setf(std::ios::unitbuf);
-    Attacks::initArr();
-    PositionData::initArr();
     EvalParam::initArr();
-    EvalParam::initMaterial();
     Search::initArr();
     //EvalParam::displayPST();
     engine.origpos.setPosition(StartFEN);
@@ -63,7 +80,14 @@ bool uci_t::input(iss& stream) {
     else if (cmd == "moves") moves();
     else if (cmd == "d") displaypos();
     else if (cmd == "speedup") speedup(stream);
-    else if (cmd == "tune") tune();
+    else if (cmd == "bench") bench(stream);
+    else if (cmd == "evalbench") evalbench(stream);
+    else if (cmd == "evalfile") evalfile(stream);
+    else if (cmd == "tbverify") tbverify(stream);
+    else if (cmd == "pickbench") pickbench(stream);
+    else if (cmd == "sliderbench") sliderbench(stream);
+    else if (cmd == "tune") tune(stream);
+    else if (cmd == "tunepack") tunepack(stream);
     else if (cmd == "see") see();
     else LogAndPrintOutput() << "Invalid cmd: " << cmd;
 
@@ -91,6 +115,7 @@ void uci_t::ponderhit() {
 }
 
 void uci_t::isready() {
+    Bitbases::init(); // the gui waits for readyok anyway, better here than in the first search that needs them
     LogAndPrintOutput() << "readyok";
 }
 
@@ -167,10 +192,21 @@ void uci_t::newgame() {
 
 uci_t::~uci_t() {}
 
-void uci_t::tune() {
-#ifdef TUNE
-    Tuner::Tune("lichess-quiet.txt");
-#endif
+// tune [packed file] [threads], the file made by tunepack
+void uci_t::tune(iss& stream) {
+    std::string filename = "lichess-quiet.bin";
+    int threads;
+    stream >> filename;
+    if (!(stream >> threads)) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = Utils::clampThreads(threads);
+    Tuner::Tune(filename, threads);
+}
+
+// tunepack <text file> <packed file>: converts "fen|result" lines into the packed format tune maps
+void uci_t::tunepack(iss& stream) {
+    std::string textname, binname;
+    stream >> textname >> binname;
+    Tuner::PackFile(textname, binname);
 }
 
 void uci_t::see() {
@@ -264,18 +300,6 @@ void uci_t::displaypos() {
 
 void uci_t::speedup(iss& stream) {
     iss streamcmd;
-    std::vector<std::string> fenPos = {
-        "r3k2r/pbpnqp2/1p1ppn1p/6p1/2PP4/2PBPNB1/P4PPP/R2Q1RK1 w kq - 2 12",
-        "2kr3r/pbpn1pq1/1p3n2/3p1R2/3P3p/2P2Q2/P1BN2PP/R3B2K w - - 4 22",
-        "r2n1rk1/1pq2ppp/p2pbn2/8/P3Pp2/2PBB2P/2PNQ1P1/1R3RK1 w - - 0 17",
-        "1r2r2k/1p4qp/p3bp2/4p2R/n3P3/2PB4/2PB1QPK/1R6 w - - 1 32",
-        "1b3r1k/rb1q3p/pp2pppP/3n1n2/1P2N3/P2B1NPQ/1B3P2/2R1R1K1 b - - 1 32",
-        "1r1r1qk1/pn1p2p1/1pp1npBp/8/2PB2QP/4R1P1/P4PK1/3R4 w - - 0 1",
-        "3rr1k1/1b2nnpp/1p1q1p2/pP1p1P2/P1pP2P1/2N1P1QP/3N1RB1/2R3K1 w - - 0 1",
-        "r1bqk1nr/ppp2pbp/2n1p1p1/7P/3Pp3/2N2N2/PPP2PP1/R1BQKB1R w KQkq - 0 7",
-        "1r3rk1/3bb1pp/1qn1p3/3pP3/3P1N2/2Q2N2/2P3PP/R1BR3K w - - 0 1",
-        "rn1q1rk1/2pbb3/pn2p3/1p1pPpp1/3P4/1PNBBN2/P1P1Q1PP/R4R1K w - - 0 1"
-    };
 
     std::vector<int> threads;
     int depth;
@@ -286,8 +310,8 @@ void uci_t::speedup(iss& stream) {
     std::vector<double> timeSpeedupSum(threads.size(), 0.0);
     std::vector<double> nodesSpeedupSum(threads.size(), 0.0);
 
-    for (size_t idxpos = 0; idxpos < fenPos.size(); ++idxpos) {
-        LogAndPrintOutput() << "\n\nPos#" << idxpos + 1 << ": " << fenPos[idxpos];
+    for (size_t idxpos = 0; idxpos < BenchPositions.size(); ++idxpos) {
+        LogAndPrintOutput() << "\n\nPos#" << idxpos + 1 << ": " << BenchPositions[idxpos];
         uint64_t nodes1 = 0;
         uint64_t spentTime1 = 0;
         for (size_t idxthread = 0; idxthread < threads.size(); ++idxthread) {
@@ -295,7 +319,7 @@ void uci_t::speedup(iss& stream) {
             setoption(streamcmd);
             newgame();
 
-            streamcmd = iss("fen " + fenPos[idxpos]);
+            streamcmd = iss("fen " + BenchPositions[idxpos]);
             positioncmd(streamcmd);
 
             uint64_t startTime = Utils::getTime();
@@ -331,11 +355,290 @@ void uci_t::speedup(iss& stream) {
         }
     }
     LogAndPrintOutput() << "\n\n";
-    LogAndPrintOutput() << "Threads: " << std::to_string(threads[0]) << " time: " << std::to_string(timeSpeedupSum[0] / fenPos.size()) << "s, "
-        << std::to_string(nodesSpeedupSum[0] / fenPos.size()) << "knps";
+    LogAndPrintOutput() << "Threads: " << std::to_string(threads[0]) << " time: " << std::to_string(timeSpeedupSum[0] / BenchPositions.size()) << "s, "
+        << std::to_string(nodesSpeedupSum[0] / BenchPositions.size()) << "knps";
     for (size_t idxthread = 1; idxthread < threads.size(); ++idxthread) {
         LogAndPrintOutput() << "Threads: " << std::to_string(threads[idxthread])
-            << " time: " << std::to_string(timeSpeedupSum[idxthread] / fenPos.size()) << " nodes: " << std::to_string(nodesSpeedupSum[idxthread] / fenPos.size());
+            << " time: " << std::to_string(timeSpeedupSum[idxthread] / BenchPositions.size()) << " nodes: " << std::to_string(nodesSpeedupSum[idxthread] / BenchPositions.size());
     }
     LogAndPrintOutput() << "\n\n";
-}
\ No newline at end of file
+}
+
+void uci_t::bench(iss& stream) {
+    iss streamcmd;
+    int depth = 13;
+    stream >> depth;
+
+    streamcmd = iss("name Threads value 1");
+    setoption(streamcmd);
+
+    uint64_t totalnodes = 0;
+    uint64_t totaltime = 0;
+    for (auto& fen : BenchPositions) {
+        newgame();
+        streamcmd = iss("fen " + fen);
+        positioncmd(streamcmd);
+
+        uint64_t startTime = Utils::getTime();
+        streamcmd = iss("depth " + std::to_string(depth));
+        gocmd(streamcmd);
+        engine.waitForThreads();
+
+        totaltime += Utils::getTime() - startTime;
+        totalnodes += engine.nodesearched();
+    }
+    LogAndPrintOutput() << "\nnodes: " << totalnodes << " time: " << totaltime << " ms NPS: " << (totalnodes * 1000 / (totaltime + 1));
+}
+
+std::vector<position_t> uci_t::benchPositionsAndChildren() {
+    std::vector<position_t> positions;
+    for (auto& fen : BenchPositions) {
+        movelist_t<220> ml;
+        undo_t undo;
+        int ply = 0;
+        position_t pos(fen);
+        positions.push_back(pos);
+        pos.genLegal(ml);
+        for (move_t m : ml) {
+            pos.doMove(undo, m, ply);
+            positions.push_back(pos);
+            pos.undoMove(undo, ply);
+        }
+    }
+    return positions;
+}
+
+void uci_t::evalbench(iss& stream) {
+    int iterations = 10000;
+    stream >> iterations;
+
+    std::vector<position_t> positions = benchPositionsAndChildren();
+    eval_t eval;
+    int64_t checksum = 0;
+    uint64_t startTime = Utils::getTime();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto& pos : positions) checksum += eval.score(pos);
+    }
+    uint64_t spentTime = Utils::getTime() - startTime;
+    uint64_t evals = uint64_t(iterations) * positions.size();
+    LogAndPrintOutput() << "positions: " << positions.size() << " evals: " << evals << " checksum: " << checksum
+        << " time: " << spentTime << " ms evals/sec: " << (evals * 1000 / (spentTime + 1));
+    if (!NNUE::Enabled) return;
+
+    // make, evaluate and unmake every legal move the way search reaches its nodes, so the network
+    // pays for its incremental accumulator updates and not for full refreshes
+    std::vector<position_t> roots(BenchPositions.begin(), BenchPositions.end());
+    std::vector<NNUE::accumulator_t> accstack(2);
+    for (int nnue = 0; nnue < 2; ++nnue) {
+        checksum = evals = 0;
+        startTime = Utils::getTime();
+        for (int i = 0; i < iterations; ++i) {
+            for (auto& pos : roots) {
+                movelist_t<220> ml;
+                undo_t undo;
+                int ply = 0;
+                pos.genLegal(ml);
+                if (nnue) NNUE::refresh(pos, *(pos.acc = &accstack[0]));
+                for (move_t m : ml) {
+                    pos.doMove(undo, m, ply);
+                    checksum += nnue ? NNUE::evaluate(pos) : eval.score(pos);
+                    pos.undoMove(undo, ply);
+                }
+                pos.acc = nullptr;
+                evals += ml.size;
+            }
+        }
+        spentTime = Utils::getTime() - startTime;
+        LogAndPrintOutput() << (nnue ? "nnue" : "hce ") << " make/eval/unmake: " << evals << " checksum: " << checksum
+            << " time: " << spentTime << " ms evals/sec: " << (evals * 1000 / (spentTime + 1));
+    }
+}
+
+// evalfile <fenfile> [threads] [scorefile]: scores every fen in the file from the side to move and
+// writes one score per line when a score file is given
+void uci_t::evalfile(iss& stream) {
+    std::string filename, outname;
+    int threads;
+    stream >> filename;
+    if (!(stream >> threads)) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = Utils::clampThreads(threads);
+    stream >> outname;
+
+    std::ifstream infile(filename);
+    if (!infile) {
+        LogAndPrintOutput() << "File not found = " << filename;
+        return;
+    }
+    std::ofstream outfile;
+    if (!outname.empty()) outfile.open(outname);
+
+    // the file is read a chunk at a time, the next one while the threads parse and score the current one
+    const size_t ChunkLines = 1 << 16;
+    auto readChunk = [&](std::vector<std::string>& lines) {
+        lines.clear();
+        for (std::string line; lines.size() < ChunkLines && std::getline(infile, line);) {
+            if (!line.empty()) lines.push_back(line);
+        }
+    };
+    std::vector<std::string> chunk, next;
+    std::vector<basic_score_t> scores;
+    size_t count = 0;
+    uint64_t startTime = Utils::getTime();
+    for (readChunk(chunk); !chunk.empty(); std::swap(chunk, next)) {
+        scores.resize(chunk.size());
+        std::thread scorer([&] { scoreBatch(chunk.data(), scores.data(), chunk.size(), threads); });
+        readChunk(next);
+        scorer.join();
+        count += chunk.size();
+        if (outfile) for (auto score : scores) outfile << score << "\n";
+    }
+    uint64_t spentTime = Utils::getTime() - startTime;
+    LogAndPrintOutput() << "positions: " << count << " threads: " << threads
+        << " time: " << spentTime << " ms evals/sec: " << (count * 1000 / (spentTime + 1)) << " (reading and parsing included)";
+}
+
+// tbverify <material> [count] [outfile], e.g. tbverify KRPvKR 500: probes random legal positions of the
+// material and checks that each wdl is the best of the wdls after its moves, 50 move rule aside, and
+// that the dtz agrees with it. The outfile gets "fen wdl dtz" lines to compare with another prober.
+// It is only meaningful on the real tables: run it for every 3-5 man material of a complete set, where
+// the tables are consistent, so any mismatch is the prober's
+void uci_t::tbverify(iss& stream) {
+    static const std::string PieceChars = "PNBRQK";
+    std::string material, outname;
+    int count = 500;
+    stream >> material >> count >> outname;
+    const size_t split = material.find('v');
+    if (split == std::string::npos || material.find_first_not_of(PieceChars + "v") != std::string::npos) {
+        LogAndPrintOutput() << "Invalid material = " << material;
+        return;
+    }
+    if (!Tablebases::MaxCardinality) {
+        LogAndPrintOutput() << "No tablebases found, set SyzygyPath first";
+        return;
+    }
+    auto sign = [](int v) { return (v > 0) - (v < 0); };
+    std::ofstream outfile;
+    if (!outname.empty()) outfile.open(outname);
+
+    std::mt19937_64 rng(count);
+    int checked = 0, skipped = 0, mismatches = 0;
+    for (int tries = 0; checked < count && tries < count * 100; ++tries) {
+        std::string board(64, ' ');
+        for (size_t i = 0; i < material.size(); ++i) {
+            if (i == split) continue;
+            int sq;
+            do sq = rng() % 64;
+            while (board[sq] != ' ' || (material[i] == 'P' && (sq < 8 || sq >= 56)));
+            board[sq] = i < split ? material[i] : char(tolower(material[i]));
+        }
+        std::string fen;
+        for (int rank = 7; rank >= 0; --rank) {
+            int empty = 0;
+            for (int file = 0; file < 8; ++file) {
+                const char c = board[rank * 8 + file];
+                if (c == ' ') {
+                    ++empty;
+                    continue;
+                }
+                if (empty) fen += std::to_string(empty);
+                empty = 0;
+                fen += c;
+            }
+            if (empty) fen += std::to_string(empty);
+            if (rank) fen += '/';
+        }
+        const bool white = rng() & 1;
+        // the side that just moved cannot be in check
+        if (position_t(fen + (white ? " b" : " w") + " - - 0 1").kingIsInCheck()) continue;
+        fen += white ? " w - - 0 1" : " b - - 0 1";
+
+        position_t pos(fen);
+        int state = Tablebases::PS_OK;
+        const int wdl = Tablebases::probeWDL(pos, state);
+        const int dtz = state != Tablebases::PS_FAIL ? Tablebases::probeDTZ(pos, state) : 0;
+        movelist_t<220> ml;
+        pos.genLegal(ml);
+        int best = (ml.size || pos.kingIsInCheck()) ? -1 : 0;
+        undo_t undo;
+        int ply = 0;
+        for (move_t m : ml) {
+            pos.doMove(undo, m, ply);
+            best = std::max(best, -sign(Tablebases::probeWDL(pos, state)));
+            pos.undoMove(undo, ply);
+        }
+        // a promotion or a capture may lead to a table that is not there
+        if (state == Tablebases::PS_FAIL) {
+            ++skipped;
+            continue;
+        }
+        ++checked;
+        if (sign(wdl) != best || sign(dtz) != sign(wdl)) {
+            ++mismatches;
+            LogAndPrintOutput() << "mismatch: " << fen << " wdl: " << wdl << " dtz: " << dtz << " best after moves: " << best;
+        }
+        if (outfile) outfile << fen << " " << wdl << " " << dtz << "\n";
+    }
+    LogAndPrintOutput() << "positions: " << checked << " mismatches: " << mismatches << " skipped: " << skipped;
+}
+
+void uci_t::sliderbench(iss& stream) {
+    int iterations = 1000;
+    stream >> iterations;
+
+    // rook and bishop lookups from every square under the occupancies of real positions
+    std::vector<position_t> positions = benchPositionsAndChildren();
+    uint64_t checksum = 0;
+    uint64_t startTime = Utils::getTime();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto& pos : positions) {
+            for (int sq = 0; sq < 64; ++sq) {
+                checksum += Attacks::rookAttacksBB(sq, pos.occupiedBB) ^ Attacks::bishopAttacksBB(sq, pos.occupiedBB);
+            }
+        }
+    }
+    uint64_t spentTime = Utils::getTime() - startTime;
+    uint64_t lookups = uint64_t(iterations) * positions.size() * 64 * 2;
+    LogAndPrintOutput() << "backend: " << Attacks::sliderBackend() << " lookups: " << lookups << " checksum: " << checksum
+        << " time: " << spentTime << " ms lookups/sec: " << (lookups * 1000 / (spentTime + 1));
+}
+
+void uci_t::pickbench(iss& stream) {
+    iss streamcmd;
+    int iterations = 1000;
+    stream >> iterations;
+
+    streamcmd = iss("name Threads value 1");
+    setoption(streamcmd);
+    newgame();
+
+    // a short search per bench position leaves realistic history tables behind
+    search_t& s = *engine[0];
+    for (auto& fen : BenchPositions) {
+        streamcmd = iss("fen " + fen);
+        positioncmd(streamcmd);
+        streamcmd = iss("depth 9");
+        gocmd(streamcmd);
+        engine.waitForThreads();
+    }
+
+    std::vector<position_t> positions = benchPositionsAndChildren();
+    uint64_t picks = 0, checksum = 0;
+    uint64_t startTime = Utils::getTime();
+    Utils::withCpuPath([&](auto path) {
+        for (auto& pos : positions) {
+            s.pos = pos;
+            s.ply = 0;
+            const bool inCheck = s.pos.kingIsInCheck();
+            for (int i = 0; i < iterations; ++i) {
+                movepicker_t<decltype(path)::value> mp(s, inCheck, false, 1);
+                for (move_t m; mp.getMoves(m);) {
+                    ++picks;
+                    checksum = checksum * 31 + m.m;
+                }
+            }
+        }
+    });
+    uint64_t spentTime = Utils::getTime() - startTime;
+    LogAndPrintOutput() << "positions: " << positions.size() << " picks: " << picks << " checksum: " << checksum
+        << " time: " << spentTime << " ms picks/sec: " << (picks * 1000 / (spentTime + 1));
+}
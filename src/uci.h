@@ -31,7 +31,8 @@ private:
     void newgame();
     void displayID();
     void quit();
-    void tune();
+    void tune(iss& stream);
+    void tunepack(iss& stream);
     void see();
     void perftbench(iss& stream);
     void perft(iss& stream);
@@ -39,11 +40,19 @@ private:
     void moves();
     void displaypos();
     void speedup(iss& stream);
+    void bench(iss& stream);
+    void evalbench(iss& stream);
+    void evalfile(iss& stream);
+    void tbverify(iss& stream);
+    void pickbench(iss& stream);
+    void sliderbench(iss& stream);
+    std::vector<position_t> benchPositionsAndChildren();
 
     static const std::string name;
     static const std::string author;
     static const std::string year;
     static const std::string version;
+    static const std::vector<std::string> BenchPositions;
 
     engine_t engine;
 };
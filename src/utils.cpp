@@ -4,15 +4,90 @@
 /*  ed_apostol@yahoo.com                          */
 /**************************************************/
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <thread>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
 #include "typedefs.h"
 #include "utils.h"
 
 namespace Utils {
+    namespace {
+        void cpuid(int leaf, uint32_t regs[4]) {
 #ifdef _MSC_VER
+            __cpuidex((int*)regs, leaf, 0);
+#else
+            __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        }
 
-#include <intrin.h>
+        bool detectSSE41() {
+            uint32_t r[4];
+            cpuid(1, r);
+            return (r[2] & (1u << 9)) && (r[2] & (1u << 19));
+        }
+
+        int detectCpuPath() {
+            uint32_t r[4];
+            cpuid(0, r);
+            const uint32_t maxleaf = r[0];
+            const bool amd = r[1] == 0x68747541; // "Auth"enticAMD
+            const bool hygon = r[1] == 0x6f677948; // "Hygo"nGenuine
+            cpuid(1, r);
+            const int family = ((r[0] >> 8) & 0xf) + ((r[0] >> 20) & 0xff);
+            const bool popcnt = r[2] & (1u << 23);
+            const bool osxsave = r[2] & (1u << 27);
+            bool bmi2 = false, avx2 = false;
+            if (maxleaf >= 7) {
+                uint32_t r7[4];
+                cpuid(7, r7);
+                bmi2 = r7[1] & (1u << 8);
+                avx2 = r7[1] & (1u << 5);
+            }
+            // the os must save the ymm registers for avx2 to be usable
+            if (avx2 && osxsave) {
+#ifdef _MSC_VER
+                avx2 = (_xgetbv(0) & 6) == 6;
+#else
+                uint32_t lo, hi;
+                asm("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+                avx2 = (lo & 6) == 6;
+#endif
+            }
+            else avx2 = false;
+            // pext and pdep are microcoded before zen 3 and on the zen 1 based hygon dhyana, much slower
+            // than magics there. Only the sliders go back to magics, the avx2 kernels are kept
+            const int magics = (amd && family < 0x19) || (hygon && family == 0x18) ? CPU_MAGICS : 0;
+
+            if (!popcnt) return CPU_GENERIC;
+            if (!bmi2) return CPU_POPCNT;
+            if (!avx2) return CPU_BMI2 | magics;
+            return CPU_AVX2 | magics;
+        }
+    }
+
+    int detectedCpuPath() {
+        static const int path = [] {
+            const int detected = detectCpuPath();
+            return std::max(cpuLevel(detected), BuildPath) | (detected & CPU_MAGICS);
+        }();
+        return path;
+    }
+
+    const int CpuPath = detectedCpuPath();
+    const bool CpuSSE41 = detectSSE41();
+
+    const char* cpuPathName() {
+        static const char* names[] = { "generic", "popcnt", "bmi2", "avx2" };
+        return names[cpuLevel(CpuPath)];
+    }
+
+#ifdef _MSC_VER
 
 #pragma intrinsic(_BitScanForward64)
 #pragma intrinsic(_BitScanReverse64)
@@ -29,19 +104,6 @@ namespace Utils {
         b &= (b - 1);
         return index;
     }
-
-#ifdef NOPOPCNT
-    int bitCnt(uint64_t x) {
-        x -= (x >> 1) & 0x5555555555555555ULL;
-        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
-        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
-        return (x * 0x0101010101010101ULL) >> 56;
-    }
-#else
-    int bitCnt(uint64_t x) {
-        return __popcnt64(x);
-    }
-#endif
 #else
     int getFirstBit(uint64_t bb) {
         return __builtin_ctzll(bb);
@@ -52,10 +114,6 @@ namespace Utils {
         b &= (b - 1);
         return index;
     }
-
-    int bitCnt(uint64_t x) {
-        return __builtin_popcountll(x);
-    }
 #endif
 
     std::string printBitBoard(uint64_t b) {
@@ -79,6 +137,11 @@ namespace Utils {
         using namespace std::chrono;
         return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
     }
+
+    int clampThreads(int threads) {
+        const int maxthreads = std::max(1u, std::thread::hardware_concurrency());
+        return std::clamp(threads, 1, maxthreads);
+    }
 #ifndef _WIN32
     void bindThisThread(int index) { (void)index; };
 #else
@@ -7,17 +7,105 @@
 #pragma once
 
 #include <iostream>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__BMI2__)
+#include <immintrin.h>
+#endif
 #include "typedefs.h"
 #include "position.h"
 
 namespace Utils {
     extern std::string printBitBoard(uint64_t n);
     extern uint64_t getTime(void);
+    extern int clampThreads(int threads); // to [1, hardware threads]
     extern void bindThisThread(int index);
 
     extern int getFirstBit(uint64_t b);
     extern int popFirstBit(uint64_t& b);
-    extern int bitCnt(uint64_t b);
+
+    // the path the compiler flags already guarantee (e.g. -march=native), checks up to it fold away
+#if defined(__AVX2__) && defined(__BMI2__)
+    constexpr int BuildPath = CPU_AVX2;
+#elif defined(__BMI2__)
+    constexpr int BuildPath = CPU_BMI2;
+#elif defined(__POPCNT__)
+    constexpr int BuildPath = CPU_POPCNT;
+#else
+    constexpr int BuildPath = CPU_GENERIC;
+#endif
+    extern const int CpuPath; // a level, and CPU_MAGICS on cpus with slow pext
+    extern int detectedCpuPath(); // CpuPath, safe to call from static initialisers
+    extern const char* cpuPathName();
+    extern const bool CpuSSE41; // ssse3 and sse4.1, outside the path ladder since some popcnt cpus lack them
+    inline bool cpuHas(int level) {
+        return level <= BuildPath || cpuLevel(CpuPath) >= level;
+    }
+
+    // runs f with the cpu path as a compile-time constant. The search, perft and the evaluation take it
+    // once at their entry point and everything below them is instantiated for it. Bmi2 without pext
+    // sliders has nothing over popcnt and shares its kernels
+    template<typename F>
+    auto withCpuPath(F&& f) {
+        switch (detectedCpuPath()) {
+        case CPU_GENERIC: return f(std::integral_constant<int, CPU_GENERIC>());
+        case CPU_POPCNT: case CPU_BMI2 | CPU_MAGICS: return f(std::integral_constant<int, CPU_POPCNT>());
+        case CPU_BMI2: return f(std::integral_constant<int, CPU_BMI2>());
+        case CPU_AVX2 | CPU_MAGICS: return f(std::integral_constant<int, CPU_AVX2 | CPU_MAGICS>());
+        default: return f(std::integral_constant<int, CPU_AVX2>());
+        }
+    }
+    // expands M once per path withCpuPath can pick, for the explicit instantiations of the kernels
+#define FOR_EACH_CPU_PATH(M) M(CPU_GENERIC) M(CPU_POPCNT) M(CPU_BMI2) M(CPU_AVX2) M(CPU_AVX2 | CPU_MAGICS)
+
+    inline int swarBitCnt(uint64_t x) {
+        x -= (x >> 1) & 0x5555555555555555ULL;
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (x * 0x0101010101010101ULL) >> 56;
+    }
+
+    template<int path>
+    inline int bitCnt(uint64_t b) {
+        if constexpr (cpuLevel(path) < CPU_POPCNT && BuildPath < CPU_POPCNT) return swarBitCnt(b);
+        else {
+#if defined(__POPCNT__)
+            return __builtin_popcountll(b);
+#elif defined(_MSC_VER)
+            return int(__popcnt64(b));
+#else
+            // inline asm, so the baseline build can use popcnt in the kernels instantiated for it. The
+            // range hint lets the compiler use the count as an index without widening it again
+            uint64_t r;
+            asm("popcntq %1, %0" : "=r"(r) : "rm"(b));
+            if (r > 64) __builtin_unreachable();
+            return int(r);
+#endif
+        }
+    }
+
+    // for code outside the kernels, decided on every call
+    inline int bitCnt(uint64_t b) {
+        return cpuHas(CPU_POPCNT) ? bitCnt<CPU_POPCNT>(b) : bitCnt<CPU_GENERIC>(b);
+    }
+
+    // only valid when cpuHas(CPU_BMI2)
+#if defined(__BMI2__) || defined(_MSC_VER)
+    inline uint64_t pext(uint64_t b, uint64_t mask) { return _pext_u64(b, mask); }
+    inline uint64_t pdep(uint64_t b, uint64_t mask) { return _pdep_u64(b, mask); }
+#else
+    inline uint64_t pext(uint64_t b, uint64_t mask) {
+        uint64_t r;
+        asm("pextq %2, %1, %0" : "=r"(r) : "r"(b), "rm"(mask));
+        return r;
+    }
+    inline uint64_t pdep(uint64_t b, uint64_t mask) {
+        uint64_t r;
+        asm("pdepq %2, %1, %0" : "=r"(r) : "r"(b), "rm"(mask));
+        return r;
+    }
+#endif
 }
 
 template <LogLevel level, bool out = true, bool logtofile = false>